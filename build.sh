@@ -36,9 +36,9 @@ then
     cd ..
 fi
 
-echo -e "${GREEN}$0${OFF}: building e9patch and e9tool..."
+echo -e "${GREEN}$0${OFF}: building e9patch, e9tool and e9apply..."
 make clean
-make -j `nproc` tool release
+make -j `nproc` tool release apply
 
 echo -e "${GREEN}$0${OFF}: done...!"
 
@@ -0,0 +1,139 @@
+#!/bin/bash
+#
+# Benchmark the e9patch backend on a synthetic message stream.
+#
+# usage: ./e9bench.sh BINARY [E9PATCH ...]
+#
+# The stream is generated from the .text section of BINARY (using objdump),
+# and patches every instruction with a passthru trampoline.  Each E9PATCH
+# (default ./e9patch) is run $RUNS times on the same stream, and the best
+# time is reported.  To compare before/after, build the old version of
+# e9patch elsewhere and pass both binaries.
+#
+# If MALLOC=1, then each E9PATCH is also run once with a preloaded library
+# that counts the calls to malloc() (which includes operator new).
+
+if [ -t 1 ]
+then
+    GREEN="\033[32m"
+    YELLOW="\033[33m"
+    OFF="\033[0m"
+else
+    GREEN=
+    YELLOW=
+    OFF=
+fi
+
+set -e
+if [ $# -lt 1 ]
+then
+    echo "usage: $0 BINARY [E9PATCH ...]" >&2
+    exit 1
+fi
+BINARY=$(realpath "$1")
+shift
+if [ $# -eq 0 ]
+then
+    set -- ./e9patch
+fi
+RUNS=${RUNS:-3}
+mkdir -p tmp
+if [ "$MALLOC" = 1 ]
+then
+    cat > tmp/e9bench_malloc.c << 'EOF'
+#include <stdio.h>
+#include <stdlib.h>
+extern void *__libc_malloc(size_t size);
+static size_t count = 0;
+void *malloc(size_t size)
+{
+    count++;
+    return __libc_malloc(size);
+}
+__attribute__((__destructor__)) static void report(void)
+{
+    fprintf(stderr, "num_malloc_calls      = %zu\n", count);
+}
+EOF
+    gcc -O2 -shared -fPIC tmp/e9bench_malloc.c -o tmp/e9bench_malloc.so
+fi
+
+# Step (1): Generate the message stream:
+STREAM=tmp/bench.json
+TEXT=($(readelf -SW "$BINARY" | \
+    awk '{
+        for (i = 1; i < NF; i++)
+            if ($i == ".text")
+                print $(i+2), $(i+3)
+    }'))
+DELTA=$((16#${TEXT[0]} - 16#${TEXT[1]}))
+objdump -d -w --section=.text "$BINARY" | \
+    awk -F'\t' '
+    function hex(s, i, n)
+    {
+        n = 0
+        for (i = 1; i <= length(s); i++)
+            n = 16 * n + index("0123456789abcdef", substr(s, i, 1)) - 1
+        return n
+    }
+    /^ *[0-9a-f]+:\t/ {
+        addr = $1; sub(/:.*/, "", addr); gsub(/ /, "", addr);
+        print hex(addr), split($2, bytes, " ")
+    }' | sort -rn | \
+    awk -v binary="$BINARY" -v delta="$DELTA" '
+    BEGIN {
+        printf "{\"jsonrpc\":\"2.0\",\"method\":\"binary\",\"params\":" \
+            "{\"filename\":\"%s\",\"mode\":\"exe\"},\"id\":0}\n", binary
+        printf "{\"jsonrpc\":\"2.0\",\"method\":\"trampoline\",\"params\":" \
+            "{\"name\":\"passthru\",\"template\":[\"$instruction\"," \
+            "\"$continue\"]},\"id\":1}\n"
+        id = 2
+    }
+    {
+        addr[NR] = $1
+        printf "{\"jsonrpc\":\"2.0\",\"method\":\"instruction\",\"params\":" \
+            "{\"address\":%d,\"length\":%d,\"offset\":%d},\"id\":%d}\n",
+            $1, $2, $1 - delta, id++
+    }
+    END {
+        for (i = 1; i <= NR; i++)
+            printf "{\"jsonrpc\":\"2.0\",\"method\":\"patch\",\"params\":" \
+                "{\"trampoline\":\"passthru\",\"offset\":%d},\"id\":%d}\n",
+                addr[i] - delta, id++
+        printf "{\"jsonrpc\":\"2.0\",\"method\":\"emit\",\"params\":" \
+            "{\"filename\":\"tmp/bench.out\",\"format\":\"binary\"}," \
+            "\"id\":%d}\n", id
+    }' > $STREAM
+BYTES=$(stat -c %s $STREAM)
+MESSAGES=$(wc -l < $STREAM)
+echo -e "${GREEN}stream${OFF}: ${YELLOW}$STREAM${OFF} ($MESSAGES messages," \
+    "$BYTES bytes)"
+
+# Step (2): Time each backend:
+for E9PATCH in "$@"
+do
+    BEST=
+    for ((i = 0; i < RUNS; i++))
+    do
+        START=$(date +%s%N)
+        "$E9PATCH" -i $STREAM > tmp/bench.log 2>&1
+        END=$(date +%s%N)
+        TIME=$(( (END - START) / 1000000 ))
+        if [ -z "$BEST" ] || [ $TIME -lt $BEST ]
+        then
+            BEST=$TIME
+        fi
+    done
+    [ $BEST -gt 0 ] || BEST=1
+    echo -e "${GREEN}$E9PATCH${OFF}: ${BEST}ms," \
+        "$(( BYTES * 1000 / BEST / 1048576 ))MB/s," \
+        "$(( MESSAGES * 1000 / BEST )) messages/s"
+    if [ "$MALLOC" = 1 ]
+    then
+        LD_PRELOAD="$PWD/tmp/e9bench_malloc.so" "$E9PATCH" -i $STREAM \
+            > tmp/bench.log 2> tmp/bench.err
+        cat tmp/bench.err >> tmp/bench.log
+    fi
+    grep -a -E '^(num_patched |num_patch_records|num_malloc_calls)' \
+        tmp/bench.log || true
+done
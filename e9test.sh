@@ -79,3 +79,206 @@ do
     fi
 done
 
+
+# Encode an unsigned LEB128 varint (as printf escapes).
+varint()
+{
+    local X=$1
+    while [ $X -ge 128 ]
+    do
+        printf '\\x%02x' $(( (X & 0x7F) | 0x80 ))
+        X=$((X >> 7))
+    done
+    printf '\\x%02x' $X
+}
+
+# Encode a binary "trampoline" message whose size is exactly $1 bytes.
+binary_trampoline()
+{
+    local SIZE=$1 LEN=0 REC BODY
+    while true
+    do
+        REC=$((1 + $(varint $LEN | wc -c) / 4 + LEN))
+        BODY=$((6 + $(varint $REC | wc -c) / 4 + REC))
+        [ $BODY -ge $SIZE ] && break
+        LEN=$((LEN + 1))
+    done
+    printf '\\xe9%s\\x07\\x01\\x0c\\x01t\\x0f%s\\x01%s' "$(varint $SIZE)" \
+        "$(varint $REC)" "$(varint $LEN)"
+    for ((i = 0; i < LEN; i++))
+    do
+        printf '\\x90'
+    done
+}
+
+# Binary protocol: message sizes where the size varint contains 0xFF.
+for SIZE in 254 255 256 383 511
+do
+    {
+        echo '{"jsonrpc":"2.0","method":"binary","params":{"filename":' \
+            '"e9patch","mode":"exe"},"id":0}'
+        echo '{"jsonrpc":"2.0","method":"option","params":{"protocol":' \
+            '"binary"},"id":1}'
+        printf '%b' "$(binary_trampoline $SIZE)"
+        echo '{"jsonrpc":"2.0","method":"emit","params":{"filename":' \
+            '"tmp/binary.patched","format":"binary"},"id":3}'
+    } > tmp/binary.$SIZE.msgs
+    if ./e9patch -i tmp/binary.$SIZE.msgs >/dev/null 2>&1 &&
+        cat tmp/binary.$SIZE.msgs | ./e9patch >/dev/null 2>&1
+    then
+        echo -e "${GREEN}PASSED${OFF}: binary  ${YELLOW}$SIZE byte message${OFF}"
+    else
+        echo -e "${RED}FAILED${OFF}: binary  ${YELLOW}$SIZE byte message${OFF}"
+    fi
+done
+
+# Binary protocol: template labels need not begin with `.L' (same as JSON).
+for PROTOCOL in json binary
+do
+    {
+        echo '{"jsonrpc":"2.0","method":"binary","params":{"filename":' \
+            '"e9patch","mode":"exe"},"id":0}'
+        echo '{"jsonrpc":"2.0","method":"option","params":{"protocol":' \
+            "\"$PROTOCOL\"},\"id\":1}"
+        if [ $PROTOCOL = binary ]
+        then
+            printf '\xe9\x10\x07\x02\x0c\x01t\x0f\x09\x03\x04.foo\x01\x01\x90'
+        else
+            echo '{"jsonrpc":"2.0","method":"trampoline","params":{"name":' \
+                '"t","template":[".foo",144]},"id":2}'
+        fi
+        echo '{"jsonrpc":"2.0","method":"emit","params":{"filename":' \
+            "\"tmp/label.$PROTOCOL.patched\",\"format\":\"binary\"},\"id\":3}"
+    } > tmp/label.$PROTOCOL.msgs
+done
+if ./e9patch -i tmp/label.json.msgs >/dev/null 2>&1 &&
+    ./e9patch -i tmp/label.binary.msgs >/dev/null 2>&1 &&
+    diff tmp/label.json.patched tmp/label.binary.patched > /dev/null
+then
+    echo -e "${GREEN}PASSED${OFF}: binary  ${YELLOW}.foo label${OFF}"
+else
+    echo -e "${RED}FAILED${OFF}: binary  ${YELLOW}.foo label${OFF}"
+fi
+
+# Output modes: each must give the same output as the reference.
+ACTION='call entry(asm,instr,rflags,rdi,rip,addr,target,next)@nop'
+./e9tool ./e9patch --match true "--action=$ACTION" \
+    -o tmp/reference.patched -c 6 -s >/dev/null 2>&1
+if ./e9tool --threads 4 ./e9patch --match true "--action=$ACTION" \
+        -o tmp/threads.patched -c 6 -s >/dev/null 2>&1 &&
+    diff tmp/reference.patched tmp/threads.patched > /dev/null
+then
+    echo -e "${GREEN}PASSED${OFF}: e9tool  ${YELLOW}--threads 4${OFF}"
+else
+    echo -e "${RED}FAILED${OFF}: e9tool  ${YELLOW}--threads 4${OFF}"
+fi
+if ./e9tool --protocol binary ./e9patch --match true "--action=$ACTION" \
+        -o tmp/protocol.patched -c 6 -s >/dev/null 2>&1 &&
+    diff tmp/reference.patched tmp/protocol.patched > /dev/null
+then
+    echo -e "${GREEN}PASSED${OFF}: e9tool  ${YELLOW}--protocol binary${OFF}"
+else
+    echo -e "${RED}FAILED${OFF}: e9tool  ${YELLOW}--protocol binary${OFF}"
+fi
+rm -f tmp/delta.delta
+if ./e9tool --format delta ./e9patch --match true "--action=$ACTION" \
+        -o tmp/delta -c 6 -s >/dev/null 2>&1 &&
+    ./e9apply ./e9patch tmp/delta.delta tmp/delta.patched >/dev/null 2>&1 &&
+    diff tmp/reference.patched tmp/delta.patched > /dev/null
+then
+    echo -e "${GREEN}PASSED${OFF}: e9apply ${YELLOW}--format delta${OFF}"
+else
+    echo -e "${RED}FAILED${OFF}: e9apply ${YELLOW}--format delta${OFF}"
+fi
+
+# Backend options: the output may differ from the reference, but must be
+# deterministic, and the patched backend must reproduce the reference.
+readelf -h ./e9patch | awk '/Entry point/ {print $4 ",100"}' \
+    > tmp/e9patch.prof
+for OPTION in \
+    '--threads=4' \
+    '--load-segments' \
+    '--lazy-load' \
+    '--huge-pages' \
+    '--profile=tmp/e9patch.prof'
+do
+    if ./e9tool ./e9patch --match true --action=passthru "--option=$OPTION" \
+            -o tmp/option.patched -c 6 -s >/dev/null 2>&1 &&
+        ./e9tool ./e9patch --match true --action=passthru \
+            "--option=$OPTION" -o tmp/option.2.patched -c 6 -s \
+            >/dev/null 2>&1 &&
+        diff tmp/option.patched tmp/option.2.patched > /dev/null &&
+        ./e9tool --backend "$PWD/tmp/option.patched" ./e9patch \
+            --match true "--action=$ACTION" -o tmp/option.3.patched -c 6 -s \
+            >/dev/null 2>&1 &&
+        diff tmp/reference.patched tmp/option.3.patched > /dev/null
+    then
+        echo -e "${GREEN}PASSED${OFF}: e9patch ${YELLOW}$OPTION${OFF}"
+    else
+        echo -e "${RED}FAILED${OFF}: e9patch ${YELLOW}$OPTION${OFF}"
+    fi
+done
+
+# Library API: the example frontend must give the same output as e9patch.
+TEXT=($(readelf -SW ./e9patch | \
+    awk '{
+        for (i = 1; i < NF; i++)
+            if ($i == ".text")
+                print $(i+2), $(i+3)
+    }'))
+DELTA=$((16#${TEXT[0]} - 16#${TEXT[1]}))
+objdump -d -w --section=.text ./e9patch | \
+    awk -F'\t' -v delta="$DELTA" '
+    function hex(s, i, n)
+    {
+        n = 0
+        for (i = 1; i <= length(s); i++)
+            n = 16 * n + index("0123456789abcdef", substr(s, i, 1)) - 1
+        return n
+    }
+    /^ *[0-9a-f]+:\t/ {
+        addr = $1; sub(/:.*/, "", addr); gsub(/ /, "", addr);
+        print hex(addr), split($2, bytes, " "), hex(addr) - delta
+    }' > tmp/passthru.instrs
+awk '
+    BEGIN {
+        print "{\"jsonrpc\":\"2.0\",\"method\":\"binary\",\"params\":" \
+            "{\"filename\":\"e9patch\",\"mode\":\"exe\"},\"id\":0}"
+        print "{\"jsonrpc\":\"2.0\",\"method\":\"trampoline\",\"params\":" \
+            "{\"name\":\"passthru\",\"template\":[\"$instruction\"," \
+            "\"$continue\"]},\"id\":0}"
+    }
+    {
+        offset[NR] = $3
+        printf "{\"jsonrpc\":\"2.0\",\"method\":\"instruction\",\"params\":" \
+            "{\"address\":%d,\"length\":%d,\"offset\":%d},\"id\":%d}\n",
+            $1, $2, $3, NR
+    }
+    END {
+        for (i = NR; i >= 1; i--)
+            printf "{\"jsonrpc\":\"2.0\",\"method\":\"patch\",\"params\":" \
+                "{\"trampoline\":\"passthru\",\"offset\":%d},\"id\":%d}\n",
+                offset[i], i
+        printf "{\"jsonrpc\":\"2.0\",\"method\":\"emit\",\"params\":" \
+            "{\"filename\":\"tmp/e9patch.json.patched\",\"format\":" \
+            "\"binary\"},\"id\":%d}\n", NR + 1
+    }' tmp/passthru.instrs > tmp/passthru.json
+if make lib >/dev/null 2>&1 &&
+    g++ -std=c++14 -O2 -I src/e9patch/ -o tmp/passthru \
+        examples/frontend/passthru.cpp libe9patch.a -pthread >/dev/null 2>&1 &&
+    ./e9patch -i tmp/passthru.json >/dev/null 2>&1 &&
+    tmp/passthru ./e9patch tmp/e9patch.api.patched < tmp/passthru.instrs \
+        >/dev/null 2>&1 &&
+    diff tmp/e9patch.json.patched tmp/e9patch.api.patched > /dev/null
+then
+    echo -e "${GREEN}PASSED${OFF}: e9api   ${YELLOW}passthru${OFF}"
+else
+    echo -e "${RED}FAILED${OFF}: e9api   ${YELLOW}passthru${OFF}"
+fi
+if echo '4096 16 0' | tmp/passthru ./e9patch tmp/e9patch.api.patched 2>&1 |
+    grep -q 'message (id=1); "length"'
+then
+    echo -e "${GREEN}PASSED${OFF}: e9api   ${YELLOW}error id${OFF}"
+else
+    echo -e "${RED}FAILED${OFF}: e9api   ${YELLOW}error id${OFF}"
+fi
@@ -0,0 +1,76 @@
+/*
+ * passthru.cpp
+ * Copyright (C) 2020 National University of Singapore
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This is an example frontend that calls the E9Patch backend in-process
+ * using the typed API (libe9patch.a).  It reads a list of instructions, one
+ * "ADDRESS LENGTH OFFSET" triple per line, and patches every instruction
+ * with a passthru trampoline.  The output is the same as sending the
+ * equivalent "instruction" and "patch" messages to the e9patch tool.  The
+ * line number is used as the message id in error messages.
+ *
+ * To compile:
+ *          $ make lib
+ *          $ g++ -std=c++14 -O2 -I src/e9patch/ -o passthru \
+ *              examples/frontend/passthru.cpp libe9patch.a -pthread
+ *
+ * To use:
+ *          $ ./passthru program a.out < instructions.txt
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <vector>
+
+#include "e9api.h"
+#include "e9patch.h"
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s BINARY OUTPUT < INSTRUCTIONS\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    unsigned id = 0;
+    Binary *B = makeBinary(argv[1], MODE_EXECUTABLE);
+    Trampoline *T = parseTrampoline("[\"$instruction\", \"$continue\"]");
+    addTrampoline(B, "passthru", T, id++);
+
+    std::vector<std::pair<off_t, unsigned>> offsets;
+    intptr_t address;
+    size_t length;
+    off_t offset;
+    while (scanf("%zd %zu %zd", &address, &length, &offset) == 3)
+    {
+        addInstruction(B, address, length, offset, id);
+        offsets.push_back(std::make_pair(offset, id++));
+    }
+
+    // Patches must be applied in reverse order:
+    std::sort(offsets.begin(), offsets.end());
+    for (auto i = offsets.rbegin(); i != offsets.rend(); ++i)
+        patchInstruction(B, i->first, T, nullptr, i->second);
+
+    emitPatchedBinary(B, argv[2], FORMAT_BINARY, PAGE_SIZE, id);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,334 @@
+/*
+ * e9apply.cpp
+ * Copyright (C) 2020 National University of Singapore
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reconstruct a patched binary from the original binary and a delta file
+ * generated by e9patch using the "delta" or "delta.xz" format.
+ *
+ * usage: e9apply ORIGINAL DELTA OUTPUT
+ */
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef E9_LZMA
+#include <lzma.h>
+#endif
+
+#include "e9delta.h"
+
+#define NO_RETURN               __attribute__((__noreturn__))
+
+static bool option_is_tty = false;
+
+/*
+ * Report an error and exit.
+ */
+static void NO_RETURN error(const char *msg, ...)
+{
+    fprintf(stderr, "%serror%s: ",
+        (option_is_tty? "\33[31m": ""),
+        (option_is_tty? "\33[0m" : ""));
+
+    va_list ap;
+    va_start(ap, msg);
+    vfprintf(stderr, msg, ap);
+    va_end(ap);
+    putc('\n', stderr);
+
+    _Exit(EXIT_FAILURE);
+}
+
+/*
+ * Delta record stream reader.
+ */
+struct DeltaReader
+{
+    const char *filename;               // Delta filename.
+    const uint8_t *ptr;                 // Next (compressed) input byte.
+    const uint8_t *end;                 // End of the input.
+#ifdef E9_LZMA
+    lzma_stream *xz;                    // Decompressor (or nullptr).
+#endif
+};
+
+/*
+ * Read exactly `len' bytes from the record stream.  If the stream is not
+ * compressed, then `buf' may be nullptr, in which case a pointer into the
+ * mapped delta file is returned instead.
+ */
+static const uint8_t *deltaRead(DeltaReader &R, uint8_t *buf, size_t len)
+{
+#ifdef E9_LZMA
+    if (R.xz == nullptr)
+#endif
+    {
+        if ((size_t)(R.end - R.ptr) < len)
+            error("failed to read delta file \"%s\"; unexpected end-of-file",
+                R.filename);
+        const uint8_t *ptr = R.ptr;
+        R.ptr += len;
+        if (buf == nullptr)
+            return ptr;
+        memcpy(buf, ptr, len);
+        return buf;
+    }
+
+#ifdef E9_LZMA
+    R.xz->next_out  = buf;
+    R.xz->avail_out = len;
+    while (R.xz->avail_out > 0)
+    {
+        R.xz->next_in  = R.ptr;
+        R.xz->avail_in = R.end - R.ptr;
+        lzma_ret r = lzma_code(R.xz, LZMA_FINISH);
+        R.ptr = R.xz->next_in;
+        if (r == LZMA_STREAM_END && R.xz->avail_out > 0)
+            error("failed to read delta file \"%s\"; unexpected end of "
+                "compressed stream", R.filename);
+        if (r != LZMA_OK && r != LZMA_STREAM_END)
+            error("failed to decompress delta file \"%s\"; xz error %d",
+                R.filename, (int)r);
+    }
+    return buf;
+#endif
+}
+
+/*
+ * Write bytes to the output at the given offset.
+ */
+static void writeOutput(int fd, const char *filename, const uint8_t *buf,
+    size_t len, off_t offset)
+{
+    for (size_t k = 0; k < len; )
+    {
+        ssize_t r = pwrite(fd, buf + k, len - k, offset + k);
+        if (r < 0)
+            error("failed to write output to file \"%s\": %s", filename,
+                strerror(errno));
+        k += (size_t)r;
+    }
+}
+
+/*
+ * Copy bytes from the original binary to the output at the same offset.
+ * Uses copy_file_range() where possible (which avoids copying the data
+ * through user space, and may share extents on some file systems), and
+ * falls back to the mapped original otherwise.
+ */
+static void copyOutput(int fd_in, const uint8_t *original, int fd_out,
+    const char *filename, size_t len, off_t offset)
+{
+    static bool use_copy_file_range = true;
+    off_t off_in = offset, off_out = offset;
+    while (use_copy_file_range && len > 0)
+    {
+        ssize_t r = copy_file_range(fd_in, &off_in, fd_out, &off_out, len, 0);
+        if (r < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                errno == EOPNOTSUPP))
+        {
+            use_copy_file_range = false;
+            break;
+        }
+        if (r < 0)
+            error("failed to copy data to file \"%s\": %s", filename,
+                strerror(errno));
+        if (r == 0)
+            error("failed to copy data to file \"%s\"; unexpected "
+                "end-of-file", filename);
+        len -= (size_t)r;
+    }
+    writeOutput(fd_out, filename, original + off_in, len, off_out);
+}
+
+/*
+ * Map a file into memory.
+ */
+static const uint8_t *mapFile(const char *filename, int *fd_ptr,
+    size_t *size_ptr)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        error("failed to open file \"%s\" for reading: %s", filename,
+            strerror(errno));
+    struct stat buf;
+    if (fstat(fd, &buf) != 0)
+        error("failed to stat file \"%s\": %s", filename, strerror(errno));
+    size_t size = (size_t)buf.st_size;
+    const uint8_t *ptr = nullptr;
+    if (size > 0)
+    {
+        void *mem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED)
+            error("failed to map file \"%s\": %s", filename,
+                strerror(errno));
+        ptr = (const uint8_t *)mem;
+    }
+    *fd_ptr   = fd;
+    *size_ptr = size;
+    return ptr;
+}
+
+/*
+ * Entry.
+ */
+int main(int argc, char **argv)
+{
+    option_is_tty = (isatty(STDERR_FILENO) != 0);
+    if (argc != 4)
+    {
+        fprintf(stderr, "usage: %s ORIGINAL DELTA OUTPUT\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *original_filename = argv[1];
+    const char *delta_filename    = argv[2];
+    const char *output_filename   = argv[3];
+
+    int original_fd, delta_fd;
+    size_t original_size, delta_size;
+    const uint8_t *original = mapFile(original_filename, &original_fd,
+        &original_size);
+    const uint8_t *delta = mapFile(delta_filename, &delta_fd, &delta_size);
+
+    // Check the header:
+    DeltaHeader header;
+    if (delta_size < sizeof(header))
+        error("failed to read delta file \"%s\"; file is too small",
+            delta_filename);
+    memcpy(&header, delta, sizeof(header));
+    if (memcmp(header.magic, DELTA_MAGIC, sizeof(DELTA_MAGIC)) != 0)
+        error("failed to read delta file \"%s\"; invalid magic number",
+            delta_filename);
+    if (header.version != DELTA_VERSION)
+        error("failed to read delta file \"%s\"; unsupported version %u",
+            delta_filename, header.version);
+    if (header.original_size != original_size)
+        error("failed to apply delta file \"%s\"; size of original file "
+            "\"%s\" (%zu) does not match the expected size (%zu)",
+            delta_filename, original_filename, original_size,
+            (size_t)header.original_size);
+
+    DeltaReader R;
+    R.filename = delta_filename;
+    R.ptr      = delta + sizeof(header);
+    R.end      = delta + delta_size;
+    bool compressed = ((header.flags & DELTA_FLAG_XZ) != 0);
+#ifdef E9_LZMA
+    R.xz       = nullptr;
+    lzma_stream xz = LZMA_STREAM_INIT;
+    if (compressed)
+    {
+        lzma_ret r = lzma_stream_decoder(&xz, UINT64_MAX, 0);
+        if (r != LZMA_OK)
+            error("failed to initialize xz decompressor; xz error %d",
+                (int)r);
+        R.xz = &xz;
+    }
+#else
+    if (compressed)
+        error("failed to apply delta file \"%s\"; the file is "
+            "xz-compressed, which requires e9apply to be built with xz "
+            "support (E9_LZMA=1)", delta_filename);
+#endif
+
+    int fd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC,
+        S_IRUSR | S_IWUSR | S_IXUSR |
+        S_IRGRP | S_IWGRP | S_IXGRP |
+        S_IROTH | S_IWOTH | S_IXOTH);
+    if (fd < 0)
+        error("failed to open output file \"%s\" for writing: %s",
+            output_filename, strerror(errno));
+    if (ftruncate(fd, (off_t)header.patched_size) != 0)
+        error("failed to resize output file \"%s\": %s", output_filename,
+            strerror(errno));
+
+    // Apply the records:
+    uint8_t buf[BUFSIZ];
+    uint64_t offset = 0;
+    while (true)
+    {
+        DeltaRecord record;
+        deltaRead(R, (uint8_t *)&record, sizeof(record));
+        if (record.offset != offset ||
+                record.length > header.patched_size - offset)
+            error("failed to apply delta file \"%s\"; invalid record at "
+                "offset %zu", delta_filename, (size_t)offset);
+        switch (record.kind)
+        {
+            case DELTA_END:
+                break;
+            case DELTA_COPY:
+                if (record.offset + record.length > original_size)
+                    error("failed to apply delta file \"%s\"; copy record "
+                        "exceeds the original file size", delta_filename);
+                copyOutput(original_fd, original, fd, output_filename,
+                    record.length, record.offset);
+                offset += record.length;
+                continue;
+            case DELTA_INSERT:
+                if (!compressed)
+                {
+                    const uint8_t *data = deltaRead(R, nullptr,
+                        record.length);
+                    writeOutput(fd, output_filename, data, record.length,
+                        record.offset);
+                    offset += record.length;
+                    continue;
+                }
+                for (uint64_t k = 0; k < record.length; )
+                {
+                    size_t len = (size_t)std::min((uint64_t)sizeof(buf),
+                        record.length - k);
+                    deltaRead(R, buf, len);
+                    writeOutput(fd, output_filename, buf, len,
+                        record.offset + k);
+                    k += len;
+                }
+                offset += record.length;
+                continue;
+            default:
+                error("failed to apply delta file \"%s\"; unknown record "
+                    "kind 0x%.2X", delta_filename, (unsigned)record.kind);
+        }
+        break;
+    }
+    if (offset != header.patched_size)
+        error("failed to apply delta file \"%s\"; records do not cover the "
+            "patched file", delta_filename);
+
+#ifdef E9_LZMA
+    if (compressed)
+        lzma_end(&xz);
+#endif
+    if (close(fd) < 0)
+        error("failed to close output file \"%s\": %s", output_filename,
+            strerror(errno));
+    return EXIT_SUCCESS;
+}
@@ -91,32 +91,94 @@ RB_GENERATE_STATIC(Tree, Node, entry, compare);
 #define FLAG_LB                     0x1
 #define FLAG_UB                     0x2
 #define FLAG_SAME_PAGE              0x4
+#define FLAG_ALIGN                  0x8
+
+#define CACHE_LINE_SIZE             64
 
 #define flag_set(flags, flag, val)  \
     ((val)? (flags) | (flag): (flags) & ~(flag))
 
-static Node *insert(Node *root, intptr_t lb, intptr_t ub, size_t size,
-    uint32_t flags);
+static Node *insert(Allocator &allocator, Node *root, intptr_t lb,
+    intptr_t ub, size_t size, uint32_t flags);
+
+/*
+ * Node slab allocator.
+ *
+ * Nodes are allocated from large contiguous chunks, and freed nodes are
+ * kept on an intrusive free list for reuse.  The T3 tactic speculatively
+ * allocates and deallocates nodes in tight loops, so this is much faster
+ * than malloc()/free(), and keeps the tree nodes close together in memory.
+ * Each allocator has its own slab, so allocators used by different threads
+ * share no state.
+ */
+#define SLAB_CHUNK_SIZE             (1 << 20)
+#define SLAB_CHUNK_NODES            (SLAB_CHUNK_SIZE / sizeof(Node))
+
+union FreeNode
+{
+    Node node;                      // Node storage
+    FreeNode *next;                 // Next free node
+};
 
 /*
  * Allocate a node.
  */
-static Node *alloc()
+static Node *alloc(Allocator &allocator)
 {
-    Node *n = (Node *)malloc(sizeof(Node));
-    if (n == nullptr)
-        error("failed to allocate %zu bytes for interval tree node: %s",
-            sizeof(Node), strerror(ENOMEM));
+    auto &slab  = allocator.slab;
+    FreeNode *f = (FreeNode *)slab.free;
+    if (f != nullptr)
+        slab.free = f->next;
+    else
+    {
+        if (slab.chunk == nullptr || slab.used >= SLAB_CHUNK_NODES)
+        {
+            slab.chunk = malloc(SLAB_CHUNK_NODES * sizeof(FreeNode));
+            if (slab.chunk == nullptr)
+                error("failed to allocate %zu bytes for interval tree "
+                    "nodes: %s", SLAB_CHUNK_NODES * sizeof(FreeNode),
+                    strerror(ENOMEM));
+            slab.chunks.push_back(slab.chunk);
+            slab.used   = 0;
+            slab.bytes += SLAB_CHUNK_NODES * sizeof(FreeNode);
+        }
+        f = (FreeNode *)slab.chunk + slab.used++;
+        slab.slots++;
+    }
+    slab.nodes++;
+    slab.peak = std::max(slab.peak, slab.nodes);
+
+    Node *n = &f->node;
     n->alloc.T = nullptr;
     n->alloc.I = nullptr;
     return n;
 }
 
+/*
+ * Free a node.
+ */
+static void dealloc(Allocator &allocator, Node *n)
+{
+    FreeNode *f = (FreeNode *)n;
+    f->next = (FreeNode *)allocator.slab.free;
+    allocator.slab.free = f;
+    allocator.slab.nodes--;
+}
+
+/*
+ * Destroy an allocator.
+ */
+Allocator::~Allocator()
+{
+    for (void *chunk: slab.chunks)
+        free(chunk);
+}
+
 /*
  * Allocate and initialize a new interval tree node.
  */
-static Node *node(Node *parent, intptr_t lb, intptr_t ub, size_t size,
-    uint32_t flags)
+static Node *node(Allocator &allocator, Node *parent, intptr_t lb,
+    intptr_t ub, size_t size, uint32_t flags)
 {
     bool alloc_left = ((flags & FLAG_LB) != 0 || (flags & FLAG_UB) == 0);
     intptr_t LB, UB;
@@ -131,24 +193,42 @@ static Node *node(Node *parent, intptr_t lb, intptr_t ub, size_t size,
         UB = ub;
     }
 
+    bool align = ((flags & FLAG_ALIGN) != 0);
+    if (align)
+    {
+        intptr_t offset = (LB % CACHE_LINE_SIZE + CACHE_LINE_SIZE) %
+            CACHE_LINE_SIZE;
+        offset = (alloc_left && offset != 0? CACHE_LINE_SIZE - offset:
+            -offset);
+        LB += offset;
+        UB += offset;
+    }
+
     bool same_page   = ((flags & FLAG_SAME_PAGE) != 0);
     bool spans_pages = (LB / PAGE_SIZE != (UB-1) / PAGE_SIZE);
     if (same_page && spans_pages)
     {
         off_t offset = (alloc_left?
-            (off_t)PAGE_SIZE - std::abs((intptr_t)(lb % PAGE_SIZE)):
-            -std::abs((intptr_t)(ub % PAGE_SIZE)));
+            (off_t)PAGE_SIZE - std::abs((intptr_t)(LB % PAGE_SIZE)):
+            -std::abs((intptr_t)(UB % PAGE_SIZE)));
         LB += offset;
         UB += offset;
-        assert(LB / PAGE_SIZE == (UB-1) / PAGE_SIZE);
-        if (LB < lb || UB > ub)
+        if (align && !alloc_left)
         {
-            // Cannot fit into the current page == fail.
-            return nullptr;
+            offset = (LB % CACHE_LINE_SIZE + CACHE_LINE_SIZE) %
+                CACHE_LINE_SIZE;
+            LB -= offset;
+            UB -= offset;
         }
+        assert(LB / PAGE_SIZE == (UB-1) / PAGE_SIZE);
+    }
+    if (LB < lb || UB > ub)
+    {
+        // Cannot fit into the current page/cache line == fail.
+        return nullptr;
     }
 
-    Node *n = alloc();
+    Node *n = alloc(allocator);
     n->alloc.lb     = LB;
     n->alloc.ub     = UB;
     n->lb           = LB;
@@ -164,8 +244,8 @@ static Node *node(Node *parent, intptr_t lb, intptr_t ub, size_t size,
 /*
  * Insert left-child helper.
  */
-static Node *insertLeftChild(Node *root, intptr_t lb, intptr_t ub, size_t size,
-    uint32_t flags)
+static Node *insertLeftChild(Allocator &allocator, Node *root, intptr_t lb,
+    intptr_t ub, size_t size, uint32_t flags)
 {
     ub = std::min(ub, root->alloc.lb);
     if ((intptr_t)size > ub - lb)
@@ -174,17 +254,17 @@ static Node *insertLeftChild(Node *root, intptr_t lb, intptr_t ub, size_t size,
         (root->alloc.lb - ub < (ssize_t)PAGE_SIZE));
     Node *n;
     if (root->entry.left == nullptr)
-        n = root->entry.left = node(root, lb, ub, size, flags);
+        n = root->entry.left = node(allocator, root, lb, ub, size, flags);
     else
-        n = insert(root->entry.left, lb, ub, size, flags);
+        n = insert(allocator, root->entry.left, lb, ub, size, flags);
     return n;
 }
 
 /*
  * Insert right-child helper.
  */
-static Node *insertRightChild(Node *root, intptr_t lb, intptr_t ub,
-    size_t size, uint32_t flags)
+static Node *insertRightChild(Allocator &allocator, Node *root, intptr_t lb,
+    intptr_t ub, size_t size, uint32_t flags)
 {
     lb = std::max(lb, root->alloc.ub);
     if ((intptr_t)size > ub - lb)
@@ -193,22 +273,22 @@ static Node *insertRightChild(Node *root, intptr_t lb, intptr_t ub,
         (lb - root->alloc.ub < (ssize_t)PAGE_SIZE));
     Node *n;
     if (root->entry.right == nullptr)
-        n = root->entry.right = node(root, lb, ub, size, flags);
+        n = root->entry.right = node(allocator, root, lb, ub, size, flags);
     else
-        n = insert(root->entry.right, lb, ub, size, flags);
+        n = insert(allocator, root->entry.right, lb, ub, size, flags);
     return n;
 }
 
 /*
  * Insert a new allocation or reservation into the interval tree node `root`.
  */
-static Node *insert(Node *root, intptr_t lb, intptr_t ub, size_t size,
-    uint32_t flags)
+static Node *insert(Allocator &allocator, Node *root, intptr_t lb,
+    intptr_t ub, size_t size, uint32_t flags)
 {
     if ((intptr_t)size > ub - lb)
         return nullptr;
     if (root == nullptr)
-        return node(nullptr, lb, ub, size, flags);
+        return node(allocator, nullptr, lb, ub, size, flags);
 
     Node *n = nullptr;
     if (size <= root->gap)
@@ -216,14 +296,16 @@ static Node *insert(Node *root, intptr_t lb, intptr_t ub, size_t size,
         intptr_t rlb = std::max(lb, root->lb);
         intptr_t rub = std::min(ub, root->ub);
         if (n == nullptr)
-            n = insertRightChild(root, rlb, rub, size, flags);
+            n = insertRightChild(allocator, root, rlb, rub, size, flags);
         if (n == nullptr)
-            n = insertLeftChild(root, rlb, rub, size, flags);
+            n = insertLeftChild(allocator, root, rlb, rub, size, flags);
     }
     if (n == nullptr && ub > root->ub)
-        n = insertRightChild(root, std::max(lb, root->ub), ub, size, flags);
+        n = insertRightChild(allocator, root, std::max(lb, root->ub), ub,
+            size, flags);
     if (n == nullptr && lb < root->lb)
-        n = insertLeftChild(root, lb, std::min(ub, root->lb), size, flags);
+        n = insertLeftChild(allocator, root, lb, std::min(ub, root->lb),
+            size, flags);
 
     if (n != nullptr)
         fix(root);
@@ -245,9 +327,144 @@ static bool verify(intptr_t lb, intptr_t ub)
     return false;
 }
 
+/*
+ * Get the key of a shared trampoline.  The key is the trampoline bytes
+ * (prefixed by the protections), which are the same for all addresses.
+ */
+static std::string sharedKey(const Trampoline *T, const Instr *I, size_t size)
+{
+    std::string key(size + 1, '\0');
+    key[0] = (char)T->prot;
+    flattenTrampoline((uint8_t *)&key[1], size, /*offset32=*/0, T, I);
+    return key;
+}
+
+/*
+ * Find an existing shared trampoline identical to (T, I) with an address
+ * within the range [lb..ub].  Returns the allocation, or nullptr if none
+ * exists.
+ */
+static const Alloc *findShared(Allocator &allocator, const std::string &key,
+    intptr_t lb, intptr_t ub, size_t size, bool same_page)
+{
+    auto i = allocator.shared.find(key);
+    if (i == allocator.shared.end())
+        return nullptr;
+    auto &nodes = i->second;
+    for (auto j = nodes.lower_bound(lb); j != nodes.end() && j->first <= ub;
+            ++j)
+    {
+        intptr_t addr = j->first;
+        if (same_page && addr / PAGE_SIZE != (addr + size - 1) / PAGE_SIZE)
+            continue;
+        j->second.second++;
+        return &j->second.first->alloc;
+    }
+    return nullptr;
+}
+
+#define WINDOW_RANGE_MIN            ((intptr_t)1 << 30)
+#define HOT_WINDOW_SIZE             ((intptr_t)(16 * PAGE_SIZE))
+
+/*
+ * Insert a new allocation into an open window, i.e., a huge page window
+ * (--huge-pages) or a hot window (--profile).  Windows that are too full
+ * for the allocation are closed, unless the failure may be due to
+ * cache-line alignment.
+ */
+static Node *insertWindow(Allocator &allocator,
+    std::map<intptr_t, intptr_t> &windows, intptr_t lb, intptr_t ub,
+    size_t size, uint32_t flags)
+{
+    auto i = windows.upper_bound(lb);
+    if (i != windows.begin() && std::prev(i)->second > lb)
+        --i;
+    while (i != windows.end() && i->first <= ub)
+    {
+        intptr_t wlb = i->first, wub = i->second;
+        Node *n = insert(allocator, allocator.tree.root, std::max(lb, wlb),
+            std::min(ub + (intptr_t)size, wub), size, flags);
+        if (n != nullptr)
+            return n;
+        if ((flags & FLAG_ALIGN) == 0 && lb <= wlb &&
+                ub + (intptr_t)size >= wub)
+            i = windows.erase(i);
+        else
+            ++i;
+    }
+    return nullptr;
+}
+
+/*
+ * Insert a new (cold) allocation outside of the hot windows (--profile).
+ */
+static Node *insertCold(Allocator &allocator, intptr_t lb, intptr_t ub,
+    size_t size, uint32_t flags)
+{
+    const auto &hot = allocator.hot;
+    ub += (intptr_t)size;
+    auto i = hot.upper_bound(lb);
+    if (i != hot.begin() && std::prev(i)->second > lb)
+    {
+        --i;
+        lb = i->second;
+        ++i;
+    }
+    while (lb < ub)
+    {
+        intptr_t gub = (i == hot.end()? ub: std::min(ub, i->first));
+        Node *n = insert(allocator, allocator.tree.root, lb, gub, size,
+            flags);
+        if (n != nullptr || i == hot.end())
+            return n;
+        lb = i->second;
+        ++i;
+    }
+    return nullptr;
+}
+
+/*
+ * Open the window of size `size' containing `addr'.
+ */
+static void openWindow(Allocator &allocator,
+    std::map<intptr_t, intptr_t> &windows, intptr_t addr, intptr_t size)
+{
+    intptr_t wlb = addr - (addr % size + size) % size;
+    intptr_t wub = wlb + size;
+    if (allocator.stripes != 0)
+    {
+        intptr_t s = allocator.lb +
+            (addr - allocator.lb) / STRIPE_SIZE * STRIPE_SIZE;
+        wlb = std::max(wlb, s);
+        wub = std::min(wub, s + STRIPE_SIZE);
+    }
+    windows.insert({wlb, wub});
+}
+
 /*
  * Allocates a chunk of virtual address space of size `size` and within the
  * range [lb..ub].  Returns the allocation, or nullptr on failure.
+ *
+ * Shared trampolines (see initTrampoline()) are content-addressed: if an
+ * identical trampoline has already been allocated within the range, then
+ * the existing allocation is reused and its reference count incremented.
+ *
+ * If the allocator is striped, then the range [allocator.lb..allocator.ub]
+ * is divided into STRIPE_SIZE stripes that are assigned round-robin to
+ * `allocator.stripes' allocators, and allocations are restricted to the
+ * allocator's own stripes.  This allows several allocators to be used
+ * concurrently without overlapping allocations.
+ *
+ * For --profile, hot allocations are first attempted (cache-line aligned)
+ * within the open hot windows, which clusters the hot trampolines into a
+ * few dense pages.  Cold allocations avoid the hot windows, and are placed
+ * normally.  A hot window is opened by any hot allocation with a range
+ * wide enough to have been placed elsewhere.
+ *
+ * For --huge-pages, allocations are then attempted within the open huge
+ * page windows, which packs trampolines into fewer huge pages.  A window
+ * is opened by any other allocation with a wide range (e.g., B1), since
+ * such allocations could have been placed (almost) anywhere.
  */
 const Alloc *allocate(Allocator &allocator, intptr_t lb, intptr_t ub,
     const Trampoline *T, const Instr *I, bool same_page)
@@ -258,9 +475,51 @@ const Alloc *allocate(Allocator &allocator, intptr_t lb, intptr_t ub,
     if (r < 0)
         return nullptr;
     size_t size = (size_t)r;
-    ub += size;
+    lb = std::max(lb, allocator.lb);
+    ub = std::min(ub, allocator.ub - (intptr_t)size);
+    if (lb > ub)
+        return nullptr;
+    std::string key;
+    if (T->shared && I != nullptr)
+    {
+        key = sharedKey(T, I, size);
+        const Alloc *A = findShared(allocator, key, lb, ub, size, same_page);
+        if (A != nullptr)
+            return A;
+    }
     uint32_t flags = (same_page? FLAG_SAME_PAGE: 0);
-    Node *n = insert(allocator.tree.root, lb, ub, size, flags);
+    Node *n = nullptr;
+    bool hot = (I != nullptr && I->hot);
+    bool hot_packed = false, packed = false;
+    if (hot)
+    {
+        n = insertWindow(allocator, allocator.hot, lb, ub, size,
+            flags | FLAG_ALIGN);
+        if (n == nullptr)
+            n = insertWindow(allocator, allocator.hot, lb, ub, size, flags);
+        hot_packed = (n != nullptr);
+    }
+    if (!hot_packed && option_huge_pages)
+    {
+        n = insertWindow(allocator, allocator.windows, lb, ub, size, flags);
+        packed = (n != nullptr);
+    }
+    packed = (packed || hot_packed);
+    if (!packed && !hot && !allocator.hot.empty() && allocator.stripes == 0)
+        n = insertCold(allocator, lb, ub, size, flags);
+    if (n == nullptr && !packed && allocator.stripes == 0)
+        n = insert(allocator, allocator.tree.root, lb, ub + size, size,
+            flags);
+    else if (n == nullptr && !packed)
+    {
+        intptr_t width = STRIPE_SIZE * allocator.stripes;
+        intptr_t base  = allocator.lb + STRIPE_SIZE * allocator.stripe;
+        intptr_t s     = base + std::max((intptr_t)0, (lb - base) / width) *
+            width;
+        for (; n == nullptr && s <= ub; s += width)
+            n = insert(allocator, allocator.tree.root, std::max(lb, s),
+                std::min(ub + (intptr_t)size, s + STRIPE_SIZE), size, flags);
+    }
     if (n == nullptr)
         return nullptr;
     if (allocator.tree.root == nullptr)
@@ -270,6 +529,13 @@ const Alloc *allocate(Allocator &allocator, intptr_t lb, intptr_t ub,
     Alloc *A = &n->alloc;
     A->T = T;
     A->I = I;
+    if (!key.empty())
+        allocator.shared[key].insert({A->lb, {n, 1}});
+    if (hot && !hot_packed && ub - lb >= HOT_WINDOW_SIZE)
+        openWindow(allocator, allocator.hot, A->lb, HOT_WINDOW_SIZE);
+    if (option_huge_pages && !packed && ub - lb >= WINDOW_RANGE_MIN)
+        openWindow(allocator, allocator.windows, A->lb,
+            (intptr_t)HUGE_PAGE_SIZE);
     return A;
 }
 
@@ -286,7 +552,8 @@ bool reserve(Allocator &allocator, intptr_t lb, intptr_t ub)
     if (ub - lb <= 0)
         return false;
     uint32_t flags = 0;
-    Node *n = insert(allocator.tree.root, lb, ub, (ub - lb), flags);
+    Node *n = insert(allocator, allocator.tree.root, lb, ub, (ub - lb),
+        flags);
     if (n == nullptr)
         return false;
     if (allocator.tree.root == nullptr)
@@ -308,8 +575,60 @@ void deallocate(Allocator &allocator, const Alloc *a)
         return;
     Node *n = (Node *)(a);
     assert(n->alloc.T != nullptr);
+    if (a->T->shared && a->I != nullptr)
+    {
+        auto i = allocator.shared.find(sharedKey(a->T, a->I,
+            a->ub - a->lb));
+        assert(i != allocator.shared.end());
+        auto j = i->second.find(a->lb);
+        assert(j != i->second.end());
+        if (--j->second.second > 0)
+            return;
+        i->second.erase(j);
+        if (i->second.empty())
+            allocator.shared.erase(i);
+    }
     rebalanceRemove(&allocator.tree, n);
-    free(n);
+    dealloc(allocator, n);
+}
+
+static Node *next(Node *n);
+
+/*
+ * Copy all allocations from `src` that overlap the range [lb..ub] into
+ * `dst`, at the same addresses.  If `patches` is set, only trampolines for
+ * patched instructions are copied, along with any sharing information.
+ */
+void copy(Allocator &dst, const Allocator &src, intptr_t lb, intptr_t ub,
+    bool patches)
+{
+    for (Node *m = src.begin().node; m != nullptr; m = next(m))
+    {
+        const Alloc *a = &m->alloc;
+        if (a->ub <= lb || a->lb > ub)
+            continue;
+        if (patches && a->I == nullptr)
+            continue;
+        Node *n = insert(dst, dst.tree.root, a->lb, a->ub, a->ub - a->lb,
+            /*flags=*/0);
+        if (n == nullptr || n->alloc.lb != a->lb)
+            error("failed to copy allocation " ADDRESS_FORMAT ".."
+                ADDRESS_FORMAT "; the address range is already allocated",
+                ADDRESS(a->lb), ADDRESS(a->ub));
+        if (dst.tree.root == nullptr)
+            dst.tree.root = n;
+        rebalanceInsert(&dst.tree, n);
+        n->alloc.T = a->T;
+        n->alloc.I = a->I;
+        if (!patches || !a->T->shared)
+            continue;
+        std::string key = sharedKey(a->T, a->I, a->ub - a->lb);
+        auto i = src.shared.find(key);
+        assert(i != src.shared.end());
+        auto j = i->second.find(a->lb);
+        assert(j != i->second.end());
+        dst.shared[key].insert({a->lb, {n, j->second.second}});
+    }
 }
 
 /*
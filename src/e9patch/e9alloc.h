@@ -27,6 +27,10 @@ const Alloc *allocate(Allocator &allocator, intptr_t lb, intptr_t ub,
     const Trampoline *T, const Instr *I, bool same_page = false);
 bool reserve(Allocator &allocator, intptr_t lb, intptr_t ub);
 void deallocate(Allocator &allocator, const Alloc *a);
+void copy(Allocator &dst, const Allocator &src, intptr_t lb, intptr_t ub,
+    bool patches = false);
+
+#define STRIPE_SIZE                 ((intptr_t)1 << 20)
 
 #define RELATIVE_ADDRESS_MAX        0x1FFFFFFFFFFFF000ll
 #define RELATIVE_ADDRESS_MIN        (-0x1FFFFFFFFFFFF000ll)
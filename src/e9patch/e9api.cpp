@@ -16,10 +16,18 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cctype>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <algorithm>
+#include <new>
+#include <set>
 #include <string>
+#include <thread>
 
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -27,30 +35,306 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "e9alloc.h"
+#include "e9api.h"
 #include "e9elf.h"
 #include "e9emit.h"
 #include "e9patch.h"
 #include "e9json.h"
 #include "e9tactics.h"
+#include "e9trampoline.h"
 #include "e9x86_64.h"
 
+/*
+ * Global options.
+ */
+bool option_is_tty        = false;
+bool option_debug         = false;
+bool option_disable_B1    = false;
+bool option_disable_B2    = false;
+bool option_disable_T1    = false;
+bool option_disable_T2    = false;
+bool option_disable_T3    = false;
+bool option_experimental  = false;
+bool option_huge_pages    = false;
+bool option_lazy_load     = false;
+bool option_load_segments = false;
+bool option_static_loader = false;
+bool option_same_page     = false;
+bool option_trap_all      = false;
+bool option_use_stack     = false;
+intptr_t option_lb        = INTPTR_MIN;
+intptr_t option_ub        = INTPTR_MAX;
+unsigned option_threads   = 1;
+unsigned option_mapping_effort = 0;
+const char *option_profile = nullptr;
+
+/*
+ * Global statistics.
+ */
+size_t stat_num_patched = 0;
+size_t stat_num_failed  = 0;
+size_t stat_num_B1 = 0;
+size_t stat_num_B2 = 0;
+size_t stat_num_T1 = 0;
+size_t stat_num_T2 = 0;
+size_t stat_num_T3 = 0;
+size_t stat_num_virtual_mappings  = 0;
+size_t stat_num_physical_mappings = 0;
+size_t stat_num_virtual_bytes  = 0;
+size_t stat_num_physical_bytes = 0;
+size_t stat_num_mmaps     = 0;
+size_t stat_num_coalesced = 0;
+size_t stat_num_segments  = 0;
+size_t stat_num_lazy_mappings     = 0;
+size_t stat_num_lazy_reservations = 0;
+size_t stat_num_huge_regions      = 0;
+size_t stat_num_huge_trampolines  = 0;
+size_t stat_num_hot_trampolines   = 0;
+size_t stat_num_hot_pages         = 0;
+size_t stat_num_greedy_mappings = 0;
+size_t stat_num_greedy_bytes = 0;
+size_t stat_num_patches      = 0;
+size_t stat_num_patch_allocs = 0;
+size_t stat_num_windows      = 0;
+size_t stat_num_deferred     = 0;
+size_t stat_num_nodes        = 0;
+size_t stat_num_peak_nodes   = 0;
+size_t stat_num_node_slots   = 0;
+size_t stat_num_node_bytes   = 0;
+size_t stat_num_shared       = 0;
+size_t stat_num_shared_bytes = 0;
+size_t stat_num_dirty_pages  = 0;
+size_t stat_num_dirty_ranges = 0;
+size_t stat_num_pages        = 0;
+size_t stat_num_messages = 0;
+size_t stat_num_message_bytes = 0;
+size_t stat_input_file_size  = 0;
+size_t stat_output_file_size = 0;
+
+/*
+ * Report an error and exit.
+ */
+void NO_RETURN error(const char *msg, ...)
+{
+    fprintf(stderr, "%serror%s: ",
+        (option_is_tty? "\33[31m": ""),
+        (option_is_tty? "\33[0m" : ""));
+
+    va_list ap;
+    va_start(ap, msg);
+    vfprintf(stderr, msg, ap);
+    va_end(ap);
+    
+    putc('\n', stderr);
+
+    _Exit(EXIT_FAILURE);
+}
+
+/*
+ * Print a warning message.
+ */
+void warning(const char *msg, ...)
+{
+    fprintf(stderr, "%swarning%s: ",
+        (option_is_tty? "\33[33m": ""),
+        (option_is_tty? "\33[0m" : ""));
+
+    va_list ap;
+    va_start(ap, msg);
+    vfprintf(stderr, msg, ap);
+    va_end(ap);
+    
+    putc('\n', stderr);
+}
+
+/*
+ * Print a debug message.
+ */
+void debugImpl(const char *msg, ...)
+{
+    fprintf(stderr, "%sdebug%s: ",
+        (option_is_tty? "\33[35m": ""),
+        (option_is_tty? "\33[0m" : ""));
+
+    va_list ap;
+    va_start(ap, msg);
+    vfprintf(stderr, msg, ap);
+    va_end(ap);
+
+    putc('\n', stderr);
+}
+
+/*
+ * Allocate storage for an instruction record.
+ */
+void *InstrSet::alloc()
+{
+    if (used >= INSTR_BLOCK_SIZE)
+    {
+        void *ptr = malloc(INSTR_BLOCK_SIZE * sizeof(Instr));
+        if (ptr == nullptr)
+            error("failed to allocate %zu bytes for instructions: %s",
+                INSTR_BLOCK_SIZE * sizeof(Instr), strerror(ENOMEM));
+        blocks.push_back((Instr *)ptr);
+        used = 0;
+    }
+    return (void *)(blocks.back() + used++);
+}
+
+/*
+ * Find the index chunk that may contain `offset'.
+ */
+static size_t findChunk(const InstrSet &Is, off_t offset)
+{
+    auto i = std::upper_bound(Is.index.begin(), Is.index.end(), offset,
+        [](off_t offset, const std::vector<Instr *> &chunk)
+        {
+            return offset < (off_t)chunk.front()->offset;
+        });
+    return (i == Is.index.begin()? 0: (i - Is.index.begin()) - 1);
+}
+
+/*
+ * Insert an instruction into the index.
+ */
+void InstrSet::insert(Instr *I)
+{
+    Instr *J = back();
+    count++;
+    if (J == nullptr || J->offset < I->offset)
+    {
+        // Fast path: append.
+        if (index.empty() || index.back().size() >= INSTR_CHUNK_SIZE)
+        {
+            index.emplace_back();
+            index.back().reserve(INSTR_CHUNK_SIZE);
+        }
+        index.back().push_back(I);
+        return;
+    }
+    Instr *K = (run.empty()? index.front().front(): run.back());
+    if (I->offset < K->offset)
+    {
+        // Fast path: prepend.
+        run.push_back(I);
+        if (run.size() >= INSTR_CHUNK_SIZE)
+            flush();
+        return;
+    }
+
+    flush();
+    size_t c = findChunk(*this, (off_t)I->offset);
+    std::vector<Instr *> &chunk = index[c];
+    auto i = std::upper_bound(chunk.begin(), chunk.end(), I,
+        [](const Instr *I, const Instr *J) { return I->offset < J->offset; });
+    chunk.insert(i, I);
+    if (chunk.size() >= 2 * INSTR_CHUNK_SIZE)
+    {
+        std::vector<Instr *> split(chunk.begin() + INSTR_CHUNK_SIZE,
+            chunk.end());
+        chunk.resize(INSTR_CHUNK_SIZE);
+        index.insert(index.begin() + c + 1, std::move(split));
+    }
+}
+
+/*
+ * Move the pending descending run into a new front chunk.
+ */
+void InstrSet::flush()
+{
+    if (run.empty())
+        return;
+    index.emplace(index.begin(), run.rbegin(), run.rend());
+    run.clear();
+}
+
+/*
+ * Find the first instruction with an offset >= `offset' (or nullptr).
+ */
+Instr *InstrSet::lowerBound(off_t offset) const
+{
+    if (count == 0)
+        return nullptr;
+    if (!run.empty() && offset <= (off_t)run.front()->offset)
+        return *std::lower_bound(run.rbegin(), run.rend(), offset,
+            [](const Instr *I, off_t offset)
+            { return (off_t)I->offset < offset; });
+    size_t c = findChunk(*this, offset);
+    const std::vector<Instr *> &chunk = index[c];
+    auto i = std::lower_bound(chunk.begin(), chunk.end(), offset,
+        [](const Instr *I, off_t offset) { return (off_t)I->offset < offset; });
+    if (i != chunk.end())
+        return *i;
+    return (c + 1 < index.size()? index[c+1].front(): nullptr);
+}
+
+/*
+ * Find the instruction at `offset' (or nullptr).
+ */
+Instr *InstrSet::find(off_t offset) const
+{
+    Instr *I = lowerBound(offset);
+    return (I != nullptr && (off_t)I->offset == offset? I: nullptr);
+}
+
+/*
+ * Resize a page set to cover a file of `size' bytes.
+ */
+void PageSet::resize(size_t size)
+{
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    bits.assign((pages + 63) / 64, 0);
+}
+
+/*
+ * Insert all pages overlapping [offset..offset+size) into a page set.
+ */
+void PageSet::insert(off_t offset, size_t size)
+{
+    size_t lo = (size_t)offset / PAGE_SIZE;
+    size_t hi = ((size_t)offset + size - 1) / PAGE_SIZE;
+    for (size_t page = lo; page <= hi; page++)
+        __atomic_or_fetch(&bits[page / 64], (uint64_t)1 << (page % 64),
+            __ATOMIC_RELAXED);
+}
+
+/*
+ * Find the offset of the first page in the set at or after `offset'.
+ * Returns (-1) if there is no such page.
+ */
+off_t PageSet::next(off_t offset) const
+{
+    size_t page = (size_t)offset / PAGE_SIZE;
+    size_t i = page / 64;
+    if (i >= bits.size())
+        return -1;
+    uint64_t word = bits[i] & (~(uint64_t)0 << (page % 64));
+    while (word == 0)
+    {
+        if (++i >= bits.size())
+            return -1;
+        word = bits[i];
+    }
+    page = i * 64 + __builtin_ctzll(word);
+    return (off_t)(page * PAGE_SIZE);
+}
+
 /*
  * Insert an instruction into a binary.
  */
 void insertInstruction(Binary *B, Instr *I)
 {
-    // Insert the instruction into the index:
-    auto result = B->Is.insert(std::make_pair((off_t)I->offset, I));
-    if (!result.second)
+    // Find the successor and predecessor instructions:
+    Instr *J = B->Is.lowerBound((off_t)I->offset);
+    if (J != nullptr && J->offset == I->offset)
         error("failed to insert instruction at offset (+%zu), another "
             "instruction already exists at that offset", I->offset);
-    InstrSet::iterator i = result.first;
+    Instr *K = (J != nullptr? J->prev: B->Is.back());
 
-    // Find and validate successor and predecessor instructions:
-    ++i;
-    if (i != B->Is.end())
+    // Validate successor and predecessor instructions:
+    if (J != nullptr)
     {
-        Instr *J = i->second;
         if (I->offset + I->size > J->offset)
             error("failed to insert instruction at offset (+%zu), instruction "
                 "overlaps with another instruction at offset (+%zu)",
@@ -63,22 +347,20 @@ void insertInstruction(Binary *B, Instr *I)
         J->prev = I;
     }
 
-    i = result.first;
-    if (i != B->Is.begin())
+    if (K != nullptr)
     {
-        --i;
-        Instr *J = i->second;
-        if (J->offset + J->size > I->offset)
+        if (K->offset + K->size > I->offset)
             error("failed to insert instruction at offset (+%zu), instruction "
                 "overlaps with another instruction at offset (+%zu)",
-                I->offset, J->offset);
-        if (J->addr + J->size > I->addr)
+                I->offset, K->offset);
+        if (K->addr + K->size > I->addr)
             error("failed to insert instruction at address (%p), instruction "
                 "overlaps with another instruction at address (%p)",
-                (void *)I->addr, (void *)J->addr);
-        I->prev = J;
-        J->next = I;
+                (void *)I->addr, (void *)K->addr);
+        I->prev = K;
+        K->next = I;
     }
+    B->Is.insert(I);
 
     // Initialize the state:
     for (unsigned i = 0; i < I->size; i++)
@@ -106,21 +388,61 @@ void insertInstruction(Binary *B, Instr *I)
 }
 
 /*
- * Flush the patching queue up to the new cursor.
+ * Patches more than this distance apart cannot affect each other.
+ */
+#define PATCH_DISTANCE_MAX                                              \
+    (/*max short jmp=*/INT8_MAX + 2 + /*max instruction size=*/15 +     \
+     /*a bit extra=*/32)
+
+/*
+ * Parallel patching parameters.
+ */
+#define WINDOW_PATCHES_MIN          1024
+#define WINDOW_BORDER               (PATCH_DISTANCE_MAX + 16)
+
+/*
+ * The result of patching an instruction.
  */
-static void queueFlush(Binary *B, intptr_t cursor)
+struct PatchResult
 {
-    if (B->cursor <= cursor)
-        error("failed to patch instruction at address 0x%lx; \"patch\" "
-            "messages were not send in reverse order", cursor);
-    B->cursor = cursor;
+    Instr *I;                           // Instruction.
+    const Trampoline *T;                // Trampoline.
+    bool ok;                            // Patched?
+};
+typedef std::vector<PatchResult> PatchResults;
 
-    cursor += /*max short jmp=*/ INT8_MAX + 2 + /*max instruction size=*/15 +
-        /*a bit extra=*/32;
-    while (!B->Q.empty() && B->Q.back().first->addr > cursor)
+/*
+ * Patch an instruction.  If `defer' is set (parallel windows), then only the
+ * tactics that do not evict neighbouring instructions are used.  If these
+ * fail, the instruction is queued (i.e., protected from the tactics of its
+ * neighbours) so that it can be patched sequentially later.
+ */
+static bool patchOrDefer(Allocator &allocator, PageSet &dirty, Instr *I,
+    const Trampoline *T, bool defer)
+{
+    if (!defer)
+        return patch(allocator, dirty, I, T);
+    if (patch(allocator, dirty, I, T, /*evict=*/false))
+        return true;
+    for (unsigned i = 0; i < I->size; i++)
+    {
+        assert(I->patched.state[i] == STATE_INSTRUCTION);
+        I->patched.state[i] = STATE_QUEUED;
+    }
+    return false;
+}
+
+/*
+ * Flush the patching queue `Q' up to the cursor.
+ */
+static void queueFlush(PatchQueue &Q, Allocator &allocator, PageSet &dirty,
+    intptr_t cursor, PatchResults &results, bool defer = false)
+{
+    cursor += PATCH_DISTANCE_MAX;
+    while (!Q.empty() && Q.back().first->addr > cursor)
     {
-        auto entry = B->Q.back();
-        B->Q.pop_back();
+        auto entry = Q.back();
+        Q.pop_back();
         Instr *I            = entry.first;
         const Trampoline *T = entry.second;
         for (unsigned i = 0; i < I->size; i++)
@@ -128,25 +450,22 @@ static void queueFlush(Binary *B, intptr_t cursor)
             assert(I->patched.state[i] == STATE_QUEUED);
             I->patched.state[i] = STATE_INSTRUCTION;
         }
-        if (patch(*B, I, T))
-            stat_num_patched++;
-        else
-            stat_num_failed++;
+        results.push_back({I, T,
+            patchOrDefer(allocator, dirty, I, T, defer)});
     }
 }
 
 /*
  * Queue an instruction for patching.
  */
-static void queuePatch(Binary *B, Instr *I, const Trampoline *T)
+static void queuePatch(PatchQueue &Q, Allocator &allocator, PageSet &dirty,
+    Instr *I, const Trampoline *T, PatchResults &results, bool defer = false)
 {
     if (!option_experimental)
     {
         // Patch queues are experimental...
-        if (patch(*B, I, T))
-            stat_num_patched++;
-        else
-            stat_num_failed++;
+        results.push_back({I, T,
+            patchOrDefer(allocator, dirty, I, T, defer)});
         return;
     }
 
@@ -156,42 +475,293 @@ static void queuePatch(Binary *B, Instr *I, const Trampoline *T)
         I->patched.state[i] = STATE_QUEUED;
     }
 
-    B->Q.push_front({I, T});
-    queueFlush(B, I->addr);
+    Q.push_front({I, T});
+    queueFlush(Q, allocator, dirty, I->addr, results, defer);
 }
 
 /*
- * Parse a binary message.
+ * Report patching results.
  */
-static Binary *parseBinary(const Message &msg)
+static void reportResults(PatchResults &results)
 {
-    const char *filename = nullptr;
-    Mode mode = MODE_EXECUTABLE;
-    bool have_mode = false, dup = false;
-    for (unsigned i = 0; i < msg.num_params; i++)
+    for (const auto &result: results)
     {
-        switch (msg.params[i].name)
+        if (result.ok)
         {
-            case PARAM_FILENAME:
-                dup = dup || (filename != nullptr);
-                filename = msg.params[i].value.string;
-                break;
-            case PARAM_MODE:
-                dup = dup || have_mode;
-                mode = (Mode)msg.params[i].value.integer;
-                have_mode = true;
-                break;
-            default:
-                break;
+            stat_num_patched++;
+            printf("\33[32m.\33[0m");
+        }
+        else
+        {
+            stat_num_failed++;
+            printf("\33[31mX\33[0m");
         }
     }
-    if (filename == nullptr)
-        error("failed to parse \"binary\" message (id=%u); missing "
-            "\"filename\" parameter", msg.id);
-    if (dup)
-        error("failed to parse \"binary\" message (id=%u); duplicate "
-            "parameters detected", msg.id);
+    results.clear();
+}
+
+/*
+ * Queue an instruction for patching.
+ */
+static void queuePatch(Binary *B, Instr *I, const Trampoline *T)
+{
+    if (option_experimental || option_threads > 1)
+    {
+        if (B->cursor <= I->addr)
+            error("failed to patch instruction at address 0x%lx; \"patch\" "
+                "messages were not send in reverse order", I->addr);
+        B->cursor = I->addr;
+    }
+    if (option_threads > 1)
+    {
+        // Parallel patching is deferred until the binary is emitted.
+        B->pending.push_back({I, T});
+        return;
+    }
+
+    static PatchResults results;
+    queuePatch(B->Q, B->allocator, B->dirty, I, T, results);
+    reportResults(results);
+}
+
+/*
+ * A window of patches that are independent of all other windows.  Each
+ * window is patched using its own allocator that is restricted to a
+ * disjoint set of stripes of the address space.
+ */
+struct Window
+{
+    size_t lo = 0;                      // First patch.
+    size_t hi = 0;                      // Last patch (exclusive).
+    Allocator allocator;                // Window allocator.
+    PatchResults results;               // Window results.
+};
+
+/*
+ * Patch a window.  This is the same as patching sequentially, except that
+ * the queue only contains patches from the window, and patches that need
+ * the eviction tactics are deferred (see patchOrDefer()).
+ */
+static void patchWindow(Binary *B, Window &W)
+{
+    PatchQueue Q;
+    for (size_t i = W.lo; i < W.hi; i++)
+        queuePatch(Q, W.allocator, B->dirty, B->pending[i].first,
+            B->pending[i].second, W.results, /*defer=*/true);
+    queueFlush(Q, W.allocator, B->dirty, INTPTR_MIN, W.results,
+        /*defer=*/true);
+}
+
+/*
+ * Patch all pending instructions in parallel.  The pending patches are
+ * partitioned into one window per thread, separated by borders so that
+ * no two windows touch the same bytes.  Patches within a border are queued
+ * (i.e., protected from the tactics) and are patched sequentially once the
+ * window allocations have been merged.  Within a window, a patch that cannot
+ * be applied without evicting its neighbours (e.g., because its punned jump
+ * range falls within another window's stripes) is likewise queued.  The
+ * borders and deferred patches are then patched sequentially, in reverse
+ * address order, using the whole address space and all tactics.  This keeps
+ * the coverage close to that of sequential patching.  The result depends
+ * only on the number of threads, and not on the thread schedule.
+ */
+static void patchParallel(Binary *B)
+{
+    const PatchList &pending = B->pending;
+    if (pending.empty())
+        return;
+
+    // Step (1): Partition the patches into windows and borders:
+    size_t num_windows = (pending.size() + WINDOW_PATCHES_MIN - 1) /
+        WINDOW_PATCHES_MIN;
+    num_windows = std::min(num_windows, (size_t)option_threads);
+    size_t window_size = (pending.size() + num_windows - 1) / num_windows;
+    std::vector<Window> windows(num_windows);
+    std::vector<size_t> borders;
+    for (size_t w = 0, i = 0; w < num_windows; w++)
+    {
+        Window &W = windows[w];
+        W.lo = i;
+        i = std::min(i + window_size, pending.size());
+        if (i == pending.size())
+        {
+            W.hi = i;
+            break;
+        }
+        intptr_t split = pending[i].first->addr;
+        W.hi = W.lo;
+        while (W.hi < i && pending[W.hi].first->addr >= split + WINDOW_BORDER)
+            W.hi++;
+        for (i = W.hi; i < pending.size() &&
+                pending[i].first->addr > split - WINDOW_BORDER; i++)
+        {
+            Instr *I = pending[i].first;
+            for (unsigned j = 0; j < I->size; j++)
+            {
+                assert(I->patched.state[j] == STATE_INSTRUCTION);
+                I->patched.state[j] = STATE_QUEUED;
+            }
+            borders.push_back(i);
+        }
+    }
+
+    // Step (2): Give each window a disjoint set of stripes of the address
+    //           space that is reachable from all instructions:
+    intptr_t lb = pending.front().first->addr + /*max jmp prefix=*/16 -
+        (intptr_t)INT32_MAX;
+    intptr_t ub = pending.back().first->addr + (intptr_t)INT32_MAX -
+        2 * TRAMPOLINE_MAX;
+    lb = std::max(lb, option_lb);
+    ub = std::min(ub, option_ub);
+    lb -= lb % STRIPE_SIZE;
+    for (size_t w = 0; w < num_windows; w++)
+    {
+        Window &W = windows[w];
+        W.allocator.lb      = lb;
+        W.allocator.ub      = ub;
+        W.allocator.stripes = num_windows;
+        W.allocator.stripe  = w;
+        copy(W.allocator, B->allocator, lb, ub);
+    }
+
+    // Step (3): Patch the windows in parallel:
+    std::vector<std::thread> threads;
+    for (size_t w = 1; w < num_windows; w++)
+        threads.emplace_back(patchWindow, B, std::ref(windows[w]));
+    patchWindow(B, windows[0]);
+    for (auto &thread: threads)
+        thread.join();
+
+    // Step (4): Merge the windows:
+    for (auto &W: windows)
+        copy(B->allocator, W.allocator, INTPTR_MIN, INTPTR_MAX,
+            /*patches=*/true);
+
+    // Step (5): Patch the borders and deferred patches sequentially:
+    PatchResults results;
+    for (size_t i: borders)
+        results.push_back({pending[i].first, pending[i].second, false});
+    std::vector<PatchResult *> deferred;
+    for (auto &result: results)
+        deferred.push_back(&result);
+    for (auto &W: windows)
+    {
+        for (auto &result: W.results)
+        {
+            if (result.ok)
+                continue;
+            deferred.push_back(&result);
+            stat_num_deferred++;
+        }
+    }
+    std::sort(deferred.begin(), deferred.end(),
+        [](const PatchResult *a, const PatchResult *b)
+        {
+            return (a->I->addr > b->I->addr);
+        });
+    for (auto *result: deferred)
+    {
+        Instr *I = result->I;
+        for (unsigned j = 0; j < I->size; j++)
+        {
+            assert(I->patched.state[j] == STATE_QUEUED);
+            I->patched.state[j] = STATE_INSTRUCTION;
+        }
+        result->ok = patch(B->allocator, B->dirty, I, result->T);
+    }
+    for (auto &W: windows)
+        reportResults(W.results);
+    reportResults(results);
+    stat_num_windows += num_windows;
+    B->pending.clear();
+}
+
+/*
+ * Flush all queued patches.
+ */
+static void queueFlush(Binary *B)
+{
+    B->cursor = INTPTR_MIN;
+    if (option_threads > 1)
+    {
+        patchParallel(B);
+        return;
+    }
+    static PatchResults results;
+    queueFlush(B->Q, B->allocator, B->dirty, INTPTR_MIN, results);
+    reportResults(results);
+}
+
+#define HOT_THRESHOLD               0.9
+
+/*
+ * Load a profile (--profile).  Each line is of the form "ADDR,COUNT", where
+ * ADDR is an instruction address and COUNT is the number of times it was
+ * hit.  The hot instructions are the most frequently hit instructions that
+ * together account for HOT_THRESHOLD of all hits.
+ */
+static void loadProfile(const char *filename,
+    std::unordered_set<intptr_t> &hot)
+{
+    FILE *stream = fopen(filename, "r");
+    if (stream == nullptr)
+        error("failed to open profile \"%s\" for reading: %s", filename,
+            strerror(errno));
+    std::vector<std::pair<uint64_t, intptr_t>> entries;
+    uint64_t total = 0;
+    char line[BUFSIZ];
+    for (size_t lineno = 1; fgets(line, sizeof(line), stream) != nullptr;
+            lineno++)
+    {
+        const char *s = line;
+        while (isspace(*s))
+            s++;
+        if (*s == '\0' || *s == '#')
+            continue;
+        char *end = nullptr;
+        errno = 0;
+        intptr_t addr = (intptr_t)strtoull(s, &end, 0);
+        bool ok = (errno == 0 && end != s);
+        while (ok && isspace(*end))
+            end++;
+        ok = ok && (*end++ == ',');
+        s = end;
+        uint64_t count = (ok? strtoull(s, &end, 0): 0);
+        ok = ok && (errno == 0 && end != s);
+        while (ok && isspace(*end))
+            end++;
+        ok = ok && (*end == '\0');
+        if (!ok)
+            error("failed to parse profile \"%s\" at line %zu; expected a "
+                "line of the form \"ADDR,COUNT\"", filename, lineno);
+        if (count == 0)
+            continue;
+        entries.push_back({count, addr});
+        total += count;
+    }
+    fclose(stream);
+
+    std::sort(entries.begin(), entries.end(),
+        [](const std::pair<uint64_t, intptr_t> &a,
+                const std::pair<uint64_t, intptr_t> &b)
+        {
+            return (a.first > b.first);
+        });
+    uint64_t hits = 0;
+    for (const auto &entry: entries)
+    {
+        if ((double)hits >= HOT_THRESHOLD * (double)total)
+            break;
+        hot.insert(entry.second);
+        hits += entry.first;
+    }
+}
 
+/*
+ * Create a binary for patching.
+ */
+Binary *makeBinary(const char *filename, Mode mode)
+{
     Binary *B = new Binary;
     B->filename = filename;
     B->mode     = mode;
@@ -210,6 +780,7 @@ static Binary *parseBinary(const Message &msg)
             strerror(errno));
     size_t size = (size_t)buf.st_size;
     B->size = size;
+    B->dirty.resize(size);
 
     // Allocate extra space for file extensions.
     const size_t EXTEND_SIZE = 32 * (1ull << 30);        // 32GB
@@ -254,80 +825,370 @@ mmap_failed:
     B->patched.state = (uint8_t *)ptr;
     memset(B->patched.state + size, STATE_OVERFLOW, ext_size - size);
 
+    // Load the profile (if any):
+    if (option_profile != nullptr)
+        loadProfile(option_profile, B->hot);
+
     return B;
 }
 
+/*
+ * Create an instruction (without inserting it).
+ */
+Instr *makeInstruction(Binary *B, intptr_t address, size_t length,
+    off_t offset, unsigned id)
+{
+    if (length == 0 || length > 15)
+        error("failed to parse \"instruction\" message (id=%u); "
+            "\"length\" parameter must be within the range 1..15", id);
+    if (offset < 0)
+        error("failed to parse \"instruction\" message (id=%u); the "
+            "instruction offset (%zd) is negative", id, offset);
+    if (offset + length > B->size)
+        error("failed to parse \"instruction\" message (id=%u); the "
+            "instruction offset+length (%zd+%zu) overflows the end-of-file "
+            "\"%s\" (with size %zu)", id, offset, length, B->filename,
+            B->size);
+
+    size_t pcrel32_idx = 0, pcrel8_idx = 0;
+    unsigned pcrel_idx = getInstrPCRelativeIndex(B->original.bytes + offset,
+        length);
+    if (pcrel_idx != 0)
+    {
+        if (length - pcrel_idx < sizeof(int32_t))
+            pcrel8_idx = pcrel_idx;     // Must be pcrel8
+        else
+            pcrel32_idx = pcrel_idx;    // Must be pcrel32
+    }
+    Instr *I = new (B->Is.alloc()) Instr(offset, address, length,
+        B->original.bytes + offset, B->patched.bytes + offset,
+        B->patched.state + offset, pcrel32_idx, pcrel8_idx, B->elf.pic);
+    I->hot = (B->hot.count(address) != 0);
+    return I;
+}
+
+/*
+ * Add an instruction to a binary.
+ */
+void addInstruction(Binary *B, intptr_t address, size_t length, off_t offset,
+    unsigned id)
+{
+    Instr *I = makeInstruction(B, address, length, offset, id);
+    insertInstruction(B, I);
+}
+
+/*
+ * Add several instructions to a binary.  The instructions are inserted in
+ * ascending order so that each instruction is (usually) appended to the
+ * index.
+ */
+void addInstructions(Binary *B, std::vector<Instr *> &Is)
+{
+    std::sort(Is.begin(), Is.end(),
+        [](const Instr *I, const Instr *J) { return I->offset < J->offset; });
+    for (Instr *I: Is)
+        insertInstruction(B, I);
+}
+
+/*
+ * Add a named trampoline template to a binary.
+ */
+void addTrampoline(Binary *B, const char *name, Trampoline *T, unsigned id)
+{
+    auto i = B->Ts.find(name);
+    if (i != B->Ts.end())
+        error("failed to parse \"template\" message (id=%u); a template "
+            "with name \"%s\" already exists", id, name);
+    B->Ts.insert(std::make_pair(name, T));
+}
+
+/*
+ * Find a named trampoline template (or nullptr if it does not exist).
+ */
+const Trampoline *findTrampoline(const Binary *B, const char *name)
+{
+    auto i = B->Ts.find(name);
+    return (i == B->Ts.end()? nullptr: i->second);
+}
+
+/*
+ * Patch the instruction at `offset' using trampoline `T'.  Instructions
+ * must be patched in reverse order.
+ */
+void patchInstruction(Binary *B, off_t offset, const Trampoline *T,
+    Metadata *meta, unsigned id)
+{
+    Instr *I = B->Is.find(offset);
+    if (I == nullptr)
+        error("failed to parse \"patch\" message (id=%u); no matching "
+            "instruction at offset (%zd)", id, offset);
+    I->metadata = meta;
+    queuePatch(B, I, T);
+}
+
+/*
+ * Reserve a range of the virtual address space.
+ */
+void reserveMemory(Binary *B, intptr_t address, size_t length, bool absolute,
+    unsigned id)
+{
+    if (absolute && B->elf.pic)
+        address = ABSOLUTE_ADDRESS(address);
+    if (!reserve(B->allocator, address, address + length))
+        error("failed to parse \"reserve\" message (id=%u); failed to "
+            "reserve address space at address " ADDRESS_FORMAT, id,
+            ADDRESS(address));
+}
+
+/*
+ * Reserve and initialize a range of the virtual address space.  The `init'
+ * and `mmap' addresses are optional (INTPTR_MIN for none).
+ */
+void reserveMemory(Binary *B, intptr_t address, Trampoline *bytes, int prot,
+    intptr_t init, intptr_t mmap, bool absolute, unsigned id)
+{
+    if (absolute && B->elf.pic)
+        address = ABSOLUTE_ADDRESS(address);
+    if (init != INTPTR_MIN)
+    {
+        if (absolute && B->elf.pic)
+            init = ABSOLUTE_ADDRESS(init);
+        if (init < address || init >= address + bytes->entries[0].length)
+            error("failed to parse \"reserve\" message (id=%u); \"init\" "
+                "parameter value (" ADDRESS_FORMAT ") is out-of-bounds",
+                id, ADDRESS(init));
+        B->inits.push_back(init);
+    }
+    if (mmap != INTPTR_MIN)
+    {
+        if (absolute && B->elf.pic)
+            mmap = ABSOLUTE_ADDRESS(mmap);
+        if (mmap < address || mmap >= address + bytes->entries[0].length)
+            error("failed to parse \"reserve\" message (id=%u); \"mmap\" "
+                "parameter value (" ADDRESS_FORMAT ") is out-of-bounds",
+                id, ADDRESS(mmap));
+        if (B->mmap != INTPTR_MIN)
+            error("failed to parse \"reserve\" message (id=%u); a mmap "
+                "function was previously defined", id);
+        B->mmap = mmap;
+    }
+
+    bytes->prot    = prot;
+    bytes->preload = true;
+    const Alloc *A = allocate(B->allocator, address, address, bytes,
+        nullptr);
+    if (A == nullptr)
+        error("failed to parse \"reserve\" message (id=%u); failed to "
+            "reserve address space at address " ADDRESS_FORMAT, id,
+            ADDRESS(address));
+}
+
+/*
+ * Emit the patched binary.  Returns the size of the patched binary.
+ */
+size_t emitPatchedBinary(Binary *B, const char *filename, Format format,
+    size_t mapping_size, unsigned id)
+{
+    if (mapping_size % PAGE_SIZE != 0)
+        error("failed to parse \"emit\" message (id=%u); mapping size "
+            "must be a multiple of the page size (%u), found %zu", id,
+            PAGE_SIZE, mapping_size);
+    if ((mapping_size & (mapping_size - 1)) != 0)
+        error("failed to parse \"emit\" message (id=%u); mapping size "
+            "must be a power-of-two, found %zu", id, mapping_size);
+
+    // Flush the queue:
+    queueFlush(B);
+    putchar('\n');
+    stat_num_nodes      = B->allocator.slab.nodes;
+    stat_num_peak_nodes = B->allocator.slab.peak;
+    stat_num_node_slots = B->allocator.slab.slots;
+    stat_num_node_bytes = B->allocator.slab.bytes;
+    for (const auto &i: B->allocator.shared)
+    {
+        for (const auto &j: i.second)
+        {
+            size_t refs = j.second.second;
+            stat_num_shared       += refs - 1;
+            stat_num_shared_bytes += (refs - 1) * (i.first.size() - 1);
+        }
+    }
+    if (option_profile != nullptr)
+    {
+        std::set<intptr_t> pages;
+        for (const Alloc *A: B->allocator)
+        {
+            if (A->T == nullptr || A->I == nullptr || !A->I->hot)
+                continue;
+            stat_num_hot_trampolines++;
+            intptr_t lb = A->lb / (intptr_t)PAGE_SIZE;
+            intptr_t ub = (A->ub - 1) / (intptr_t)PAGE_SIZE;
+            for (intptr_t p = lb; p <= ub; p++)
+                pages.insert(p);
+        }
+        stat_num_hot_pages = pages.size();
+    }
+
+    // Create and optimize the mappings:
+    MappingSet mappings;
+    buildMappings(B->allocator, mapping_size, mappings);
+    optimizeMappings(mappings);
+    putchar('\n');
+
+    // Create the patched binary:
+    B->patched.size = emitElf(B, mappings, mapping_size,
+        /*flatten=*/(format != FORMAT_BINARY));
+
+    // Emit the result:
+    switch (format)
+    {
+        case FORMAT_BINARY:
+            emitBinary(filename, B->patched.bytes, B->patched.size,
+                mappings);
+            break;
+        case FORMAT_DELTA:
+        case FORMAT_DELTA_XZ:
+            emitDelta(filename, (format == FORMAT_DELTA_XZ),
+                B->original.bytes, B->size, B->patched.bytes,
+                B->patched.size);
+            break;
+        case FORMAT_PATCH:
+            emitPatch(filename, /*compress=*/nullptr, B->original.fd,
+                B->patched.bytes, B->patched.size);
+            break;
+        case FORMAT_PATCH_GZ:
+            emitPatch(filename, "gzip", B->original.fd, B->patched.bytes,
+                B->patched.size);
+            break;
+        case FORMAT_PATCH_BZIP2:
+            emitPatch(filename, "bzip2", B->original.fd, B->patched.bytes,
+                B->patched.size);
+            break;
+        case FORMAT_PATCH_XZ:
+            emitPatch(filename, "xz", B->original.fd, B->patched.bytes,
+                B->patched.size);
+            break;
+        default:
+            error("failed to parse \"emit\" message (id=%u); invalid "
+                "\"format\" code %u", id, (unsigned)format);
+    }
+    return B->patched.size;
+}
+
+/*
+ * Parse a binary message.
+ */
+static Binary *parseBinary(const Message &msg)
+{
+    const char *filename = nullptr;
+    Mode mode = MODE_EXECUTABLE;
+    bool have_mode = false, dup = false;
+    for (unsigned i = 0; i < msg.num_params; i++)
+    {
+        switch (msg.params[i].name)
+        {
+            case PARAM_FILENAME:
+                dup = dup || (filename != nullptr);
+                filename = msg.params[i].value.string;
+                break;
+            case PARAM_MODE:
+                dup = dup || have_mode;
+                mode = (Mode)msg.params[i].value.integer;
+                have_mode = true;
+                break;
+            default:
+                break;
+        }
+    }
+    if (filename == nullptr)
+        error("failed to parse \"binary\" message (id=%u); missing "
+            "\"filename\" parameter", msg.id);
+    if (dup)
+        error("failed to parse \"binary\" message (id=%u); duplicate "
+            "parameters detected", msg.id);
+
+    return makeBinary(filename, mode);
+}
+
+/*
+ * Get the number of elements of a (batched) message.  Array parameters
+ * must have the same length, and scalar parameters apply to all elements.
+ */
+static size_t getMessageLength(const Message &msg)
+{
+    size_t length = 1;
+    bool have_array = false;
+    for (unsigned i = 0; i < msg.num_params; i++)
+    {
+        const Param &param = msg.params[i];
+        if (!param.array)
+            continue;
+        if (have_array && param.length != length)
+            error("failed to parse \"%s\" message (id=%u); array parameters "
+                "have different lengths (%zu vs. %zu)",
+                getMethodString(msg.method), msg.id, length, param.length);
+        length = param.length;
+        have_array = true;
+    }
+    return length;
+}
+
 /*
  * Parse an instruction message.
  */
 static void parseInstruction(Binary *B, const Message &msg)
 {
-    intptr_t address = 0;
-    size_t   length  = 0;
-    off_t    offset  = 0;
-    bool have_address = false, have_length = false, have_offset = false,
-        dup = false;
+    const Param *address = nullptr, *length = nullptr, *offset = nullptr;
+    bool dup = false;
     for (unsigned i = 0; i < msg.num_params; i++)
     {
         switch (msg.params[i].name)
         {
             case PARAM_ADDRESS:
-                dup = dup || have_address;
-                address = (intptr_t)msg.params[i].value.integer;
-                have_address = true;
+                dup = dup || (address != nullptr);
+                address = msg.params + i;
                 break;
             case PARAM_LENGTH:
-                dup = dup || have_length;
-                length = (size_t)msg.params[i].value.integer;
-                have_length = true;
+                dup = dup || (length != nullptr);
+                length = msg.params + i;
                 break;
             case PARAM_OFFSET:
-                dup = dup || have_offset;
-                offset = (off_t)msg.params[i].value.integer;
-                have_offset = true;
+                dup = dup || (offset != nullptr);
+                offset = msg.params + i;
                 break;
             default:
                 break;
         }
     }
-    if (!have_address)
+    if (address == nullptr)
         error("failed to parse \"instruction\" message (id=%u); missing "
             "\"address\" parameter", msg.id);
-    if (!have_length)
+    if (length == nullptr)
         error("failed to parse \"instruction\" message (id=%u); missing "
             "\"length\" parameter", msg.id);
-    if (length == 0 || length > 15)
-        error("failed to parse \"instruction\" message (id=%u); \"length\" "
-            "parameter must be within the range 1..15", msg.id);
-    if (!have_offset)
+    if (offset == nullptr)
         error("failed to parse \"instruction\" message (id=%u); missing "
             "\"offset\" parameter", msg.id);
-    if (offset < 0)
-        error("failed to parse \"instruction\" message (id=%u); the "
-            "instruction offset (%zd) is negative", msg.id, offset);
-    if (offset + length > B->size)
-        error("failed to parse \"instruction\" message (id=%u); the "
-            "instruction offset+length (%zd+%zu) overflows "
-            "the end-of-file \"%s\" (with size %zu)", msg.id, offset, length,
-            B->filename, B->size);
     if (dup)
         error("failed to parse \"instruction\" message (id=%u); duplicate "
             "parameters detected", msg.id);
 
-    size_t pcrel32_idx = 0, pcrel8_idx = 0;
-    unsigned pcrel_idx = getInstrPCRelativeIndex(B->original.bytes + offset,
-        length);
-    if (pcrel_idx != 0)
+    size_t count = getMessageLength(msg);
+    if (count == 1)
     {
-        if (length - pcrel_idx < sizeof(int32_t))
-            pcrel8_idx = pcrel_idx;     // Must be pcrel8
-        else
-            pcrel32_idx = pcrel_idx;    // Must be pcrel32
+        addInstruction(B, (intptr_t)getParamValue(*address, 0).integer,
+            (size_t)getParamValue(*length, 0).integer,
+            (off_t)getParamValue(*offset, 0).integer, msg.id);
+        return;
     }
-    Instr *I = new Instr(offset, address, length, B->original.bytes + offset,
-        B->patched.bytes + offset, B->patched.state + offset, pcrel32_idx,
-        pcrel8_idx, B->elf.pic);
-    insertInstruction(B, I);
+    static std::vector<Instr *> Is;
+    Is.clear();
+    for (size_t i = 0; i < count; i++)
+        Is.push_back(makeInstruction(B,
+            (intptr_t)getParamValue(*address, i).integer,
+            (size_t)getParamValue(*length, i).integer,
+            (off_t)getParamValue(*offset, i).integer, msg.id));
+    addInstructions(B, Is);
 }
 
 /*
@@ -335,26 +1196,23 @@ static void parseInstruction(Binary *B, const Message &msg)
  */
 static void parsePatch(Binary *B, const Message &msg)
 {
-    const char *trampoline = nullptr;
-    off_t offset = 0;
-    Metadata *meta = nullptr;
-    bool have_offset = false, dup = false;
+    const Param *trampoline = nullptr, *offset = nullptr, *meta = nullptr;
+    bool dup = false;
     for (unsigned i = 0; i < msg.num_params; i++)
     {
         switch (msg.params[i].name)
         {
             case PARAM_TRAMPOLINE:
                 dup = dup || (trampoline != nullptr);
-                trampoline = msg.params[i].value.string;
+                trampoline = msg.params + i;
                 break;
             case PARAM_OFFSET:
-                dup = dup || have_offset;
-                offset = (off_t)msg.params[i].value.integer;
-                have_offset = true;
+                dup = dup || (offset != nullptr);
+                offset = msg.params + i;
                 break;
             case PARAM_METADATA:
                 dup = dup || (meta != nullptr);
-                meta = msg.params[i].value.metadata;
+                meta = msg.params + i;
                 break;
             default:
                 break;
@@ -363,26 +1221,31 @@ static void parsePatch(Binary *B, const Message &msg)
     if (trampoline == nullptr)
         error("failed to parse \"patch\" message (id=%u); missing "
             "\"trampoline\" parameter", msg.id);
-    if (!have_offset)
+    if (offset == nullptr)
         error("failed to parse \"patch\" message (id=%u); missing "
             "\"offset\" parameter", msg.id);
     if (dup)
         error("failed to parse \"patch\" message (id=%u); duplicate "
             "parameters detected", msg.id);
 
-    auto i = B->Is.find(offset);
-    if (i == B->Is.end())
-        error("failed to parse \"patch\" message (id=%u); no matching "
-            "instruction at offset (%zd)", msg.id, offset);
-    Instr *I = i->second;
-    I->metadata = meta;
-
-    auto j = B->Ts.find(trampoline);
-    if (j == B->Ts.end())
-        error("failed to parse \"patch\" message (id=%u); no matching "
-            "trampoline with name \"%s\"", msg.id, trampoline);
-    const Trampoline *T = j->second;
-    queuePatch(B, I, T);
+    size_t count = getMessageLength(msg);
+    const char *name = nullptr;
+    const Trampoline *T = nullptr;
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *next = getParamValue(*trampoline, i).string;
+        if (next != name)
+        {
+            name = next;
+            T = findTrampoline(B, name);
+            if (T == nullptr)
+                error("failed to parse \"patch\" message (id=%u); no "
+                    "matching trampoline with name \"%s\"", msg.id, name);
+        }
+        patchInstruction(B, (off_t)getParamValue(*offset, i).integer, T,
+            (meta == nullptr? nullptr: getParamValue(*meta, i).metadata),
+            msg.id);
+    }
 }
 
 /*
@@ -419,57 +1282,11 @@ static void parseEmit(Binary *B, const Message &msg)
     if (filename == nullptr)
         error("failed to parse \"emit\" message (id=%u); missing "
             "\"filename\" parameter", msg.id);
-    if (mapping_size % PAGE_SIZE != 0)
-        error("failed to parse \"emit\" message (id=%u); mapping size "
-            "must be a multiple of the page size (%u), found %zu", msg.id,
-            PAGE_SIZE, mapping_size);
-    if ((mapping_size & (mapping_size - 1)) != 0)
-        error("failed to parse \"emit\" message (id=%u); mapping size "
-            "must be a power-of-two, found %zu", msg.id, mapping_size);
     if (dup)
         error("failed to parse \"emit\" message (id=%u); duplicate "
-            "parameters detected");
-
-
-    // Flush the queue:
-    queueFlush(B, INTPTR_MIN);
-    putchar('\n');
-
-    // Create and optimize the mappings:
-    MappingSet mappings;
-    buildMappings(B->allocator, mapping_size, mappings);
-    optimizeMappings(mappings);
-    putchar('\n');
-
-    // Create the patched binary:
-    B->patched.size = emitElf(B, mappings, mapping_size);
+            "parameters detected", msg.id);
 
-    // Emit the result:
-    switch (format)
-    {
-        case FORMAT_BINARY:
-            emitBinary(filename, B->patched.bytes, B->patched.size);
-            break;
-        case FORMAT_PATCH:
-            emitPatch(filename, /*compress=*/nullptr, B->original.fd,
-                B->patched.bytes, B->patched.size);
-            break;
-        case FORMAT_PATCH_GZ:
-            emitPatch(filename, "gzip", B->original.fd, B->patched.bytes,
-                B->patched.size);
-            break;
-        case FORMAT_PATCH_BZIP2:
-            emitPatch(filename, "bzip2", B->original.fd, B->patched.bytes,
-                B->patched.size);
-            break;
-        case FORMAT_PATCH_XZ:
-            emitPatch(filename, "xz", B->original.fd, B->patched.bytes,
-                B->patched.size);
-            break;
-        default:
-            error("failed to parse \"emit\" message (id=%u); invalid "
-                "\"format\" code %u", msg.id, (unsigned)format);
-    }
+    emitPatchedBinary(B, filename, format, mapping_size, msg.id);
 }
 
 /*
@@ -479,8 +1296,8 @@ static void parseReserve(Binary *B, const Message &msg)
 {
     bool absolute     = false;
     intptr_t address  = 0;
-    intptr_t init     = 0;
-    intptr_t mmap     = 0;
+    intptr_t init     = INTPTR_MIN;
+    intptr_t mmap     = INTPTR_MIN;
     size_t length     = 0;
     Trampoline *bytes = nullptr;
     int protection    = PROT_READ | PROT_EXEC;
@@ -539,54 +1356,20 @@ static void parseReserve(Binary *B, const Message &msg)
         error("failed to parse \"reserve\" message (id=%u); only one of "
             "the \"bytes\" or \"length\" parameters can be specified",
             msg.id);
-    if (absolute && B->elf.pic)
-        address = ABSOLUTE_ADDRESS(address);
-    if (have_init)
-    {
-        if (absolute && B->elf.pic)
-            init = ABSOLUTE_ADDRESS(init);
-        if (bytes == nullptr || init < address ||
-                init >= address + bytes->entries[0].length)
-            error("failed to parse \"reserve\" message (id=%u); \"init\" "
-                "parameter value (" ADDRESS_FORMAT ") is out-of-bounds",
-                msg.id, ADDRESS(address));
-        B->inits.push_back(init);
-    }
-    if (have_mmap)
-    {
-        if (absolute && B->elf.pic)
-            mmap = ABSOLUTE_ADDRESS(mmap);
-        if (bytes == nullptr || mmap < address ||
-                mmap >= address + bytes->entries[0].length)
-            error("failed to parse \"reserve\" message (id=%u); \"mmap\" "
-                "parameter value (" ADDRESS_FORMAT ") is out-of-bounds",
-                msg.id, ADDRESS(address));
-        if (B->mmap != INTPTR_MIN)
-            error("failed to parse \"reserve\" message (id=%u); a mmap "
-                "function was previously defined", msg.id);
-        B->mmap = mmap;
-    }
+    if (bytes == nullptr && (have_init || have_mmap))
+        error("failed to parse \"reserve\" message (id=%u); the \"init\" "
+            "and \"mmap\" parameters require the \"bytes\" parameter",
+            msg.id);
     if (dup)
         error("failed to parse \"reserve\" message (id=%u); duplicate "
             "parameters detected", msg.id);
 
-    if (have_protection && bytes != nullptr)
-        bytes->prot = protection;
     if (bytes != nullptr)
-    {
-        bytes->preload = true;
-        const Alloc *A = allocate(B->allocator, address, address, bytes,
-            nullptr);
-        if (A == nullptr)
-            error("failed to reserve address space at address "
-                ADDRESS_FORMAT, ADDRESS(address));
-    }
-    if (have_length)
-    {
-        if (!reserve(B->allocator, address, address + length))
-            error("failed to reserve address space at address "
-                ADDRESS_FORMAT, ADDRESS(address));
-    }
+        reserveMemory(B, address, bytes,
+            (have_protection? protection: bytes->prot), init, mmap,
+            absolute, msg.id);
+    else
+        reserveMemory(B, address, length, absolute, msg.id);
 }
 
 /*
@@ -623,11 +1406,7 @@ static void parseTrampoline(Binary *B, const Message &msg)
         error("failed to parse \"template\" message (id=%u); duplicate "
             "parameters detected", msg.id);
 
-    auto i = B->Ts.find(name);
-    if (i != B->Ts.end())
-        error("failed to parse \"template\" message (id=%u); a template "
-            "with name \"%s\" already exists", msg.id, name);
-    B->Ts.insert(std::make_pair(name, T));
+    addTrampoline(B, name, T, msg.id);
 }
 
 /*
@@ -695,7 +1474,8 @@ static void parseOptions(const Message &msg)
  */
 Binary *parseMessage(Binary *B, Message &msg)
 {
-    if (msg.method != METHOD_BINARY && B == nullptr)
+    if (msg.method != METHOD_BINARY && msg.method != METHOD_OPTION &&
+            B == nullptr)
         error("failed to parse message stream; got \"%s\" message (id=%u) "
             "before \"binary\" message", getMethodString(msg.method), msg.id);
 
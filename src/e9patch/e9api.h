@@ -22,9 +22,40 @@
 #ifndef __E9API_H
 #define __E9API_H
 
+#include <vector>
+
 #include "e9json.h"
 #include "e9tactics.h"
 
+/*
+ * The typed API.  Each function is the in-process equivalent of the
+ * corresponding JSON-RPC message, and can be called directly by a frontend
+ * that links against libe9patch.a.  The same rules as the JSON-RPC API
+ * apply, e.g., patches must be applied in reverse order.  Options are set
+ * using the global option_* variables, and errors are reported using
+ * error().  The `id' is the caller's message id, which is included in
+ * error messages.
+ */
+Binary *makeBinary(const char *filename, Mode mode);
+Instr *makeInstruction(Binary *B, intptr_t address, size_t length,
+    off_t offset, unsigned id);
+void addInstruction(Binary *B, intptr_t address, size_t length,
+    off_t offset, unsigned id);
+void addInstructions(Binary *B, std::vector<Instr *> &Is);
+void addTrampoline(Binary *B, const char *name, Trampoline *T, unsigned id);
+const Trampoline *findTrampoline(const Binary *B, const char *name);
+void patchInstruction(Binary *B, off_t offset, const Trampoline *T,
+    Metadata *meta, unsigned id);
+void reserveMemory(Binary *B, intptr_t address, size_t length,
+    bool absolute, unsigned id);
+void reserveMemory(Binary *B, intptr_t address, Trampoline *bytes, int prot,
+    intptr_t init, intptr_t mmap, bool absolute, unsigned id);
+size_t emitPatchedBinary(Binary *B, const char *filename, Format format,
+    size_t mapping_size, unsigned id);
+
+/*
+ * The JSON-RPC API.
+ */
 Binary *parseMessage(Binary *B, Message &msg);
 
 #endif
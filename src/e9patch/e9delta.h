@@ -0,0 +1,60 @@
+/*
+ * e9delta.h
+ * Copyright (C) 2020 National University of Singapore
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __E9DELTA_H
+#define __E9DELTA_H
+
+#include <cstdint>
+
+/*
+ * Native binary delta format.
+ *
+ * A delta file is a DeltaHeader followed by a stream of DeltaRecords.  If
+ * the DELTA_FLAG_XZ flag is set, then the record stream is xz-compressed.
+ * Records describe the patched binary in ascending offset order, and are
+ * terminated by a DELTA_END record.  A DELTA_COPY record copies bytes
+ * from the original binary at the same offset, and a DELTA_INSERT record
+ * is immediately followed by `length' bytes of new data.  Records are
+ * page-granular, except for the tail of the file.
+ */
+#define DELTA_MAGIC             "E9DELTA"
+#define DELTA_VERSION           1
+
+#define DELTA_FLAG_XZ           0x1
+
+#define DELTA_END               0x00
+#define DELTA_COPY              0x01
+#define DELTA_INSERT            0x02
+
+struct DeltaHeader
+{
+    char magic[8];                      // DELTA_MAGIC
+    uint32_t version;                   // DELTA_VERSION
+    uint32_t flags;                     // DELTA_FLAG_*
+    uint64_t original_size;             // Original binary size.
+    uint64_t patched_size;              // Patched binary size.
+};
+
+struct DeltaRecord
+{
+    uint64_t kind;                      // DELTA_END/COPY/INSERT
+    uint64_t offset;                    // Patched binary offset.
+    uint64_t length;                    // Length in bytes.
+};
+
+#endif
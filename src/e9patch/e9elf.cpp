@@ -16,6 +16,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+
 #include <cassert>
 #include <cerrno>
 #include <cstdio>
@@ -124,17 +126,20 @@ void parseElf(Allocator &allocator, const char *filename, uint8_t *data,
             error("failed to parse ELF file \"%s\"; file is not executable",
                 filename);
     }
-    if (!pie)
+    if (!pie || option_load_segments)
     {
         // Only PIEs can use the negative address range.  Other PIC such
         // as shared objects cannot use this range since the dynamic
-        // linker tends to use it for other libraries.
+        // linker tends to use it for other libraries.  PT_LOAD segments
+        // also cannot be placed below the first PT_LOAD.
         if (!reserve(allocator, RELATIVE_ADDRESS_MIN, 0x0))
             error("failed to reserve negative-address range");
     }
 
     Elf64_Phdr *phdrs = (Elf64_Phdr *)(data + ehdr->e_phoff);
-    Elf64_Phdr *phdr_note = nullptr, *phdr_dynamic = nullptr;
+    Elf64_Phdr *phdr_note = nullptr, *phdr_dynamic = nullptr,
+        *phdr_load = nullptr;
+    intptr_t load_lb = INTPTR_MAX, load_ub = INTPTR_MIN;
     for (unsigned i = 0; i < ehdr->e_phnum; i++)
     {
         Elf64_Phdr *phdr = phdrs + i;
@@ -147,6 +152,10 @@ void parseElf(Allocator &allocator, const char *filename, uint8_t *data,
                 if (!reserve(allocator, vstart, vend))
                     error("failed to reserve address space range %p..%p",
                         vstart, vend);
+                if (phdr_load == nullptr)
+                    phdr_load = phdr;
+                load_lb = std::min(load_lb, vstart);
+                load_ub = std::max(load_ub, vend);
                 break;
             }
             case PT_DYNAMIC:
@@ -164,12 +173,79 @@ void parseElf(Allocator &allocator, const char *filename, uint8_t *data,
             phdr_dynamic->p_offset + phdr_dynamic->p_memsz > size)
         error("failed to parse ELF file \"%s\": invalid dynamic section",
             filename);
+    if (phdr_load == nullptr)
+        error("failed to parse ELF file \"%s\"; missing PT_LOAD segment",
+            filename);
+
+    // For --load-segments, the PHDR table is relocated to a page after the
+    // end of the file.  The page is loaded using the same offset-to-address
+    // delta as the first PT_LOAD segment, since some kernels assume this
+    // when calculating AT_PHDR.  The page must also be above the memory
+    // image of every PT_LOAD, so the output file is zero-padded up to
+    // (load_ub - delta).  For most binaries this grows the file by roughly
+    // the size of the .bss plus any inter-segment address gaps.  Placing the
+    // page directly after the file-backed data is not possible in general,
+    // since that address usually falls inside the .bss.
+    off_t phdr_offset = -1;
+    intptr_t phdr_addr = INTPTR_MIN;
+    if (option_load_segments)
+    {
+        // PT_LOAD segments also cannot be placed below the first PT_LOAD.
+        if (!pic && load_lb > 0x10000 && !reserve(allocator, 0x10000, load_lb))
+            error("failed to reserve address space range %p..%p",
+                (intptr_t)0x10000, load_lb);
+
+        intptr_t delta = (intptr_t)phdr_load->p_vaddr -
+            (intptr_t)phdr_load->p_offset;
+        phdr_offset = (off_t)std::max((intptr_t)size, load_ub - delta);
+        if (phdr_offset % PAGE_SIZE != 0)
+            phdr_offset += PAGE_SIZE - phdr_offset % PAGE_SIZE;
+        phdr_addr = (intptr_t)phdr_offset + delta;
+        if (!reserve(allocator, phdr_addr, phdr_addr + PAGE_SIZE))
+            error("failed to reserve address space range %p..%p for the "
+                "program headers", phdr_addr, phdr_addr + PAGE_SIZE);
+    }
+
+    // For --lazy-load, the loader state is stored in the page immediately
+    // before the loader.
+    if (option_lazy_load &&
+            !reserve(allocator, LOADER_LAZY_STATE_ADDRESS,
+                LOADER_LAZY_STATE_ADDRESS + PAGE_SIZE))
+        error("failed to reserve address space range %p..%p for the lazy "
+            "loader state", (intptr_t)LOADER_LAZY_STATE_ADDRESS,
+            (intptr_t)LOADER_LAZY_STATE_ADDRESS + PAGE_SIZE);
+
     info.ehdr         = ehdr;
     info.phdr_note    = phdr_note;
     info.phdr_dynamic = phdr_dynamic;
+    info.phdr_offset  = phdr_offset;
+    info.phdr_addr    = phdr_addr;
+    info.load_lb      = load_lb;
     info.pic          = pic;
 }
 
+/*
+ * Calculate the page-level diff statistics.  Only pages in the `dirty' set
+ * can differ from the original.
+ */
+static void diffPages(const uint8_t *original, const uint8_t *data,
+    size_t size, const PageSet &dirty)
+{
+    off_t prev = -1;
+    stat_num_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (off_t offset = dirty.next(0); offset >= 0 && offset < (off_t)size;
+            offset = dirty.next(offset + PAGE_SIZE))
+    {
+        size_t len = std::min(PAGE_SIZE, size - (size_t)offset);
+        if (memcmp(original + offset, data + offset, len) == 0)
+            continue;
+        stat_num_dirty_pages++;
+        if (prev < 0 || prev + (off_t)PAGE_SIZE != offset)
+            stat_num_dirty_ranges++;
+        prev = offset;
+    }
+}
+
 /*
  * Refactor out the patched pages & restore the original pages.
  * For some programs/libraries, it is difficult to ensure the loader is
@@ -179,24 +255,24 @@ void parseElf(Allocator &allocator, const char *filename, uint8_t *data,
  */
 static size_t emitRefactoredPatch(const uint8_t *original, uint8_t *data,
     size_t size, size_t mapping_size, const InstrSet &Is,
-    RefactorSet &refactors)
+    const PageSet &dirty, RefactorSet &refactors)
 {
-    if (option_static_loader)
+    if (option_static_loader || option_load_segments)
         return 0;
 
     assert(size % PAGE_SIZE == 0);
 
-    // Step #1: Find refactorings:
+    // Step #1: Find refactorings (only dirty pages need to be checked):
     intptr_t curr_addr   = INTPTR_MIN;
     off_t    curr_offset = -1;
     size_t   curr_size   = 0;
-    for (off_t offset = 0; offset < (off_t)size; offset += PAGE_SIZE)
+    for (off_t offset = dirty.next(0); offset >= 0 && offset < (off_t)size;
+            offset = dirty.next(offset + PAGE_SIZE))
     {
         if (memcmp(original + offset, data + offset, PAGE_SIZE) == 0)
             continue;
-        auto i = Is.lower_bound(offset);
-        assert(i != Is.end());
-        const Instr *I = i->second;
+        const Instr *I = Is.lowerBound(offset);
+        assert(I != nullptr);
         intptr_t page_addr   = I->addr - (I->addr % PAGE_SIZE);
         off_t    page_offset = I->offset - (I->offset % PAGE_SIZE);
         assert(page_offset == offset);
@@ -354,6 +430,339 @@ static size_t emitLoaderMmap(uint8_t *data, bool pic, intptr_t addr,
     return size;
 }
 
+/*
+ * A mmap() call made by the loader.
+ */
+struct LoaderMmap
+{
+    intptr_t base;              // Virtual base address.
+    size_t len;                 // Length in bytes (0 = removed).
+    off_t offset;               // File offset.
+    int prot;                   // Protections.
+};
+
+/*
+ * All mmap() calls made by the loader.
+ */
+struct LoaderMmaps
+{
+    std::vector<LoaderMmap> preload;        // Preloaded trampoline pages.
+    std::vector<LoaderMmap> trampolines;    // Other trampoline pages.
+    std::vector<LoaderMmap> refactors;      // Refactored pages.
+    std::vector<LoaderMmap> lazy;           // Lazy trampoline pages.
+    std::vector<LoaderMmap> reserve;        // Lazy address reservations.
+    std::vector<LoaderMmap> huge;           // Huge page regions.
+    std::vector<std::vector<LoaderMmap>> huge_mmaps;
+                                            // Huge page region contents.
+
+    bool empty() const
+    {
+        for (const auto *mmaps: {&preload, &trampolines, &refactors, &lazy})
+            for (const auto &m: *mmaps)
+                if (m.len != 0)
+                    return false;
+        return huge.empty();
+    }
+};
+
+/*
+ * Coalesce adjacent virtual ranges that are backed by contiguous file
+ * offsets with the same protections.  Coalesced ranges are removed by
+ * setting the length to zero, so the original order is preserved.
+ */
+static void coalesceLoaderMmaps(std::vector<LoaderMmap> &mmaps)
+{
+    std::vector<size_t> order(mmaps.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(),
+        [&mmaps](size_t i, size_t j)
+        {
+            return (mmaps[i].base < mmaps[j].base);
+        });
+    LoaderMmap *prev = nullptr;
+    for (size_t i: order)
+    {
+        LoaderMmap &m = mmaps[i];
+        if (prev != nullptr &&
+                prev->base + (intptr_t)prev->len == m.base &&
+                prev->offset + (off_t)prev->len == m.offset &&
+                prev->prot == m.prot && prev->len + m.len <= INT32_MAX)
+        {
+            prev->len += m.len;
+            m.len = 0;
+            stat_num_coalesced++;
+            continue;
+        }
+        prev = &m;
+    }
+}
+
+/*
+ * Collect the mmap() calls needed to load the trampoline and refactored
+ * pages.
+ */
+static void collectLoaderMmaps(const RefactorSet &refactors,
+    const MappingSet &mappings, LoaderMmaps &M)
+{
+    std::vector<Bounds> bounds;
+    for (auto mapping: mappings)
+    {
+        stat_num_physical_bytes += mapping->size;
+        off_t offset_0 = mapping->offset;
+        for (; mapping != nullptr; mapping = mapping->merged)
+        {
+            auto &mmaps = (mapping->preload? M.preload: M.trampolines);
+            bounds.clear();
+            getVirtualBounds(mapping, bounds);
+            for (const auto b: bounds)
+            {
+                size_t len = b.ub - b.lb;
+                stat_num_virtual_bytes += len;
+                mmaps.push_back({mapping->base + b.lb, len,
+                    offset_0 + b.lb, mapping->prot});
+            }
+        }
+    }
+    for (const auto &refactor: refactors)
+        M.refactors.push_back({refactor.addr, refactor.size,
+            refactor.patched.offset, PROT_READ | PROT_EXEC});
+
+    coalesceLoaderMmaps(M.preload);
+    coalesceLoaderMmaps(M.trampolines);
+    coalesceLoaderMmaps(M.refactors);
+}
+
+/*
+ * Collect the address ranges that the loader must not replace, namely the
+ * reserved ranges (including the binary itself), the PT_LOAD segments, the
+ * loader, and the huge page regions.  The result is sorted and disjoint.
+ */
+static void getObstacles(const Binary *B, const LoaderMmaps &M,
+    const std::vector<Elf64_Phdr> &segments, std::vector<Bounds> &obstacles)
+{
+    for (auto i = B->allocator.begin(), iend = B->allocator.end();
+            i != iend; ++i)
+    {
+        const Alloc *A = *i;
+        if (A->T == nullptr)
+            obstacles.push_back({A->lb, A->ub});
+    }
+    for (const auto &phdr: segments)
+        obstacles.push_back({(intptr_t)phdr.p_vaddr,
+            (intptr_t)(phdr.p_vaddr + phdr.p_memsz)});
+    obstacles.push_back({(intptr_t)LOADER_ADDRESS,
+        (intptr_t)LOADER_ADDRESS + INT32_MAX});
+    for (const auto &m: M.huge)
+        obstacles.push_back({m.base, m.base + (intptr_t)m.len});
+    std::sort(obstacles.begin(), obstacles.end(),
+        [](const Bounds &a, const Bounds &b)
+        {
+            return (a.lb < b.lb);
+        });
+}
+
+/*
+ * Test if the range [lb..ub) overlaps an obstacle.
+ */
+static bool isObstructed(const std::vector<Bounds> &obstacles, intptr_t lb,
+    intptr_t ub)
+{
+    // The obstacles are disjoint, so are also sorted by `ub'.
+    auto i = std::upper_bound(obstacles.begin(), obstacles.end(), lb,
+        [](intptr_t lb, const Bounds &b)
+        {
+            return (lb < b.ub);
+        });
+    return (i != obstacles.end() && i->lb < ub);
+}
+
+/*
+ * Move trampoline mmap() calls into huge page regions (--huge-pages).  A
+ * region is a huge page aligned range that is sufficiently populated with
+ * trampoline pages, and does not overlap any obstacle.  The loader maps
+ * each region as a single anonymous mapping advised to use transparent
+ * huge pages, and copies the trampoline pages into it.  Note that regions
+ * only use real huge pages if the region is aligned at runtime, which is
+ * not guaranteed for PIC.
+ */
+static void selectHugeMmaps(const Binary *B, LoaderMmaps &M,
+    const std::vector<Elf64_Phdr> &segments)
+{
+    const intptr_t HUGE = (intptr_t)HUGE_PAGE_SIZE;
+    const size_t HUGE_MIN_PAGES = 16;   // Min. iTLB entries saved.
+
+    struct Region
+    {
+        int prot = -1;
+        bool ok = true;
+        size_t len = 0;
+    };
+    std::map<intptr_t, Region> regions;
+    for (auto *mmaps: {&M.preload, &M.trampolines})
+    {
+        // Trampolines that must use the user mmap() function cannot be
+        // moved, so neither can any region containing them.
+        bool user = (mmaps == &M.trampolines && B->mmap != INTPTR_MIN);
+        for (const auto &m: *mmaps)
+        {
+            if (m.len == 0)
+                continue;
+            intptr_t lb = m.base - (m.base % HUGE + HUGE) % HUGE;
+            intptr_t ub = m.base + (intptr_t)m.len;
+            Region &region = regions[lb];
+            region.ok = region.ok && !user && ub <= lb + HUGE &&
+                (region.prot < 0 || region.prot == m.prot) &&
+                !(B->elf.pic && IS_ABSOLUTE(m.base));
+            region.prot = m.prot;
+            region.len += m.len;
+            for (lb += HUGE; lb < ub; lb += HUGE)
+                regions[lb].ok = false;
+        }
+    }
+
+    std::vector<Bounds> obstacles;
+    getObstacles(B, M, segments, obstacles);
+    for (const auto &entry: regions)
+    {
+        intptr_t lb = entry.first;
+        const Region &region = entry.second;
+        if (!region.ok || region.len < HUGE_MIN_PAGES * PAGE_SIZE ||
+                isObstructed(obstacles, lb, lb + HUGE))
+            continue;
+        M.huge.push_back({lb, HUGE_PAGE_SIZE, 0, region.prot});
+    }
+    if (M.huge.empty())
+        return;
+
+    M.huge_mmaps.resize(M.huge.size());
+    for (auto *mmaps: {&M.preload, &M.trampolines})
+    {
+        if (mmaps == &M.trampolines && B->mmap != INTPTR_MIN)
+            break;                  // Must use the user mmap() function.
+        for (auto &m: *mmaps)
+        {
+            if (m.len == 0)
+                continue;
+            auto i = std::upper_bound(M.huge.begin(), M.huge.end(), m.base,
+                [](intptr_t base, const LoaderMmap &h)
+                {
+                    return (base < h.base);
+                });
+            if (i == M.huge.begin())
+                continue;
+            --i;
+            if (m.base >= i->base + (intptr_t)i->len)
+                continue;
+            M.huge_mmaps[i - M.huge.begin()].push_back(m);
+            m.len = 0;
+        }
+    }
+
+    stat_num_huge_regions = M.huge.size();
+    for (auto i = B->allocator.begin(), iend = B->allocator.end();
+            i != iend; ++i)
+    {
+        const Alloc *A = *i;
+        if (A->T == nullptr)
+            continue;
+        auto j = std::upper_bound(M.huge.begin(), M.huge.end(), A->lb,
+            [](intptr_t lb, const LoaderMmap &h)
+            {
+                return (lb < h.base);
+            });
+        if (j != M.huge.begin() && A->lb < (j-1)->base + (intptr_t)(j-1)->len)
+            stat_num_huge_trampolines++;
+    }
+}
+
+/*
+ * Move the remaining trampoline mmap() calls into the lazy table
+ * (--lazy-load).  The lazy address ranges are reserved using PROT_NONE
+ * mappings, so that the SIGSEGV handler can load the pages on demand.  A
+ * reservation may span small gaps between lazy ranges, provided that the
+ * gap does not overlap an obstacle.
+ */
+static void selectLazyMmaps(const Binary *B, LoaderMmaps &M,
+    const std::vector<Elf64_Phdr> &segments)
+{
+    if (B->mmap != INTPTR_MIN)
+        return;                     // Must use the user mmap() function.
+    for (auto &m: M.trampolines)
+    {
+        if (m.len == 0)
+            continue;
+        M.lazy.push_back(m);
+        m.len = 0;
+    }
+    if (M.lazy.empty())
+        return;
+
+    // Note: absolute addresses are always greater than relative addresses,
+    //       so the relative entries are sorted first.
+    std::sort(M.lazy.begin(), M.lazy.end(),
+        [](const LoaderMmap &a, const LoaderMmap &b)
+        {
+            return (a.base < b.base);
+        });
+
+    std::vector<Bounds> obstacles;
+    getObstacles(B, M, segments, obstacles);
+
+    const intptr_t MAX_GAP = 16 * PAGE_SIZE;
+    const intptr_t MAX_LEN = INT32_MAX - (PAGE_SIZE - 1);
+    for (const auto &m: M.lazy)
+    {
+        if (!M.reserve.empty())
+        {
+            LoaderMmap &r = M.reserve.back();
+            intptr_t lb = r.base + (intptr_t)r.len, ub = m.base;
+            bool ok = (IS_ABSOLUTE(r.base) == IS_ABSOLUTE(m.base) &&
+                ub >= lb && ub - lb <= MAX_GAP &&
+                m.base + (intptr_t)m.len - r.base <= MAX_LEN);
+            ok = ok && (ub == lb || !isObstructed(obstacles, lb, ub));
+            if (ok)
+            {
+                r.len = (size_t)(m.base + (intptr_t)m.len - r.base);
+                continue;
+            }
+        }
+        M.reserve.push_back({m.base, m.len, 0, PROT_NONE});
+    }
+    stat_num_lazy_mappings     = M.lazy.size();
+    stat_num_lazy_reservations = M.reserve.size();
+}
+
+/*
+ * Emit mmap() system calls for the given set of loader mappings.
+ */
+static size_t emitLoaderMmaps(uint8_t *data, bool pic, const char *what,
+    const std::vector<LoaderMmap> &mmaps, size_t &prev_len, int &prev_prot,
+    off_t &prev_offset, bool user_mmap)
+{
+    // Note: the mmap() calls are emitted in the original order, since
+    //       this tends to allow more register values to be reused.
+    size_t size = 0;
+    for (const auto &m: mmaps)
+    {
+        if (m.len == 0)
+            continue;
+        debug("load %s: mmap(" ADDRESS_FORMAT ", %zu, %s%s%s0, "
+            "MAP_FIXED | MAP_PRIVATE, fd, +%zd)",
+            what, ADDRESS(m.base), m.len,
+            (m.prot & PROT_READ? "PROT_READ | ": ""),
+            (m.prot & PROT_WRITE? "PROT_WRITE | ": ""),
+            (m.prot & PROT_EXEC? "PROT_EXEC | ": ""), m.offset);
+        size += emitLoaderMmap(data + size, pic, m.base, m.len, prev_len,
+            m.prot, prev_prot, m.offset, prev_offset, user_mmap);
+        prev_len    = m.len;
+        prev_offset = m.offset;
+        prev_prot   = m.prot;
+        stat_num_mmaps++;
+    }
+    return size;
+}
+
 /*
  * Loads a function pointer into %rax.
  */
@@ -388,9 +797,8 @@ static size_t emitLoadFuncPtrIntoRAX(uint8_t *data, bool pic, intptr_t fptr)
 /*
  * Emit the loader.
  */
-static size_t emitLoader(const RefactorSet &refactors,
-    const MappingSet &mappings, uint8_t *data, intptr_t entry, bool pic,
-    const InitSet &inits, intptr_t mmap, Mode mode)
+static size_t emitLoader(const LoaderMmaps &M, uint8_t *data, intptr_t entry,
+    bool pic, const InitSet &inits, intptr_t mmap, Mode mode)
 {
     /*
      * Stage #1
@@ -399,6 +807,10 @@ static size_t emitLoader(const RefactorSet &refactors,
     // Step (1): Emit the loader entry:
     memcpy(data, e9loader_bin, e9loader_bin_len);
     size_t size = e9loader_bin_len;
+    data[LOADER_EXE_FLAG_OFFSET] = (mode == MODE_EXECUTABLE? 0x01: 0x00);
+    uint32_t lazy_offset = 0, huge_offset = 0;
+    memcpy(data + LOADER_LAZY_OFFSET, &lazy_offset, sizeof(lazy_offset));
+    memcpy(data + LOADER_HUGE_OFFSET, &huge_offset, sizeof(huge_offset));
 
     /*
      * Stage #2
@@ -431,61 +843,14 @@ static size_t emitLoader(const RefactorSet &refactors,
     off_t prev_offset = -1;
     size_t prev_len   = SIZE_MAX;
     int prev_prot     = prot;
-    std::vector<Bounds> bounds;
-    for (int preload = 1; preload >= false; preload--)
-    {
-        for (auto mapping: mappings)
-        {
-            if (preload == false)
-                stat_num_physical_bytes += mapping->size;
-            off_t offset_0  = mapping->offset;
-            for (; mapping != nullptr; mapping = mapping->merged)
-            {
-                if (mapping->preload != (bool)preload)
-                    continue;
-                bounds.clear();
-                getVirtualBounds(mapping, bounds);
-                for (const auto b: bounds)
-                {
-                    intptr_t base = mapping->base + b.lb;
-                    size_t len    = b.ub - b.lb;
-                    off_t offset  = offset_0 + b.lb;
-                    int prot      = mapping->prot;
-                    debug("load trampoline: mmap(" ADDRESS_FORMAT ", %zu, "
-                        "%s%s%s0, MAP_FIXED | MAP_PRIVATE, fd, +%zd)",
-                        ADDRESS(base), len,
-                        (prot & PROT_READ? "PROT_READ | ": ""),
-                        (prot & PROT_WRITE? "PROT_WRITE | ": ""),
-                        (prot & PROT_EXEC? "PROT_EXEC | ": ""), offset);
-                    stat_num_virtual_bytes += len;
-                    size += emitLoaderMmap(data + size, pic, base, len,
-                        prev_len, prot, prev_prot, offset, prev_offset,
-                        (!preload && mmap != INTPTR_MIN));
-                    prev_len    = len;
-                    prev_offset = offset;
-                    prev_prot   = prot;
-                }
-            }
-        }
-    }
-    for (const auto &refactor: refactors)
-    {
-        intptr_t base = refactor.addr;
-        size_t len    = refactor.size;
-        off_t offset  = refactor.patched.offset;
-        int prot      = PROT_READ | PROT_EXEC;
-        debug("load refactoring: mmap(" ADDRESS_FORMAT ", %zu, %s%s%s0, "
-            "MAP_FIXED | MAP_PRIVATE, fd, +%zd)",
-            ADDRESS(base), len,
-            (prot & PROT_READ? "PROT_READ | ": ""),
-            (prot & PROT_WRITE? "PROT_WRITE | ": ""),
-            (prot & PROT_EXEC? "PROT_EXEC | ": ""), offset);
-        size += emitLoaderMmap(data + size, pic, base, len, prev_len, prot,
-            prev_prot, offset, prev_offset);
-        prev_len    = len;
-        prev_offset = offset;
-        prev_prot   = prot;
-    }
+    size += emitLoaderMmaps(data + size, pic, "reservation", M.reserve,
+        prev_len, prev_prot, prev_offset, /*user_mmap=*/false);
+    size += emitLoaderMmaps(data + size, pic, "trampoline", M.preload,
+        prev_len, prev_prot, prev_offset, /*user_mmap=*/false);
+    size += emitLoaderMmaps(data + size, pic, "trampoline", M.trampolines,
+        prev_len, prev_prot, prev_offset, (mmap != INTPTR_MIN));
+    size += emitLoaderMmaps(data + size, pic, "refactoring", M.refactors,
+        prev_len, prev_prot, prev_offset, /*user_mmap=*/false);
 
     // Step (3): Close the fd:
     const uint8_t close_fd[] =
@@ -622,14 +987,205 @@ static size_t emitLoader(const RefactorSet &refactors,
         data[size++] = 0xc3;
     }
 
+    /*
+     * Lazy table
+     */
+
+    // Emit the lazy table (if necessary).
+    if (!M.lazy.empty())
+    {
+        size_t pad = (size % sizeof(LazyEntry::addr) == 0? 0:
+            sizeof(LazyEntry::addr) - size % sizeof(LazyEntry::addr));
+        memset(data + size, 0x0, pad);
+        size += pad;
+        lazy_offset = (uint32_t)size;
+        memcpy(data + LOADER_LAZY_OFFSET, &lazy_offset, sizeof(lazy_offset));
+
+        LazyHeader header;
+        header.num          = (uint32_t)M.lazy.size();
+        header.num_relative = 0;
+        for (const auto &m: M.lazy)
+            header.num_relative += (IS_ABSOLUTE(m.base)? 0: 1);
+        memcpy(data + size, &header, sizeof(header));
+        size += sizeof(header);
+        for (const auto &m: M.lazy)
+        {
+            debug("load lazy: " ADDRESS_FORMAT " (%zu bytes, +%zd)",
+                ADDRESS(m.base), m.len, m.offset);
+            LazyEntry entry;
+            entry.addr   = BASE_ADDRESS(m.base);
+            entry.offset = (uint64_t)m.offset;
+            entry.size   = (uint32_t)m.len;
+            entry.prot   = (int32_t)m.prot;
+            memcpy(data + size, &entry, sizeof(entry));
+            size += sizeof(entry);
+        }
+    }
+
+    /*
+     * Huge page table
+     */
+
+    // Emit the huge page table (if necessary).
+    if (!M.huge.empty())
+    {
+        size_t pad = (size % sizeof(HugeHeader) == 0? 0:
+            sizeof(HugeHeader) - size % sizeof(HugeHeader));
+        memset(data + size, 0x0, pad);
+        size += pad;
+        huge_offset = (uint32_t)size;
+        memcpy(data + LOADER_HUGE_OFFSET, &huge_offset, sizeof(huge_offset));
+
+        HugeHeader header;
+        header.num = M.huge.size();
+        memcpy(data + size, &header, sizeof(header));
+        size += sizeof(header);
+        for (size_t i = 0; i < M.huge.size(); i++)
+        {
+            const LoaderMmap &h = M.huge[i];
+            const auto &mmaps = M.huge_mmaps[i];
+            debug("load huge: " ADDRESS_FORMAT " (%zu bytes, %zu mappings)",
+                ADDRESS(h.base), h.len, mmaps.size());
+            HugeRegion region;
+            region.addr = BASE_ADDRESS(h.base);
+            region.size = h.len;
+            region.num  = (uint32_t)mmaps.size();
+            region.prot = (int32_t)h.prot;
+            memcpy(data + size, &region, sizeof(region));
+            size += sizeof(region);
+            for (const auto &m: mmaps)
+            {
+                HugeEntry entry;
+                entry.offset = (uint64_t)m.offset;
+                entry.addr   = (uint32_t)(m.base - h.base);
+                entry.size   = (uint32_t)m.len;
+                memcpy(data + size, &entry, sizeof(entry));
+                size += sizeof(entry);
+            }
+        }
+    }
+
     return size;
 }
 
 /*
- * Emit the (modified) ELF binary.
+ * Move loader mmap() calls into PT_LOAD segments (--load-segments).  The
+ * number of segments is limited, since the kernel rejects PHDR tables
+ * larger than a page.  Any remaining mmap() calls are left to the loader.
+ */
+static void selectSegments(const Binary *B, LoaderMmaps &M,
+    std::vector<Elf64_Phdr> &segments)
+{
+    // Note: the table needs a PT_LOAD for itself.  The loader (if any)
+    //       replaces the PT_NOTE, so does not need an extra entry.
+    const size_t MAX_PHDRS = PAGE_SIZE / sizeof(Elf64_Phdr);
+    size_t num_phdrs = (size_t)B->elf.ehdr->e_phnum + 1;
+    size_t max = (num_phdrs < MAX_PHDRS? MAX_PHDRS - num_phdrs: 0);
+
+    for (auto *mmaps: {&M.preload, &M.trampolines})
+    {
+        if (mmaps == &M.trampolines && B->mmap != INTPTR_MIN)
+            break;                  // Must use the user mmap() function.
+        for (auto &m: *mmaps)
+        {
+            if (segments.size() >= max)
+                break;
+            if (m.len == 0 || (B->elf.pic && IS_ABSOLUTE(m.base)))
+                continue;
+            intptr_t addr = BASE_ADDRESS(m.base);
+            if (addr <= B->elf.load_lb)
+                continue;           // Must not precede the first PT_LOAD.
+
+            Elf64_Phdr phdr;
+            phdr.p_type   = PT_LOAD;
+            phdr.p_flags  = ((m.prot & PROT_READ)?  PF_R: 0) |
+                            ((m.prot & PROT_WRITE)? PF_W: 0) |
+                            ((m.prot & PROT_EXEC)?  PF_X: 0);
+            phdr.p_offset = m.offset;
+            phdr.p_vaddr  = (Elf64_Addr)addr;
+            phdr.p_paddr  = (Elf64_Addr)addr;
+            phdr.p_filesz = m.len;
+            phdr.p_memsz  = m.len;
+            phdr.p_align  = PAGE_SIZE;
+            segments.push_back(phdr);
+            m.len = 0;
+        }
+    }
+    stat_num_segments = segments.size();
+}
+
+/*
+ * Emit the relocated PHDR table (--load-segments).  The table consists of
+ * the original PHDRs, the PT_LOAD segments, the (optional) loader, and a
+ * PT_LOAD for the table itself.  PT_LOADs must be sorted by address.
+ */
+static void emitPhdrs(const Binary *B, uint8_t *data,
+    const std::vector<Elf64_Phdr> &segments, const Elf64_Phdr *loader)
+{
+    Elf64_Ehdr *ehdr = B->elf.ehdr;
+    const Elf64_Phdr *phdrs = (const Elf64_Phdr *)(data + ehdr->e_phoff);
+    std::vector<Elf64_Phdr> prefix, loads, suffix;
+    for (unsigned i = 0; i < ehdr->e_phnum; i++)
+    {
+        Elf64_Phdr phdr = phdrs[i];
+        if (loader != nullptr && phdrs + i == B->elf.phdr_note)
+            phdr = *loader;
+        if (phdr.p_type == PT_LOAD)
+            loads.push_back(phdr);
+        else if (loads.empty())
+            prefix.push_back(phdr);
+        else
+            suffix.push_back(phdr);
+    }
+    loads.insert(loads.end(), segments.begin(), segments.end());
+
+    size_t num_phdrs = prefix.size() + loads.size() + 1 + suffix.size();
+    size_t phdrs_size = num_phdrs * sizeof(Elf64_Phdr);
+    assert(phdrs_size <= PAGE_SIZE);
+    Elf64_Phdr self;
+    self.p_type   = PT_LOAD;
+    self.p_flags  = PF_R;
+    self.p_offset = B->elf.phdr_offset;
+    self.p_vaddr  = (Elf64_Addr)B->elf.phdr_addr;
+    self.p_paddr  = (Elf64_Addr)B->elf.phdr_addr;
+    self.p_filesz = phdrs_size;
+    self.p_memsz  = phdrs_size;
+    self.p_align  = PAGE_SIZE;
+    loads.push_back(self);
+    std::stable_sort(loads.begin(), loads.end(),
+        [](const Elf64_Phdr &a, const Elf64_Phdr &b)
+        {
+            return (a.p_vaddr < b.p_vaddr);
+        });
+
+    Elf64_Phdr *table = (Elf64_Phdr *)(data + B->elf.phdr_offset);
+    size_t i = 0;
+    for (const auto *phdrs: {&prefix, &loads, &suffix})
+    {
+        for (auto phdr: *phdrs)
+        {
+            if (phdr.p_type == PT_PHDR)
+            {
+                phdr.p_offset = self.p_offset;
+                phdr.p_vaddr  = self.p_vaddr;
+                phdr.p_paddr  = self.p_paddr;
+                phdr.p_filesz = phdrs_size;
+                phdr.p_memsz  = phdrs_size;
+            }
+            table[i++] = phdr;
+        }
+    }
+    ehdr->e_phoff = (Elf64_Off)B->elf.phdr_offset;
+    ehdr->e_phnum = (Elf64_Half)num_phdrs;
+}
+
+/*
+ * Emit the (modified) ELF binary.  If `flatten' is false, then space and
+ * file offsets are assigned to the mappings, but the mapping contents are
+ * not written (see emitBinary()).
  */
 size_t emitElf(const Binary *B, const MappingSet &mappings,
-    size_t mapping_size)
+    size_t mapping_size, bool flatten)
 {
     uint8_t *data = B->patched.bytes;
     size_t size = B->patched.size;
@@ -638,11 +1194,18 @@ size_t emitElf(const Binary *B, const MappingSet &mappings,
     stat_input_file_size = size;
     size = (size % PAGE_SIZE == 0?
         size: size + PAGE_SIZE - (size % PAGE_SIZE));
+    if (option_load_segments)
+    {
+        // Skip the relocated PHDR table page (emitted below).
+        assert((size_t)B->elf.phdr_offset >= size);
+        size = (size_t)B->elf.phdr_offset + PAGE_SIZE;
+    }
 
     // Step (2): Refactor the patching (if necessary):
+    diffPages(B->original.bytes, data, B->size, B->dirty);
     RefactorSet refactors;
     size += emitRefactoredPatch(B->original.bytes, data, size, mapping_size,
-        B->Is, refactors);
+        B->Is, B->dirty, refactors);
     
     // Step (3): Emit all mappings:
     for (auto mapping: mappings)
@@ -650,12 +1213,34 @@ size_t emitElf(const Binary *B, const MappingSet &mappings,
         uint8_t *base = data + size;
         mapping->offset = (off_t)size;
         printf("[\33[33m%.16lX\33[0m]", mapping->key);
-        flattenMapping(base, mapping, /*int3=*/0xcc);
+        if (flatten)
+            flattenMapping(base, mapping, /*int3=*/0xcc);
         size += mapping->size;
     }
     putchar('\n');
 
-    // Step (4): Modify the entry address.
+    // Step (4): Collect the mmap() calls, and move as many as possible
+    // into PT_LOAD segments, huge page regions, or the lazy table (if
+    // enabled).  The loader is only necessary if there is some mmap() call
+    // or initialization function remaining.
+    LoaderMmaps M;
+    collectLoaderMmaps(refactors, mappings, M);
+    std::vector<Elf64_Phdr> segments;
+    if (option_load_segments)
+        selectSegments(B, M, segments);
+    if (option_huge_pages)
+        selectHugeMmaps(B, M, segments);
+    if (option_lazy_load)
+        selectLazyMmaps(B, M, segments);
+    bool loader = (!option_load_segments || !M.empty() || !B->inits.empty());
+    if (!loader)
+    {
+        emitPhdrs(B, data, segments, nullptr);
+        stat_output_file_size = size;
+        return size;
+    }
+
+    // Step (5): Modify the entry address.
     intptr_t old_entry = 0;
     switch (B->mode)
     {
@@ -692,17 +1277,18 @@ size_t emitElf(const Binary *B, const MappingSet &mappings,
         }
     }
 
-    // Step (5): Emit the loader:
+    // Step (6): Emit the loader:
     off_t loader_offset = (off_t)size;
-    size_t loader_size  = emitLoader(refactors, mappings, data + size,
-        old_entry, B->elf.pic, B->inits, B->mmap, B->mode);
+    size_t loader_size  = emitLoader(M, data + size, old_entry, B->elf.pic,
+        B->inits, B->mmap, B->mode);
     size += loader_size;
 
-    // Step (6): Modify the PHDR to load the loader.
+    // Step (7): Modify the PHDR to load the loader.
     // NOTE: Currently we use the well-known and easy-to-implement PT_NOTE
     //       injection method to load the loader.  Some alternative methods
     //       may also work, but are not yet implemented.
-    Elf64_Phdr *phdr = B->elf.phdr_note;
+    Elf64_Phdr loader_phdr;
+    Elf64_Phdr *phdr = (option_load_segments? &loader_phdr: B->elf.phdr_note);
     phdr->p_type   = PT_LOAD;
     phdr->p_flags  = PF_X | PF_R;
     phdr->p_offset = loader_offset;
@@ -711,6 +1297,8 @@ size_t emitElf(const Binary *B, const MappingSet &mappings,
     phdr->p_filesz = loader_size;
     phdr->p_memsz  = loader_size;
     phdr->p_align  = PAGE_SIZE;
+    if (option_load_segments)
+        emitPhdrs(B, data, segments, phdr);
 
     stat_output_file_size = size;
     return size;
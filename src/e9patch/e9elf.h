@@ -28,6 +28,6 @@
 void parseElf(Allocator &allocator, const char *filename, uint8_t *data,
     size_t size, Mode mode, ElfInfo &info);
 size_t emitElf(const Binary *B, const MappingSet &mappings,
-    size_t mapping_size);
+    size_t mapping_size, bool flatten = true);
 
 #endif
@@ -17,6 +17,9 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 #include <cerrno>
 #include <cstdint>
@@ -30,30 +33,293 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#ifdef E9_LZMA
+#include <lzma.h>
+#endif
+
+#include "e9delta.h"
 #include "e9emit.h"
+#include "e9mapping.h"
 #include "e9patch.h"
 
+/*
+ * Maximum number of mappings flattened & written at once.
+ */
+#define WRITE_MAPPINGS_MAX          256
+
+/*
+ * Write a buffer to the output at the given offset.
+ */
+static void writeBuffer(int fd, const char *filename, const uint8_t *buf,
+    size_t len, off_t offset)
+{
+    for (size_t k = 0; k < len; )
+    {
+        ssize_t r = pwrite(fd, buf + k, len - k, offset + k);
+        if (r < 0)
+            error("failed to write output to file \"%s\": %s", filename,
+                strerror(errno));
+        k += (size_t)r;
+    }
+}
+
+/*
+ * Flatten batches of (contiguous) mappings and write them to the output.
+ */
+static void writeMappings(int fd, const char *filename,
+    const MappingSet &mappings, std::atomic<size_t> &next)
+{
+    std::vector<uint8_t> buf;
+    while (true)
+    {
+        size_t i = next.fetch_add(WRITE_MAPPINGS_MAX);
+        if (i >= mappings.size())
+            return;
+        size_t j = std::min(i + WRITE_MAPPINGS_MAX, mappings.size());
+        off_t offset = mappings[i]->offset;
+        size_t len   = (size_t)(mappings[j-1]->offset - offset) +
+            mappings[j-1]->size;
+        buf.resize(len);
+        for (; i < j; i++)
+            flattenMapping(buf.data() + (mappings[i]->offset - offset),
+                mappings[i], /*int3=*/0xcc);
+        writeBuffer(fd, filename, buf.data(), len, offset);
+    }
+}
+
 /*
  * Emit the complete patched executable binary file.
+ *
+ * The (already placed) mappings have not been flattened into `bin'.
+ * Instead, the mappings are flattened in parallel (using `option_threads'
+ * threads) and written directly to the output file, so the patched
+ * trampoline pages never need to be held in memory all at once.  If the
+ * output is not a regular file (e.g., a pipe), then the mappings are
+ * flattened into `bin' and written sequentially.
  */
-void emitBinary(const char *filename, const uint8_t *bin, size_t len)
+void emitBinary(const char *filename, uint8_t *bin, size_t len,
+    const MappingSet &mappings)
 {
-    FILE *out = fopen(filename, "w");
-    if (out == nullptr)
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC,
+        S_IRUSR | S_IWUSR | S_IXUSR |
+        S_IRGRP | S_IWGRP | S_IXGRP |
+        S_IROTH | S_IWOTH | S_IXOTH);
+    if (fd < 0)
         error("failed to open output file \"%s\" for writing: %s", filename,
             strerror(errno));
-    if (fwrite(bin, sizeof(uint8_t), len, out) != len)
-        error("failed to write output to file \"%s\": %s", filename,
+    struct stat buf;
+    if (fstat(fd, &buf) != 0)
+        error("failed to stat output file \"%s\": %s", filename,
             strerror(errno));
-    if (fchmod(fileno(out), S_IRUSR | S_IWUSR | S_IXUSR |
-                            S_IRGRP | S_IWGRP | S_IXGRP |
-                            S_IROTH | S_IWOTH | S_IXOTH))
+
+    if (!S_ISREG(buf.st_mode) || mappings.empty())
+    {
+        for (auto mapping: mappings)
+            flattenMapping(bin + mapping->offset, mapping, /*int3=*/0xcc);
+        for (size_t k = 0; k < len; )
+        {
+            ssize_t r = write(fd, bin + k, len - k);
+            if (r < 0)
+                error("failed to write output to file \"%s\": %s",
+                    filename, strerror(errno));
+            k += (size_t)r;
+        }
+    }
+    else
+    {
+        // The mappings are contiguous, so write the data before & after:
+        off_t lb = mappings.front()->offset;
+        off_t ub = mappings.back()->offset + mappings.back()->size;
+        if (ftruncate(fd, (off_t)len) != 0)
+            error("failed to resize output file \"%s\": %s", filename,
+                strerror(errno));
+        writeBuffer(fd, filename, bin, (size_t)lb, 0);
+        writeBuffer(fd, filename, bin + ub, len - (size_t)ub, ub);
+
+        std::atomic<size_t> next(0);
+        size_t num_threads = std::min((size_t)option_threads,
+            (mappings.size() + WRITE_MAPPINGS_MAX - 1) / WRITE_MAPPINGS_MAX);
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < num_threads; i++)
+            threads.emplace_back(writeMappings, fd, filename,
+                std::cref(mappings), std::ref(next));
+        writeMappings(fd, filename, mappings, next);
+        for (auto &thread: threads)
+            thread.join();
+    }
+
+    if (fchmod(fd, S_IRUSR | S_IWUSR | S_IXUSR |
+                   S_IRGRP | S_IWGRP | S_IXGRP |
+                   S_IROTH | S_IWOTH | S_IXOTH))
     {
         // This is a warning since the output might be /dev/null
         warning("failed to set execute permission for output file \"%s\": %s",
             filename, strerror(errno));
     }
-    if (fclose(out) < 0)
+    if (close(fd) < 0)
+        error("failed to close output file \"%s\": %s", filename,
+            strerror(errno));
+}
+
+/*
+ * Delta writer.
+ */
+struct DeltaWriter
+{
+    int fd;                             // Output file descriptor.
+    const char *filename;               // Output filename.
+#ifdef E9_LZMA
+    lzma_stream *xz;                    // Compressor (or nullptr).
+    uint8_t buf[BUFSIZ];                // Compressor output buffer.
+#endif
+};
+
+/*
+ * Write bytes to the output.
+ */
+static void writeAll(int fd, const char *filename, const uint8_t *buf,
+    size_t len)
+{
+    for (size_t k = 0; k < len; )
+    {
+        ssize_t r = write(fd, buf + k, len - k);
+        if (r < 0)
+            error("failed to write output to file \"%s\": %s", filename,
+                strerror(errno));
+        k += (size_t)r;
+    }
+}
+
+#ifdef E9_LZMA
+/*
+ * Run the compressor until the input is consumed (or until the stream is
+ * finished for LZMA_FINISH).
+ */
+static void deltaCompress(DeltaWriter &W, lzma_action action)
+{
+    while (true)
+    {
+        W.xz->next_out  = W.buf;
+        W.xz->avail_out = sizeof(W.buf);
+        lzma_ret r = lzma_code(W.xz, action);
+        if (r != LZMA_OK && r != LZMA_STREAM_END)
+            error("failed to compress output file \"%s\"; xz error %d",
+                W.filename, (int)r);
+        writeAll(W.fd, W.filename, W.buf, sizeof(W.buf) - W.xz->avail_out);
+        if (action == LZMA_FINISH? r == LZMA_STREAM_END:
+                W.xz->avail_in == 0 && W.xz->avail_out != 0)
+            return;
+    }
+}
+#endif
+
+/*
+ * Write bytes to the (possibly compressed) delta record stream.
+ */
+static void deltaWrite(DeltaWriter &W, const void *buf, size_t len)
+{
+#ifdef E9_LZMA
+    if (W.xz != nullptr)
+    {
+        W.xz->next_in  = (const uint8_t *)buf;
+        W.xz->avail_in = len;
+        deltaCompress(W, LZMA_RUN);
+        return;
+    }
+#endif
+    writeAll(W.fd, W.filename, (const uint8_t *)buf, len);
+}
+
+/*
+ * Write a delta record.
+ */
+static void deltaRecord(DeltaWriter &W, uint64_t kind, uint64_t offset,
+    uint64_t length)
+{
+    DeltaRecord record = {kind, offset, length};
+    deltaWrite(W, &record, sizeof(record));
+}
+
+/*
+ * Emit a binary delta in the native format (see e9delta.h).  Pages of the
+ * patched binary that are unchanged are encoded as DELTA_COPY records, and
+ * all other pages as DELTA_INSERT records.  The record stream is optionally
+ * xz-compressed in-process (if built with E9_LZMA).
+ */
+void emitDelta(const char *filename, bool compress, const uint8_t *bin1,
+    size_t len1, const uint8_t *bin2, size_t len2)
+{
+#ifndef E9_LZMA
+    if (compress)
+        error("failed to emit delta file \"%s\"; the \"delta.xz\" format "
+            "requires e9patch to be built with xz support (E9_LZMA=1)",
+            filename);
+#endif
+
+    int fd = STDOUT_FILENO;
+    if (strcmp(filename, "-") != 0)
+    {
+        fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC,
+            S_IRUSR | S_IRGRP | S_IROTH |
+            S_IWUSR | S_IWGRP | S_IWOTH);
+        if (fd < 0)
+            error("failed to open file \"%s\" for writing: %s", filename,
+                strerror(errno));
+    }
+
+    DeltaHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DELTA_MAGIC, sizeof(DELTA_MAGIC));
+    header.version       = DELTA_VERSION;
+    header.flags         = (compress? DELTA_FLAG_XZ: 0x0);
+    header.original_size = len1;
+    header.patched_size  = len2;
+    writeAll(fd, filename, (const uint8_t *)&header, sizeof(header));
+
+    DeltaWriter W;
+    W.fd       = fd;
+    W.filename = filename;
+#ifdef E9_LZMA
+    W.xz       = nullptr;
+    lzma_stream xz = LZMA_STREAM_INIT;
+    if (compress)
+    {
+        lzma_ret r = lzma_easy_encoder(&xz, /*preset=*/6, LZMA_CHECK_CRC64);
+        if (r != LZMA_OK)
+            error("failed to initialize xz compressor; xz error %d", (int)r);
+        W.xz = &xz;
+    }
+#endif
+
+    for (size_t i = 0; i < len2; )
+    {
+        bool copy = false;
+        size_t j = i;
+        while (j < len2)
+        {
+            size_t n = std::min(PAGE_SIZE, len2 - j);
+            bool same = (j + n <= len1 && memcmp(bin1 + j, bin2 + j, n) == 0);
+            if (j == i)
+                copy = same;
+            else if (same != copy)
+                break;
+            j += n;
+        }
+        deltaRecord(W, (copy? DELTA_COPY: DELTA_INSERT), i, j - i);
+        if (!copy)
+            deltaWrite(W, bin2 + i, j - i);
+        i = j;
+    }
+    deltaRecord(W, DELTA_END, len2, 0);
+
+#ifdef E9_LZMA
+    if (compress)
+    {
+        deltaCompress(W, LZMA_FINISH);
+        lzma_end(&xz);
+    }
+#endif
+    if (fd != STDOUT_FILENO && close(fd) < 0)
         error("failed to close output file \"%s\": %s", filename,
             strerror(errno));
 }
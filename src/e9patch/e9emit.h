@@ -22,7 +22,12 @@
 #include <cstdint>
 #include <cstdlib>
 
-void emitBinary(const char *filename, const uint8_t *bin, size_t len);
+#include "e9mapping.h"
+
+void emitBinary(const char *filename, uint8_t *bin, size_t len,
+    const MappingSet &mappings);
+void emitDelta(const char *filename, bool compress, const uint8_t *bin1,
+    size_t len1, const uint8_t *bin2, size_t len2);
 void emitPatch(const char *filename, const char *compress, int fd1,
     const uint8_t *bin2, size_t len2);
 
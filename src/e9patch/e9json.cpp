@@ -57,37 +57,142 @@
 
 /*
  * JSON parser.
+ *
+ * The parser tokenizes directly from an input buffer.  If the input is a
+ * regular file then the buffer is a private mapping of the whole file,
+ * otherwise the buffer is filled using large read()s.  Strings are unescaped
+ * in-place, so `s' points into the buffer and remains valid until the next
+ * token is read.
  */
+#define BUFFER_SIZE         (1 << 16)
+
 struct Parser
 {
-    FILE * const stream;                // Input stream
-    size_t lineno;                      // Line number
+    const int fd;                       // Input file descriptor
+    char *buf = nullptr;                // Input buffer
+    size_t size = 0;                    // Input buffer size
+    size_t pos = 0;                     // Input buffer position
+    size_t end = 0;                     // Input buffer end
+    size_t mark = 0;                    // Start of the current token
+    bool eof = false;                   // Reached end-of-file?
+    bool pipe = false;                  // Input is a pipe?
+    bool binary = false;                // Accept binary messages?
+    size_t lineno = 1;                  // Line number
     char peek = '\0';                   // Peek'ed token
     bool b;                             // Boolean value
-    bool pipe = false;                  // Input is a pipe?
     int32_t i;                          // Integer value
-    char s[STRING_MAX];                 // String value
+    const char *s = "";                 // String value
+    std::vector<ParamValue> arrays[PARAM_MAX];
+                                        // Array parameter values
 
-    Parser(FILE *stream, size_t lineno) : stream(stream), lineno(lineno)
+    Parser(FILE *stream) : fd(fileno(stream))
     {
         struct stat buf;
-        if (fstat(fileno(stream), &buf) == 0 && S_ISFIFO(buf.st_mode))
+        if (fstat(fd, &buf) != 0)
+            return;
+        if (S_ISFIFO(buf.st_mode))
             pipe = true;
+        else if (S_ISREG(buf.st_mode) && buf.st_size > 0)
+        {
+            off_t offset = lseek(fd, 0, SEEK_CUR);
+            if (offset < 0 || offset > buf.st_size)
+                return;
+            void *ptr = mmap(nullptr, buf.st_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED)
+                return;
+            (void)madvise(ptr, buf.st_size, MADV_SEQUENTIAL);
+            this->buf  = (char *)ptr;
+            this->size = this->end = (size_t)buf.st_size;
+            this->pos  = this->mark = (size_t)offset;
+            this->eof  = true;
+            stat_num_message_bytes += this->end - this->pos;
+        }
+    }
+
+    Parser(const char *str) : fd(-1)
+    {
+        size_t len = strlen(str);
+        buf = (char *)malloc(len + 1);
+        if (buf == nullptr)
+            error("failed to allocate %zu bytes for JSON input buffer: %s",
+                len + 1, strerror(ENOMEM));
+        memcpy(buf, str, len + 1);
+        size = end = len;
+        eof  = true;
+    }
+
+    /*
+     * Refill the buffer, preserving the current token.  Returns `false' on
+     * end-of-file.
+     */
+    bool fill()
+    {
+        if (eof)
+            return false;
+        if (mark > 0)
+        {
+            memmove(buf, buf + mark, end - mark);
+            pos -= mark;
+            end -= mark;
+            mark = 0;
+        }
+        if (end >= size)
+        {
+            size = (size == 0? BUFFER_SIZE: 2 * size);
+            buf  = (char *)realloc(buf, size);
+            if (buf == nullptr)
+                error("failed to allocate %zu bytes for JSON-RPC input "
+                    "buffer: %s", size, strerror(ENOMEM));
+        }
+        while (true)
+        {
+            ssize_t r = read(fd, buf + end, size - end);
+            if (r < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                error("failed to read JSON-RPC input: %s", strerror(errno));
+            }
+            if (r == 0)
+            {
+                eof = true;
+                return false;
+            }
+            end += (size_t)r;
+            stat_num_message_bytes += (size_t)r;
+            return true;
+        }
     }
 
     char getc()
     {
-        char c = ::getc(stream);
+        if (pos >= end && !fill())
+            return EOF;
+        char c = buf[pos++];
         if (c == '\n')
             lineno++;
         return c;
     }
 
+    /*
+     * Get a raw (binary) byte, or -1 on end-of-file.  Unlike getc(), the
+     * line number is not updated.
+     */
+    int getByte()
+    {
+        if (pos >= end && !fill())
+            return -1;
+        return (int)(uint8_t)buf[pos++];
+    }
+
     void ungetc(char c)
     {
+        if (c == EOF)
+            return;
         if (c == '\n')
             lineno--;
-        ::ungetc(c, stream);
+        pos--;
     }
 };
 
@@ -152,8 +257,12 @@ static char peekToken(Parser &parser)
         return parser.peek;
 
     char c;
-    while (isspace(c = parser.getc()))
-        ;
+    do
+    {
+        parser.mark = parser.pos;
+        c = parser.getc();
+    }
+    while (isspace(c));
     switch (c)
     {
         case ':': case ',': case '{': case '}': case '[': case ']': case EOF:
@@ -178,8 +287,9 @@ static char peekToken(Parser &parser)
         case '-': case '0': case '1': case '2': case '3': case '4':
         case '5': case '6': case '7': case '8': case '9':
         {
-            unsigned len = 0;
-            parser.s[len++] = c;
+            bool neg = (c == '-');
+            int64_t x = (neg? 0: c - '0');
+            unsigned len = 1;
             while (true)
             {
                 if (len >= NUMBER_MAX)
@@ -189,17 +299,20 @@ static char peekToken(Parser &parser)
                 if (!isdigit(c))
                 {
                     parser.ungetc(c);
-                    parser.s[len++] = '\0';
                     break;
                 }
-                parser.s[len++] = c;
+                x = 10 * x + (c - '0');
+                len++;
             }
-            if (parser.s[0] == '-' && parser.s[1] == '\0')
+            if (neg)
             {
-                c = '-';
-                goto bad_token;
+                if (len == 1)
+                {
+                    c = '-';
+                    goto bad_token;
+                }
+                x = -x;
             }
-            int64_t x = (int64_t)strtoll(parser.s, nullptr, 10);
             if (x < INT32_MIN || x > INT32_MAX)
                 parse_error(parser, "failed to read JSON number, value is "
                     "out of range (%d..%d)", INT32_MIN, INT32_MAX);
@@ -208,6 +321,9 @@ static char peekToken(Parser &parser)
         }
         case '\"':
         {
+            // Note: the string is unescaped in-place, starting just after
+            //       the opening quote at `mark'.  The buffer may move during
+            //       a refill, so the output pointer is recalculated.
             unsigned len = 0;
             while (true)
             {
@@ -225,8 +341,9 @@ bad_string_eof:
                             "reached end-of-file before string terminator "
                             "(`\"')");
                     case '\"':
-                        parser.s[len++] = '\0';
-                        break;
+                        parser.buf[parser.mark + 1 + len] = '\0';
+                        parser.s = parser.buf + parser.mark + 1;
+                        return (parser.peek = TOKEN_STRING);
                     case '\\':
                         c = parser.getc();
                         switch (c)
@@ -238,33 +355,30 @@ bad_string_eof:
                                     "string, unicode escape sequences are not "
                                     "yet supported");
                             case 't':
-                                parser.s[len++] = '\t';
+                                c = '\t';
                                 break;
                             case 'n':
-                                parser.s[len++] = '\n';
+                                c = '\n';
                                 break;
                             case 'r':
-                                parser.s[len++] = '\r';
+                                c = '\r';
                                 break;
                             case 'b':
-                                parser.s[len++] = '\b';
+                                c = '\b';
                                 break;
                             case 'f':
-                                parser.s[len++] = '\f';
+                                c = '\f';
                                 break;
                             default:
-                                parser.s[len++] = c;
                                 break;
                         }
                         break;
                     default:
-                        parser.s[len++] = c;
                         break;
                 }
-                if (c == '\"')
-                    break;
+                parser.buf[parser.mark + 1 + len] = c;
+                len++;
             }
-            return (parser.peek = TOKEN_STRING);
         }
         default:
 bad_token:
@@ -488,6 +602,7 @@ static bool validateParam(Method method, ParamName paramName)
                 case PARAM_OPTION_DISABLE_T1:
                 case PARAM_OPTION_DISABLE_T2:
                 case PARAM_OPTION_DISABLE_T3:
+                case PARAM_OPTION_PROTOCOL:
                     return true;
                 default:
                     return false;
@@ -497,6 +612,28 @@ static bool validateParam(Method method, ParamName paramName)
     }
 }
 
+/*
+ * Determine if a parameter may be an array.  The "instruction" and "patch"
+ * methods accept arrays for batching, where each array element corresponds
+ * to one instruction/patch, and scalars are shared by all elements.
+ */
+static bool isArrayParam(Method method, ParamName paramName)
+{
+    switch (method)
+    {
+        case METHOD_INSTRUCTION:
+            return (paramName == PARAM_ADDRESS ||
+                    paramName == PARAM_LENGTH ||
+                    paramName == PARAM_OFFSET);
+        case METHOD_PATCH:
+            return (paramName == PARAM_METADATA ||
+                    paramName == PARAM_OFFSET ||
+                    paramName == PARAM_TRAMPOLINE);
+        default:
+            return false;
+    }
+}
+
 /*
  * Create a BYTES template entry.
  */
@@ -512,6 +649,20 @@ static Entry makeBytesEntry(std::vector<uint8_t> &bytes)
     return entry;
 }
 
+/*
+ * Template string classification.  A string that begins with `$' names a
+ * macro, and a string that begins with `.' names a label.  The same rules
+ * are used for JSON and binary templates.
+ */
+static bool isMacroName(const char *name)
+{
+    return (name[0] == '$');
+}
+static bool isLabelName(const char *name)
+{
+    return (name[0] == '.');
+}
+
 /*
  * Create a MACRO template entry.
  */
@@ -717,12 +868,31 @@ type_error:
 }
 
 /*
- * Parse a template object.
+ * Create a trampoline template from a set of entries.
  */
-static Trampoline *parseTrampoline(Parser &parser, bool int3 = false)
+static Trampoline *makeTrampoline(const std::vector<Entry> &entries)
+{
+    size_t num_entries = entries.size();
+    uint8_t *ptr =
+        new uint8_t[sizeof(Trampoline) + num_entries * sizeof(Entry)];
+    Trampoline *T  = (Trampoline *)ptr;
+    T->prot        = PROT_READ | PROT_EXEC;
+    T->preload     = false;
+    T->num_entries = num_entries;
+    if (num_entries > 0)
+        memcpy(T->entries, &entries[0], num_entries * sizeof(Entry));
+    initTrampoline(T);
+
+    return T;
+}
+
+/*
+ * Parse the entries of a template object.
+ */
+static void parseEntries(Parser &parser, std::vector<Entry> &entries,
+    bool int3 = false)
 {
     std::vector<uint8_t> bytes;
-    std::vector<Entry> entries;
 
     if (int3)
         bytes.push_back(0xCC);          // INT3 instruction
@@ -754,20 +924,16 @@ static Trampoline *parseTrampoline(Parser &parser, bool int3 = false)
             switch (token)
             {
                 case TOKEN_STRING:
-                    switch (parser.s[0])
+                    if (isMacroName(parser.s))
+                        entries.push_back(makeMacroEntry(parser.s));
+                    else if (isLabelName(parser.s))
+                        entries.push_back(makeLabelEntry(parser.s));
+                    else
                     {
-                        case '$':
-                            entries.push_back(makeMacroEntry(parser.s));
-                            break;
-                        case '.':
-                            entries.push_back(makeLabelEntry(parser.s));
-                            break;
-                        default:
-                            // String constant:
-                            for (unsigned i = 0; parser.s[i] != '\0'; i++)
-                                bytes.push_back((uint8_t)parser.s[i]);
-                            bytes.push_back((uint8_t)'\0');
-                            break;
+                        // String constant:
+                        for (unsigned i = 0; parser.s[i] != '\0'; i++)
+                            bytes.push_back((uint8_t)parser.s[i]);
+                        bytes.push_back((uint8_t)'\0');
                     }
                     break;
 
@@ -790,18 +956,17 @@ static Trampoline *parseTrampoline(Parser &parser, bool int3 = false)
     }
     if (bytes.size() > 0)
         entries.push_back(makeBytesEntry(bytes));
+}
 
-    size_t num_entries = entries.size();
-    uint8_t *ptr =
-        new uint8_t[sizeof(Trampoline) + num_entries * sizeof(Entry)];
-    Trampoline *T  = (Trampoline *)ptr;
-    T->prot        = PROT_READ | PROT_EXEC;
-    T->preload     = false;
-    T->num_entries = num_entries;
-    memcpy(T->entries, &entries[0], num_entries * sizeof(Entry));
-
-    return T;
-};
+/*
+ * Parse a template object.
+ */
+static Trampoline *parseTrampoline(Parser &parser, bool int3 = false)
+{
+    std::vector<Entry> entries;
+    parseEntries(parser, entries, int3);
+    return makeTrampoline(entries);
+}
 
 /*
  * Parse a bytes object.
@@ -825,16 +990,26 @@ static Trampoline *parseBytes(Parser &parser)
             token = getToken(parser);
     }
 
-    size_t num_entries = 1;
-    uint8_t *ptr =
-        new uint8_t[sizeof(Trampoline) + num_entries * sizeof(Entry)];
-    Trampoline *T  = (Trampoline *)ptr;
-    T->prot        = PROT_READ | PROT_EXEC;
-    T->num_entries = num_entries;
-    T->preload     = false;
-    T->entries[0]  = makeBytesEntry(bytes);
-    
-    return T;
+    std::vector<Entry> entries;
+    entries.push_back(makeBytesEntry(bytes));
+    return makeTrampoline(entries);
+}
+
+/*
+ * Create instruction metadata from a set of (sorted) entries.
+ */
+typedef std::map<const char *, Trampoline *, CStrCmp> MetadataEntries;
+static Metadata *makeMetadata(const MetadataEntries &entries)
+{
+    size_t num_entries = entries.size();
+    uint8_t *ptr = new uint8_t[sizeof(Metadata) +
+        num_entries * sizeof(Trampoline *)];
+    Metadata *meta = (Metadata *)ptr;
+    meta->num_entries = num_entries;
+    size_t i = 0;
+    for (auto pair: entries)
+        meta->entries[i++] = pair.second;
+    return meta;
 }
 
 /*
@@ -842,13 +1017,13 @@ static Trampoline *parseBytes(Parser &parser)
  */
 static Metadata *parseMetadata(Parser &parser)
 {
-    std::map<const char *, Trampoline *, CStrCmp> entries;
+    MetadataEntries entries;
 
     expectToken(parser, '{');
     char token = expectToken2(parser, '}', TOKEN_STRING);
     while (token != '}')
     {
-        if (parser.s[0] != '$')
+        if (!isMacroName(parser.s))
             parse_error(parser, "failed to parse instruction metadata; "
                 "macro name must begin with a `$', found \"%s\"", parser.s);
         auto i = entries.find(parser.s);
@@ -865,15 +1040,7 @@ static Metadata *parseMetadata(Parser &parser)
              token = getToken(parser);
     }
 
-    size_t num_entries = entries.size();
-    uint8_t *ptr = new uint8_t[sizeof(Metadata) +
-        num_entries * sizeof(Trampoline *)];
-    Metadata *meta = (Metadata *)ptr;
-    meta->num_entries = num_entries;
-    size_t i = 0;
-    for (auto pair: entries)
-        meta->entries[i++] = pair.second;
-    return meta;
+    return makeMetadata(entries);
 }
 
 /*
@@ -891,6 +1058,176 @@ static int parseProtection(const Parser &parser, unsigned i, char c, int prot)
             "expected `%c' or '-', found `%c'", str, c, str[i]);
 }
 
+/*
+ * Parse a format string, or -1 if unknown.
+ */
+static intptr_t parseFormat(const char *str)
+{
+    if (strcmp(str, "binary") == 0)
+        return (intptr_t)FORMAT_BINARY;
+    else if (strcmp(str, "delta") == 0)
+        return (intptr_t)FORMAT_DELTA;
+    else if (strcmp(str, "delta.xz") == 0)
+        return (intptr_t)FORMAT_DELTA_XZ;
+    else if (strcmp(str, "patch") == 0)
+        return (intptr_t)FORMAT_PATCH;
+    else if (strcmp(str, "patch.gz") == 0)
+        return (intptr_t)FORMAT_PATCH_GZ;
+    else if (strcmp(str, "patch.bz2") == 0)
+        return (intptr_t)FORMAT_PATCH_BZIP2;
+    else if (strcmp(str, "patch.xz") == 0)
+        return (intptr_t)FORMAT_PATCH_XZ;
+    else
+        return -1;
+}
+
+/*
+ * Parse a mode string, or -1 if unknown.
+ */
+static intptr_t parseMode(const char *str)
+{
+    if (strcmp(str, "exe") == 0)
+        return (intptr_t)MODE_EXECUTABLE;
+    else if (strcmp(str, "dso") == 0)
+        return (intptr_t)MODE_SHARED_OBJECT;
+    else
+        return -1;
+}
+
+/*
+ * Parse a protocol string, or -1 if unknown.
+ */
+static intptr_t parseProtocol(const char *str)
+{
+    if (strcmp(str, "json") == 0)
+        return (intptr_t)PROTOCOL_JSON;
+    else if (strcmp(str, "binary") == 0)
+        return (intptr_t)PROTOCOL_BINARY;
+    else
+        return -1;
+}
+
+/*
+ * Parse a (scalar) parameter value.
+ */
+static void parseParamValue(Parser &parser, ParamName name, ParamValue &value)
+{
+    char token;
+    value.string = nullptr;
+    switch (name)
+    {
+        case PARAM_ADDRESS:
+        case PARAM_OFFSET:
+        case PARAM_LENGTH:
+        case PARAM_INIT:
+        case PARAM_MMAP:
+        case PARAM_MAPPING_SIZE:
+            token = expectToken2(parser, TOKEN_NUMBER, TOKEN_STRING);
+            if (token == TOKEN_NUMBER)
+                value.integer = (intptr_t)parser.i;
+            else
+                value.integer = stringToNumber(parser);
+            break;
+        case PARAM_ABSOLUTE:
+        case PARAM_OPTION_DISABLE_B1:
+        case PARAM_OPTION_DISABLE_B2:
+        case PARAM_OPTION_DISABLE_T1:
+        case PARAM_OPTION_DISABLE_T2:
+        case PARAM_OPTION_DISABLE_T3:
+            expectToken(parser, TOKEN_BOOL);
+            value.boolean = parser.b;
+            break;
+        case PARAM_FILENAME:
+        case PARAM_NAME:
+        case PARAM_TRAMPOLINE:
+            expectToken(parser, TOKEN_STRING);
+            value.string = dupString(parser.s);
+            break;
+        case PARAM_TEMPLATE:
+            value.trampoline = parseTrampoline(parser,
+                option_trap_all);
+            break;
+        case PARAM_METADATA:
+            value.metadata = parseMetadata(parser);
+            break;
+        case PARAM_PROTECTION:
+        {
+            expectToken(parser, TOKEN_STRING);
+            int prot = PROT_NONE;
+            prot |= parseProtection(parser, 0, 'r', PROT_READ);
+            prot |= parseProtection(parser, 1, 'w', PROT_WRITE);
+            prot |= parseProtection(parser, 2, 'x', PROT_EXEC);
+            if (parser.s[3] != '\0')
+                parse_error(parser, "failed to parse protection "
+                    "string \"%s\"; string length must be 3",
+                    parser.s, parser.s[0]);
+            value.integer = (intptr_t)prot;
+            break;
+        }
+        case PARAM_BYTES:
+            value.trampoline = parseBytes(parser);
+            break;
+        case PARAM_FORMAT:
+            expectToken(parser, TOKEN_STRING);
+            value.integer = parseFormat(parser.s);
+            if (value.integer < 0)
+                parse_error(parser, "failed to parse format string "
+                    "\"%s\"; expected one of {\"binary\", \"patch\", "
+                    "\"patch.gz\", \"patch.bz2\", \"patch.xz\"}",
+                    parser.s);
+            break;
+        case PARAM_MODE:
+            expectToken(parser, TOKEN_STRING);
+            value.integer = parseMode(parser.s);
+            if (value.integer < 0)
+                parse_error(parser, "failed to parse mode string "
+                    "\"%s\"; expected one of {\"exe\", \"dso\"}",
+                    parser.s);
+            break;
+        case PARAM_OPTION_PROTOCOL:
+            expectToken(parser, TOKEN_STRING);
+            value.integer = parseProtocol(parser.s);
+            if (value.integer < 0)
+                parse_error(parser, "failed to parse protocol string "
+                    "\"%s\"; expected one of {\"json\", "
+                    "\"binary\"}", parser.s);
+            break;
+        case PARAM_UNKNOWN:
+            parseAndDiscardObject(parser);
+            break;
+    }
+}
+
+/*
+ * Parse an array parameter value.
+ */
+static void parseParamArray(Parser &parser, ParamName name,
+    std::vector<ParamValue> &array)
+{
+    array.clear();
+    expectToken(parser, '[');
+    if (peekToken(parser) == ']')
+    {
+        getToken(parser);
+        return;
+    }
+    while (true)
+    {
+        ParamValue value;
+        if (name == PARAM_METADATA && peekToken(parser) == TOKEN_NULL)
+        {
+            getToken(parser);
+            value.metadata = nullptr;
+        }
+        else
+            parseParamValue(parser, name, value);
+        array.push_back(value);
+        char token = expectToken2(parser, ',', ']');
+        if (token == ']')
+            return;
+    }
+}
+
 /*
  * Parse a parameter object.
  */
@@ -949,6 +1286,8 @@ static void parseParams(Parser &parser, Message &msg)
             case 'p':
                 if (strcmp(parser.s, "protection") == 0)
                     name = PARAM_PROTECTION;
+                else if (strcmp(parser.s, "protocol") == 0)
+                    name = PARAM_OPTION_PROTOCOL;
                 break;
             case 'm':
                 if (strcmp(parser.s, "metadata") == 0)
@@ -976,99 +1315,26 @@ static void parseParams(Parser &parser, Message &msg)
             parseAndDiscardObject(parser);
         else
         {
-            ParamValue value;
-            value.string = nullptr;
-            switch (name)
-            {
-                case PARAM_ADDRESS:
-                case PARAM_OFFSET:
-                case PARAM_LENGTH:
-                case PARAM_INIT:
-                case PARAM_MMAP:
-                case PARAM_MAPPING_SIZE:
-                    token = expectToken2(parser, TOKEN_NUMBER, TOKEN_STRING);
-                    if (token == TOKEN_NUMBER)
-                        value.integer = (intptr_t)parser.i;
-                    else
-                        value.integer = stringToNumber(parser);
-                    break;
-                case PARAM_ABSOLUTE:
-                case PARAM_OPTION_DISABLE_B1:
-                case PARAM_OPTION_DISABLE_B2:
-                case PARAM_OPTION_DISABLE_T1:
-                case PARAM_OPTION_DISABLE_T2:
-                case PARAM_OPTION_DISABLE_T3:
-                    expectToken(parser, TOKEN_BOOL);
-                    value.boolean = parser.b;
-                    break;
-                case PARAM_FILENAME:
-                case PARAM_NAME:
-                case PARAM_TRAMPOLINE:
-                    expectToken(parser, TOKEN_STRING);
-                    value.string = dupString(parser.s);
-                    break;
-                case PARAM_TEMPLATE:
-                    value.trampoline = parseTrampoline(parser,
-                        option_trap_all);
-                    break;
-                case PARAM_METADATA:
-                    value.metadata = parseMetadata(parser);
-                    break;
-                case PARAM_PROTECTION:
-                {
-                    expectToken(parser, TOKEN_STRING);
-                    int prot = PROT_NONE;
-                    prot |= parseProtection(parser, 0, 'r', PROT_READ);
-                    prot |= parseProtection(parser, 1, 'w', PROT_WRITE);
-                    prot |= parseProtection(parser, 2, 'x', PROT_EXEC);
-                    if (parser.s[3] != '\0')
-                        parse_error(parser, "failed to parse protection "
-                            "string \"%s\"; string length must be 3",
-                            parser.s, parser.s[0]);
-                    value.integer = (intptr_t)prot;
-                    break;
-                }
-                case PARAM_BYTES:
-                    value.trampoline = parseBytes(parser);
-                    break;
-                case PARAM_FORMAT:
-                    expectToken(parser, TOKEN_STRING);
-                    if (strcmp(parser.s, "binary") == 0)
-                        value.integer = (intptr_t)FORMAT_BINARY;
-                    else if (strcmp(parser.s, "patch") == 0)
-                        value.integer = (intptr_t)FORMAT_PATCH;
-                    else if (strcmp(parser.s, "patch.gz") == 0)
-                        value.integer = (intptr_t)FORMAT_PATCH_GZ;
-                    else if (strcmp(parser.s, "patch.bz2") == 0)
-                        value.integer = (intptr_t)FORMAT_PATCH_BZIP2;
-                    else if (strcmp(parser.s, "patch.xz") == 0)
-                        value.integer = (intptr_t)FORMAT_PATCH_XZ;
-                    else
-                        parse_error(parser, "failed to parse format string "
-                            "\"%s\"; expected one of {\"binary\", \"patch\", "
-                            "\"patch.gz\", \"patch.bz2\", \"patch.xz\"}",
-                            parser.s);
-                    break;
-                case PARAM_MODE:
-                    expectToken(parser, TOKEN_STRING);
-                    if (strcmp(parser.s, "exe") == 0)
-                        value.integer = (intptr_t)MODE_EXECUTABLE;
-                    else if (strcmp(parser.s, "dso") == 0)
-                        value.integer = (intptr_t)MODE_SHARED_OBJECT;
-                    else
-                        parse_error(parser, "failed to parse mode string "
-                            "\"%s\"; expected one of {\"exe\", \"dso\"}",
-                            parser.s);
-                    break;
-                case PARAM_UNKNOWN:
-                    parseAndDiscardObject(parser);
-                    break;
-            }
             if (msg.num_params >= PARAM_MAX)
                 parse_error(parser, "failed to parse JSON message; number of "
                     "parameters exceeds the maximum (%u)", PARAM_MAX);
-            msg.params[msg.num_params].name  = name;
-            msg.params[msg.num_params].value = value;
+            Param &param = msg.params[msg.num_params];
+            param.name = name;
+            if (isArrayParam(msg.method, name) && peekToken(parser) == '[')
+            {
+                std::vector<ParamValue> &array =
+                    parser.arrays[msg.num_params];
+                parseParamArray(parser, name, array);
+                param.array       = true;
+                param.length      = array.size();
+                param.value.array = array.data();
+            }
+            else
+            {
+                param.array  = false;
+                param.length = 1;
+                parseParamValue(parser, name, param.value);
+            }
             msg.num_params++;
         }
         token = expectToken2(parser, '}', ',');
@@ -1080,6 +1346,541 @@ static void parseParams(Parser &parser, Message &msg)
     }
 }
 
+/*
+ * Parse a trampoline template from a JSON string.
+ */
+Trampoline *parseTrampoline(const char *str)
+{
+    Parser parser(str);
+    Trampoline *T = parseTrampoline(parser, option_trap_all);
+    expectToken(parser, EOF);
+    free(parser.buf);
+    return T;
+}
+
+/*
+ * Parse instruction metadata from a JSON string.
+ */
+Metadata *parseMetadata(const char *str)
+{
+    Parser parser(str);
+    Metadata *meta = parseMetadata(parser);
+    expectToken(parser, EOF);
+    free(parser.buf);
+    return meta;
+}
+
+/*
+ * Binary messages.
+ *
+ * A binary message is a length-prefixed record that is decoded into the
+ * same Message representation as a JSON message:
+ *
+ *      message := MAGIC size:varint method:u8 id:varint param*
+ *      param   := name:u8 size:varint value
+ *
+ * Integers are LEB128 varints (zigzag encoded if signed).  Parameter values
+ * are type-specific, where string and bytes values are raw blobs, templates
+ * are sequences of tagged entries, and metadata is a sequence of
+ * (name, template) pairs.  See the E9Patch programming guide for details.
+ */
+#define BINARY_MAGIC        0xE9
+
+#define binary_error(decoder, msg, ...)                                 \
+    error("binary message #%zu: " msg, stat_num_messages+1,             \
+        ##__VA_ARGS__)
+
+/*
+ * Binary message decoder.
+ */
+struct Decoder
+{
+    const uint8_t *ptr;                 // Current position
+    const uint8_t *end;                 // End position
+};
+
+/*
+ * Decode a byte.
+ */
+static uint8_t decodeByte(Decoder &decoder)
+{
+    if (decoder.ptr >= decoder.end)
+        binary_error(decoder, "failed to decode byte; unexpected "
+            "end-of-record");
+    return *decoder.ptr++;
+}
+
+/*
+ * Decode an unsigned varint.
+ */
+static uint64_t decodeVarint(Decoder &decoder)
+{
+    uint64_t x = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        uint8_t b = decodeByte(decoder);
+        x |= (uint64_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0)
+            return x;
+    }
+    binary_error(decoder, "failed to decode varint; value is too long");
+}
+
+/*
+ * Decode a signed (zigzag) varint.
+ */
+static int64_t decodeSigned(Decoder &decoder)
+{
+    uint64_t x = decodeVarint(decoder);
+    return (int64_t)(x >> 1) ^ -(int64_t)(x & 0x1);
+}
+
+/*
+ * Decode a size-prefixed sub-record.
+ */
+static Decoder decodeRecord(Decoder &decoder)
+{
+    uint64_t size = decodeVarint(decoder);
+    if (size > (uint64_t)(decoder.end - decoder.ptr))
+        binary_error(decoder, "failed to decode record; size (%zu) exceeds "
+            "the enclosing record", (size_t)size);
+    Decoder record = {decoder.ptr, decoder.ptr + size};
+    decoder.ptr += size;
+    return record;
+}
+
+/*
+ * Decode a string into `buf'.
+ */
+static const char *decodeString(Decoder &decoder, char *buf)
+{
+    Decoder str = decodeRecord(decoder);
+    size_t len = str.end - str.ptr;
+    if (len >= STRING_MAX)
+        binary_error(decoder, "failed to decode string, maximum length (%u) "
+            "was exceeded", STRING_MAX);
+    memcpy(buf, str.ptr, len);
+    buf[len] = '\0';
+    return buf;
+}
+
+/*
+ * Decode a string value (the whole record).
+ */
+static const char *decodeStringValue(Decoder &decoder, char *buf)
+{
+    size_t len = decoder.end - decoder.ptr;
+    if (len >= STRING_MAX)
+        binary_error(decoder, "failed to decode string, maximum length (%u) "
+            "was exceeded", STRING_MAX);
+    memcpy(buf, decoder.ptr, len);
+    buf[len] = '\0';
+    decoder.ptr = decoder.end;
+    return buf;
+}
+
+/*
+ * Template entry tags.
+ */
+#define TAG_BYTES           0x01
+#define TAG_MACRO           0x02
+#define TAG_LABEL           0x03
+#define TAG_INT8            0x04
+#define TAG_INT16           0x05
+#define TAG_INT32           0x06
+#define TAG_INT64           0x07
+#define TAG_REL8_LABEL      0x08
+#define TAG_REL8            0x09
+#define TAG_REL32_LABEL     0x0A
+#define TAG_REL32           0x0B
+#define TAG_ZEROES          0x0C
+#define TAG_JSON            0x0D
+
+/*
+ * Convert a decoded integer.
+ */
+static uintptr_t decodeInteger(Decoder &decoder, intptr_t x, intptr_t min,
+    intptr_t max, unsigned bits)
+{
+    if (x < min || x > max)
+        binary_error(decoder, "failed to decode %u-bit integer; value %zd "
+            "is not within the range %zd..%zd", bits, x, min, max);
+    if (x < 0)
+        x += (max + 1);
+    return x;
+}
+
+/*
+ * Decode a template (the whole record).
+ */
+static Trampoline *decodeTrampoline(Decoder &decoder, bool int3 = false)
+{
+    std::vector<Entry> entries;
+    char buf[STRING_MAX];
+
+    if (int3)
+    {
+        std::vector<uint8_t> bytes;
+        bytes.push_back(0xCC);          // INT3 instruction
+        entries.push_back(makeBytesEntry(bytes));
+    }
+    while (decoder.ptr < decoder.end)
+    {
+        uint8_t tag = decodeByte(decoder);
+        Entry entry;
+        entry.kind   = ENTRY_BYTES;
+        entry.length = 0;
+        entry.bytes  = nullptr;
+        switch (tag)
+        {
+            case TAG_BYTES:
+            {
+                Decoder bytes = decodeRecord(decoder);
+                size_t size = bytes.end - bytes.ptr;
+                uint8_t *bs = new uint8_t[size];
+                memcpy(bs, bytes.ptr, size);
+                entry.length = (unsigned)size;
+                entry.bytes  = bs;
+                break;
+            }
+            case TAG_MACRO:
+                decodeString(decoder, buf);
+                if (!isMacroName(buf))
+                    binary_error(decoder, "failed to decode macro; name "
+                        "must begin with a `$', found \"%s\"", buf);
+                entry = makeMacroEntry(buf);
+                break;
+            case TAG_LABEL:
+                decodeString(decoder, buf);
+                if (!isLabelName(buf))
+                    binary_error(decoder, "failed to decode label; name "
+                        "must begin with a `.', found \"%s\"", buf);
+                entry = makeLabelEntry(buf);
+                break;
+            case TAG_INT8:
+                entry.kind  = ENTRY_INT8;
+                entry.uint8 = (uint8_t)decodeInteger(decoder,
+                    decodeSigned(decoder), INT8_MIN, UINT8_MAX, 8);
+                break;
+            case TAG_INT16:
+                entry.kind   = ENTRY_INT16;
+                entry.uint16 = (uint16_t)decodeInteger(decoder,
+                    decodeSigned(decoder), INT16_MIN, UINT16_MAX, 16);
+                break;
+            case TAG_INT32:
+                entry.kind   = ENTRY_INT32;
+                entry.uint32 = (uint32_t)decodeInteger(decoder,
+                    decodeSigned(decoder), INT32_MIN, UINT32_MAX, 32);
+                break;
+            case TAG_INT64:
+                entry.kind   = ENTRY_INT64;
+                entry.uint64 = (uint64_t)decodeSigned(decoder);
+                break;
+            case TAG_REL8_LABEL: case TAG_REL32_LABEL:
+                entry.kind      = (tag == TAG_REL8_LABEL? ENTRY_REL8:
+                    ENTRY_REL32);
+                entry.use_label = true;
+                entry.label     = dupString(decodeString(decoder, buf));
+                break;
+            case TAG_REL8: case TAG_REL32:
+                entry.kind      = (tag == TAG_REL8? ENTRY_REL8: ENTRY_REL32);
+                entry.use_label = false;
+                entry.uint64    = (uint64_t)decodeSigned(decoder);
+                break;
+            case TAG_ZEROES:
+                entry.kind   = ENTRY_ZEROES;
+                entry.length = (unsigned)decodeVarint(decoder);
+                break;
+            case TAG_JSON:
+            {
+                // Entries in JSON form, parsed by the JSON template parser:
+                Decoder json = decodeRecord(decoder);
+                std::string str("[");
+                str.append((const char *)json.ptr, json.end - json.ptr);
+                str += ']';
+                Parser parser(str.c_str());
+                parseEntries(parser, entries);
+                expectToken(parser, EOF);
+                free(parser.buf);
+                continue;
+            }
+            default:
+                binary_error(decoder, "failed to decode template entry; "
+                    "unknown tag (0x%.2X)", tag);
+        }
+        entries.push_back(entry);
+    }
+    return makeTrampoline(entries);
+}
+
+/*
+ * Decode instruction metadata (the whole record).
+ */
+static Metadata *decodeMetadata(Decoder &decoder)
+{
+    MetadataEntries entries;
+    char buf[STRING_MAX];
+
+    while (decoder.ptr < decoder.end)
+    {
+        decodeString(decoder, buf);
+        if (!isMacroName(buf))
+            binary_error(decoder, "failed to decode instruction metadata; "
+                "macro name must begin with a `$', found \"%s\"", buf);
+        auto i = entries.find(buf);
+        if (i != entries.end())
+            binary_error(decoder, "failed to decode instruction metadata; "
+                "duplicate entry for \"%s\"", buf);
+        const char *name = dupString(buf);
+        Decoder code = decodeRecord(decoder);
+        Trampoline *T = decodeTrampoline(code);
+        T->name       = name;
+        entries.insert(std::make_pair(name, T));
+    }
+    return makeMetadata(entries);
+}
+
+/*
+ * Decode a parameter name.
+ */
+static ParamName decodeParamName(uint8_t name)
+{
+    switch (name)
+    {
+        case 0x01: return PARAM_ABSOLUTE;
+        case 0x02: return PARAM_ADDRESS;
+        case 0x03: return PARAM_BYTES;
+        case 0x04: return PARAM_FILENAME;
+        case 0x05: return PARAM_FORMAT;
+        case 0x06: return PARAM_INIT;
+        case 0x07: return PARAM_LENGTH;
+        case 0x08: return PARAM_MAPPING_SIZE;
+        case 0x09: return PARAM_METADATA;
+        case 0x0A: return PARAM_MMAP;
+        case 0x0B: return PARAM_MODE;
+        case 0x0C: return PARAM_NAME;
+        case 0x0D: return PARAM_OFFSET;
+        case 0x0E: return PARAM_PROTECTION;
+        case 0x0F: return PARAM_TEMPLATE;
+        case 0x10: return PARAM_TRAMPOLINE;
+        case 0x20: return PARAM_OPTION_DISABLE_B1;
+        case 0x21: return PARAM_OPTION_DISABLE_B2;
+        case 0x22: return PARAM_OPTION_DISABLE_T1;
+        case 0x23: return PARAM_OPTION_DISABLE_T2;
+        case 0x24: return PARAM_OPTION_DISABLE_T3;
+        case 0x25: return PARAM_OPTION_PROTOCOL;
+        default:   return PARAM_UNKNOWN;
+    }
+}
+
+/*
+ * Decode a method.
+ */
+static Method decodeMethod(uint8_t method)
+{
+    switch (method)
+    {
+        case 0x01: return METHOD_BINARY;
+        case 0x02: return METHOD_EMIT;
+        case 0x03: return METHOD_INSTRUCTION;
+        case 0x04: return METHOD_OPTION;
+        case 0x05: return METHOD_PATCH;
+        case 0x06: return METHOD_RESERVE;
+        case 0x07: return METHOD_TRAMPOLINE;
+        default:   return METHOD_UNKNOWN;
+    }
+}
+
+/*
+ * Decode a (scalar) parameter value.
+ */
+static void decodeParamValue(Decoder &record, ParamName name,
+    ParamValue &value)
+{
+    char buf[STRING_MAX];
+    value.string = nullptr;
+    switch (name)
+    {
+        case PARAM_ADDRESS:
+        case PARAM_OFFSET:
+        case PARAM_LENGTH:
+        case PARAM_INIT:
+        case PARAM_MMAP:
+        case PARAM_MAPPING_SIZE:
+            value.integer = decodeSigned(record);
+            break;
+        case PARAM_ABSOLUTE:
+        case PARAM_OPTION_DISABLE_B1:
+        case PARAM_OPTION_DISABLE_B2:
+        case PARAM_OPTION_DISABLE_T1:
+        case PARAM_OPTION_DISABLE_T2:
+        case PARAM_OPTION_DISABLE_T3:
+            value.boolean = (decodeByte(record) != 0);
+            break;
+        case PARAM_FILENAME:
+        case PARAM_NAME:
+        case PARAM_TRAMPOLINE:
+            value.string = dupString(decodeStringValue(record, buf));
+            break;
+        case PARAM_TEMPLATE:
+            value.trampoline = decodeTrampoline(record, option_trap_all);
+            break;
+        case PARAM_METADATA:
+            value.metadata = decodeMetadata(record);
+            break;
+        case PARAM_PROTECTION:
+        {
+            uint8_t prot = decodeByte(record);
+            if ((prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0)
+                binary_error(record, "failed to decode protection "
+                    "(0x%.2X); unknown protection bits", prot);
+            value.integer = (intptr_t)prot;
+            break;
+        }
+        case PARAM_BYTES:
+        {
+            std::vector<uint8_t> bytes(record.ptr, record.end);
+            std::vector<Entry> entries;
+            entries.push_back(makeBytesEntry(bytes));
+            value.trampoline = makeTrampoline(entries);
+            record.ptr = record.end;
+            break;
+        }
+        case PARAM_FORMAT:
+            value.integer = parseFormat(decodeStringValue(record, buf));
+            if (value.integer < 0)
+                binary_error(record, "failed to decode format string "
+                    "\"%s\"", buf);
+            break;
+        case PARAM_MODE:
+            value.integer = parseMode(decodeStringValue(record, buf));
+            if (value.integer < 0)
+                binary_error(record, "failed to decode mode string "
+                    "\"%s\"", buf);
+            break;
+        case PARAM_OPTION_PROTOCOL:
+            value.integer = parseProtocol(decodeStringValue(record, buf));
+            if (value.integer < 0)
+                binary_error(record, "failed to decode protocol string "
+                    "\"%s\"", buf);
+            break;
+        case PARAM_UNKNOWN:
+            record.ptr = record.end;
+            break;
+    }
+    if (record.ptr != record.end)
+        binary_error(record, "failed to decode parameter value; found "
+            "%zu trailing byte(s)", (size_t)(record.end - record.ptr));
+}
+
+/*
+ * Decode the parameters of a binary message.  If the ARRAY bit is set in the
+ * parameter name, then the value is an array of the form:
+ *
+ *      array := count:varint (size:varint value)*
+ */
+#define BINARY_PARAM_ARRAY  0x80
+static void decodeParams(Parser &parser, Decoder &decoder, Message &msg)
+{
+    msg.num_params = 0;
+    while (decoder.ptr < decoder.end)
+    {
+        uint8_t code = decodeByte(decoder);
+        ParamName name = decodeParamName(code & ~BINARY_PARAM_ARRAY);
+        Decoder record = decodeRecord(decoder);
+        if (!validateParam(msg.method, name))
+            continue;
+        if (msg.num_params >= PARAM_MAX)
+            binary_error(decoder, "failed to decode message; number of "
+                "parameters exceeds the maximum (%u)", PARAM_MAX);
+        Param &param = msg.params[msg.num_params];
+        param.name = name;
+        if ((code & BINARY_PARAM_ARRAY) != 0)
+        {
+            if (!isArrayParam(msg.method, name))
+                binary_error(decoder, "failed to decode parameter; "
+                    "parameter cannot be an array");
+            std::vector<ParamValue> &array = parser.arrays[msg.num_params];
+            array.clear();
+            uint64_t count = decodeVarint(record);
+            if (count > (uint64_t)(record.end - record.ptr))
+                binary_error(decoder, "failed to decode array; array length "
+                    "(%zu) exceeds the record size", (size_t)count);
+            array.resize(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                Decoder elem = decodeRecord(record);
+                if (name == PARAM_METADATA && elem.ptr == elem.end)
+                    array[i].metadata = nullptr;
+                else
+                    decodeParamValue(elem, name, array[i]);
+            }
+            if (record.ptr != record.end)
+                binary_error(decoder, "failed to decode array; found "
+                    "%zu trailing byte(s)",
+                    (size_t)(record.end - record.ptr));
+            param.array       = true;
+            param.length      = array.size();
+            param.value.array = array.data();
+        }
+        else
+        {
+            param.array  = false;
+            param.length = 1;
+            decodeParamValue(record, name, param.value);
+        }
+        msg.num_params++;
+    }
+}
+
+/*
+ * Parse a binary message.  The leading magic byte has already been read.
+ */
+static void getBinaryMessage(Parser &parser, Message &msg)
+{
+    if (!parser.binary)
+        parse_error(parser, "failed to parse message; got a binary message "
+            "before the binary protocol was selected");
+
+    uint64_t size = 0;
+    for (unsigned shift = 0; ; shift += 7)
+    {
+        int b = parser.getByte();
+        if (b < 0)
+        {
+            if (parser.pipe)
+                exit(EXIT_FAILURE);
+            binary_error(parser, "failed to read message size; reached "
+                "end-of-file");
+        }
+        if (shift >= 64)
+            binary_error(parser, "failed to read message size; value is "
+                "too long");
+        size |= (uint64_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0)
+            break;
+    }
+    parser.mark = parser.pos;
+    while (parser.end - parser.pos < size)
+    {
+        if (!parser.fill())
+        {
+            if (parser.pipe)
+                exit(EXIT_FAILURE);
+            binary_error(parser, "failed to read message; reached "
+                "end-of-file before end-of-message");
+        }
+    }
+    const uint8_t *ptr = (const uint8_t *)parser.buf + parser.pos;
+    parser.pos += size;
+
+    Decoder decoder = {ptr, ptr + size};
+    msg.method = decodeMethod(decodeByte(decoder));
+    msg.id     = (unsigned)decodeVarint(decoder);
+    msg.lineno = parser.lineno;
+    decodeParams(parser, decoder, msg);
+}
+
 /*
  * Convert a method into a string for error reporting.
  */
@@ -1097,18 +1898,20 @@ const char *getMethodString(Method method)
             return "trampoline";
         case METHOD_EMIT:
             return "emit";
+        case METHOD_RESERVE:
+            return "reserve";
+        case METHOD_OPTION:
+            return "option";
         default:
             return "???";
     }
 }
 
 /*
- * Parse a message from the given stream.
+ * Parse a JSON message.
  */
-bool getMessage(FILE *stream, size_t lineno, Message &msg)
+static bool getJSONMessage(Parser &parser, Message &msg)
 {
-    Parser parser(stream, lineno);
-
     char token = expectToken2(parser, '{', EOF);
     if (token == EOF)
         return false;
@@ -1165,3 +1968,46 @@ bool getMessage(FILE *stream, size_t lineno, Message &msg)
     return true;
 }
 
+/*
+ * Create a parser for the given stream.
+ */
+Parser *makeParser(FILE *stream)
+{
+    return new Parser(stream);
+}
+
+/*
+ * Parse a message from the given parser.
+ */
+bool getMessage(Parser &parser, Message &msg)
+{
+    char c;
+    do
+    {
+        parser.mark = parser.pos;
+        c = parser.getc();
+    }
+    while (isspace(c));
+    if (c == (char)BINARY_MAGIC)
+        getBinaryMessage(parser, msg);
+    else
+    {
+        parser.ungetc(c);
+        if (!getJSONMessage(parser, msg))
+            return false;
+    }
+    stat_num_messages++;
+
+    // The "protocol" option selects the encoding of subsequent messages:
+    if (msg.method == METHOD_OPTION)
+    {
+        for (unsigned i = 0; i < msg.num_params; i++)
+        {
+            if (msg.params[i].name == PARAM_OPTION_PROTOCOL)
+                parser.binary =
+                    (msg.params[i].value.integer == PROTOCOL_BINARY);
+        }
+    }
+    return true;
+}
+
@@ -68,6 +68,7 @@ enum ParamName
     PARAM_OPTION_DISABLE_T1,
     PARAM_OPTION_DISABLE_T2,
     PARAM_OPTION_DISABLE_T3,
+    PARAM_OPTION_PROTOCOL,
 };
 
 /*
@@ -79,7 +80,18 @@ enum Format
     FORMAT_PATCH,
     FORMAT_PATCH_GZ,
     FORMAT_PATCH_BZIP2,
-    FORMAT_PATCH_XZ
+    FORMAT_PATCH_XZ,
+    FORMAT_DELTA,
+    FORMAT_DELTA_XZ
+};
+
+/*
+ * Supported message protocols.
+ */
+enum Protocol
+{
+    PROTOCOL_JSON,
+    PROTOCOL_BINARY
 };
 
 /*
@@ -92,6 +104,7 @@ union ParamValue
     const char *string;                 // String
     Trampoline *trampoline;             // Trampoline template
     Metadata *metadata;                 // Instruction metadata
+    union ParamValue *array;            // Array of values
 };
 
 /*
@@ -100,9 +113,19 @@ union ParamValue
 struct Param
 {
     ParamName name;                     // Parameter name
+    bool array;                         // Parameter is an array?
+    size_t length;                      // Array length
     ParamValue value;                   // Parameter value
 };
 
+/*
+ * Get the i-th value of a (possibly array) parameter.
+ */
+static inline const ParamValue &getParamValue(const Param &param, size_t i)
+{
+    return (param.array? param.value.array[i]: param.value);
+}
+
 /*
  * Messages.
  */
@@ -116,7 +139,12 @@ struct Message
     Param params[PARAM_MAX];            // Message params
 };
 
-bool getMessage(FILE *stream, size_t lineno, Message &msg);
+struct Parser;
+
+Parser *makeParser(FILE *stream);
+bool getMessage(Parser &parser, Message &msg);
 const char *getMethodString(Method method);
+Trampoline *parseTrampoline(const char *str);
+Metadata *parseMetadata(const char *str);
 
 #endif
@@ -0,0 +1,208 @@
+unsigned char e9loader_bin[] = {
+  0xeb, 0x09, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x41,
+  0x57, 0x41, 0x56, 0x41, 0x55, 0x41, 0x54, 0x41, 0x53, 0x41, 0x52, 0x41,
+  0x51, 0x41, 0x50, 0x51, 0x52, 0x56, 0x57, 0x48, 0x8d, 0x7c, 0x24, 0x60,
+  0xe8, 0x4a, 0x06, 0x00, 0x00, 0x41, 0x89, 0xc0, 0x4c, 0x8d, 0x25, 0xcd,
+  0xff, 0xff, 0xff, 0x48, 0xba, 0x00, 0xc0, 0xed, 0x0f, 0x02, 0x00, 0x00,
+  0x00, 0x49, 0x29, 0xd4, 0x41, 0xbd, 0x09, 0x00, 0x00, 0x00, 0x4c, 0x8d,
+  0x35, 0xf0, 0x00, 0x00, 0x00, 0xe9, 0x44, 0x09, 0x00, 0x00, 0x2f, 0x70,
+  0x72, 0x6f, 0x63, 0x2f, 0x73, 0x65, 0x6c, 0x66, 0x2f, 0x65, 0x78, 0x65,
+  0x00, 0x2f, 0x70, 0x72, 0x6f, 0x63, 0x2f, 0x73, 0x65, 0x6c, 0x66, 0x2f,
+  0x6d, 0x61, 0x70, 0x5f, 0x66, 0x69, 0x6c, 0x65, 0x73, 0x2f, 0x00, 0x66,
+  0x69, 0x6e, 0x64, 0x20, 0x73, 0x68, 0x61, 0x72, 0x65, 0x64, 0x20, 0x6f,
+  0x62, 0x6a, 0x65, 0x63, 0x74, 0x20, 0x70, 0x61, 0x74, 0x68, 0x20, 0x28,
+  0x65, 0x72, 0x72, 0x6e, 0x6f, 0x3d, 0x25, 0x64, 0x29, 0x0a, 0x00, 0x6f,
+  0x70, 0x65, 0x6e, 0x20, 0x66, 0x69, 0x6c, 0x65, 0x20, 0x22, 0x25, 0x73,
+  0x22, 0x20, 0x66, 0x6f, 0x72, 0x20, 0x72, 0x65, 0x61, 0x64, 0x69, 0x6e,
+  0x67, 0x20, 0x28, 0x65, 0x72, 0x72, 0x6e, 0x6f, 0x3d, 0x25, 0x64, 0x29,
+  0x0a, 0x00, 0x6d, 0x61, 0x70, 0x20, 0x66, 0x69, 0x6c, 0x65, 0x20, 0x22,
+  0x25, 0x73, 0x22, 0x20, 0x28, 0x65, 0x72, 0x72, 0x6e, 0x6f, 0x3d, 0x25,
+  0x64, 0x29, 0x0a, 0x00, 0x69, 0x6e, 0x73, 0x74, 0x61, 0x6c, 0x6c, 0x20,
+  0x53, 0x49, 0x47, 0x53, 0x45, 0x47, 0x56, 0x20, 0x68, 0x61, 0x6e, 0x64,
+  0x6c, 0x65, 0x72, 0x20, 0x28, 0x65, 0x72, 0x72, 0x6e, 0x6f, 0x3d, 0x25,
+  0x64, 0x29, 0x0a, 0x00, 0x6c, 0x6f, 0x61, 0x64, 0x20, 0x68, 0x75, 0x67,
+  0x65, 0x20, 0x70, 0x61, 0x67, 0x65, 0x20, 0x72, 0x65, 0x67, 0x69, 0x6f,
+  0x6e, 0x20, 0x28, 0x65, 0x72, 0x72, 0x6e, 0x6f, 0x3d, 0x25, 0x64, 0x29,
+  0x0a, 0x00, 0x65, 0x39, 0x6c, 0x6f, 0x61, 0x64, 0x65, 0x72, 0x20, 0x65,
+  0x72, 0x72, 0x6f, 0x72, 0x3a, 0x20, 0x66, 0x61, 0x69, 0x6c, 0x65, 0x64,
+  0x20, 0x74, 0x6f, 0x20, 0x00, 0x48, 0x8d, 0x3d, 0x7e, 0xff, 0xff, 0xff,
+  0x48, 0x89, 0xc6, 0x48, 0xf7, 0xde, 0xe9, 0x17, 0x02, 0x00, 0x00, 0xb8,
+  0x0f, 0x00, 0x00, 0x00, 0x0f, 0x05, 0x48, 0x8b, 0x0f, 0x31, 0xc0, 0x8a,
+  0x11, 0x48, 0xff, 0xc1, 0x8d, 0x72, 0xd0, 0x40, 0x80, 0xfe, 0x09, 0x77,
+  0x0d, 0x48, 0xc1, 0xe0, 0x04, 0x48, 0x0f, 0xbe, 0xf6, 0x48, 0x09, 0xf0,
+  0xeb, 0xe5, 0x8d, 0x72, 0x9f, 0x40, 0x80, 0xfe, 0x05, 0x77, 0x10, 0x83,
+  0xea, 0x57, 0x48, 0xc1, 0xe0, 0x04, 0x48, 0x0f, 0xbe, 0xd2, 0x48, 0x09,
+  0xd0, 0xeb, 0xcc, 0x48, 0x89, 0x0f, 0xc3, 0x41, 0x56, 0x49, 0x89, 0xf8,
+  0xbe, 0x00, 0x00, 0x01, 0x00, 0x31, 0xd2, 0x41, 0x55, 0x41, 0x54, 0x55,
+  0x53, 0x48, 0x8d, 0x1d, 0xb5, 0xfe, 0xff, 0xff, 0x48, 0x89, 0xdf, 0x48,
+  0x81, 0xec, 0x10, 0x20, 0x00, 0x00, 0xb8, 0x02, 0x00, 0x00, 0x00, 0x0f,
+  0x05, 0x85, 0xc0, 0x0f, 0x88, 0xfd, 0x00, 0x00, 0x00, 0x4c, 0x8d, 0x15,
+  0xc7, 0xff, 0xff, 0xff, 0x48, 0x63, 0xe8, 0x48, 0x89, 0xef, 0x48, 0x8d,
+  0x74, 0x24, 0x10, 0xba, 0x00, 0x20, 0x00, 0x00, 0xb8, 0xd9, 0x00, 0x00,
+  0x00, 0x0f, 0x05, 0x48, 0x89, 0xc2, 0x41, 0x89, 0xc4, 0x85, 0xc0, 0x79,
+  0x0e, 0xb8, 0x03, 0x00, 0x00, 0x00, 0x0f, 0x05, 0x89, 0xd0, 0xe9, 0xc7,
+  0x00, 0x00, 0x00, 0x45, 0x31, 0xdb, 0x31, 0xc0, 0x4c, 0x8d, 0x6c, 0x24,
+  0x10, 0x41, 0x89, 0xc1, 0x41, 0x83, 0xf1, 0x01, 0x45, 0x39, 0xe3, 0x0f,
+  0x9c, 0xc2, 0x41, 0x20, 0xd1, 0x74, 0x79, 0x4d, 0x63, 0xf3, 0x4d, 0x01,
+  0xee, 0x41, 0x0f, 0xb7, 0x46, 0x10, 0x41, 0x01, 0xc3, 0x41, 0x80, 0x7e,
+  0x12, 0x0a, 0x75, 0x5d, 0x49, 0x8d, 0x46, 0x13, 0x48, 0x8d, 0x7c, 0x24,
+  0x08, 0x48, 0x89, 0x44, 0x24, 0x08, 0xe8, 0x17, 0xff, 0xff, 0xff, 0x49,
+  0x39, 0xc2, 0x7c, 0x45, 0xe8, 0x0d, 0xff, 0xff, 0xff, 0x49, 0x39, 0xc2,
+  0x7e, 0x05, 0x45, 0x31, 0xc9, 0xeb, 0x2e, 0x31, 0xc0, 0x8a, 0x14, 0x03,
+  0x84, 0xd2, 0x74, 0x09, 0x41, 0x88, 0x14, 0x00, 0x48, 0xff, 0xc0, 0xeb,
+  0xf0, 0x48, 0x98, 0x49, 0x29, 0xc6, 0x41, 0x8a, 0x54, 0x06, 0x13, 0x84,
+  0xd2, 0x74, 0x09, 0x41, 0x88, 0x14, 0x00, 0x48, 0xff, 0xc0, 0xeb, 0xee,
+  0x41, 0xc6, 0x04, 0x00, 0x00, 0x44, 0x89, 0xc8, 0xe9, 0x7c, 0xff, 0xff,
+  0xff, 0x31, 0xc0, 0xe9, 0x75, 0xff, 0xff, 0xff, 0x84, 0xc0, 0x0f, 0x84,
+  0x37, 0xff, 0xff, 0xff, 0x48, 0x89, 0xef, 0xb8, 0x03, 0x00, 0x00, 0x00,
+  0x0f, 0x05, 0xba, 0x00, 0x20, 0x00, 0x00, 0x4c, 0x89, 0xc7, 0x4c, 0x89,
+  0xc6, 0xb8, 0x59, 0x00, 0x00, 0x00, 0x0f, 0x05, 0x85, 0xc0, 0x78, 0x0a,
+  0x48, 0x63, 0xd0, 0x31, 0xc0, 0x41, 0xc6, 0x04, 0x10, 0x00, 0x48, 0x81,
+  0xc4, 0x10, 0x20, 0x00, 0x00, 0x5b, 0x5d, 0x41, 0x5c, 0x41, 0x5d, 0x41,
+  0x5e, 0xc3, 0x83, 0xc8, 0xff, 0x80, 0x3d, 0x26, 0xfd, 0xff, 0xff, 0x00,
+  0x0f, 0x84, 0x83, 0x00, 0x00, 0x00, 0x48, 0x8b, 0x07, 0x48, 0x8d, 0x44,
+  0xc7, 0x10, 0x48, 0x8b, 0x08, 0x48, 0x83, 0xc0, 0x08, 0x48, 0x85, 0xc9,
+  0x75, 0xf4, 0x31, 0xf6, 0x45, 0x31, 0xc0, 0x48, 0x8b, 0x10, 0x48, 0x85,
+  0xd2, 0x74, 0x28, 0x48, 0x83, 0xfa, 0x09, 0x74, 0x12, 0x48, 0x83, 0xfa,
+  0x1f, 0x74, 0x12, 0x48, 0x83, 0xfa, 0x07, 0x75, 0x10, 0x48, 0x8b, 0x70,
+  0x08, 0xeb, 0x0a, 0x48, 0x8b, 0x48, 0x08, 0xeb, 0x04, 0x4c, 0x8b, 0x40,
+  0x08, 0x48, 0x83, 0xc0, 0x10, 0xeb, 0xd0, 0x48, 0x8d, 0x05, 0xce, 0xfc,
+  0xff, 0xff, 0x48, 0x39, 0xc1, 0x75, 0x2b, 0x48, 0x85, 0xf6, 0x74, 0x26,
+  0x48, 0x8d, 0x3d, 0x0f, 0xfd, 0xff, 0xff, 0x31, 0xf6, 0xb8, 0x02, 0x00,
+  0x00, 0x00, 0x0f, 0x05, 0x85, 0xc0, 0x79, 0x15, 0x4d, 0x85, 0xc0, 0x74,
+  0x10, 0x4c, 0x89, 0xc7, 0x31, 0xd2, 0xb8, 0x02, 0x00, 0x00, 0x00, 0x0f,
+  0x05, 0xc3, 0x83, 0xc8, 0xff, 0xc3, 0x41, 0x55, 0x41, 0x54, 0x55, 0x89,
+  0xf5, 0x53, 0x48, 0x89, 0xfb, 0x48, 0x81, 0xec, 0x00, 0x40, 0x00, 0x00,
+  0x49, 0x89, 0xe4, 0x4c, 0x89, 0xe7, 0xe8, 0x10, 0xfe, 0xff, 0xff, 0x85,
+  0xc0, 0x74, 0x07, 0xc7, 0x04, 0x24, 0x3f, 0x3f, 0x3f, 0x00, 0x48, 0x8d,
+  0x8c, 0x24, 0x00, 0x20, 0x00, 0x00, 0x48, 0x8d, 0x05, 0x85, 0xfd, 0xff,
+  0xff, 0x49, 0x89, 0xcb, 0x8a, 0x10, 0x84, 0xd2, 0x74, 0x0b, 0x48, 0xff,
+  0xc1, 0x48, 0xff, 0xc0, 0x88, 0x51, 0xff, 0xeb, 0xef, 0x4c, 0x89, 0xe6,
+  0x8a, 0x03, 0x84, 0xc0, 0x0f, 0x84, 0x84, 0x00, 0x00, 0x00, 0x8a, 0x53,
+  0x01, 0x3c, 0x25, 0x75, 0x70, 0x48, 0x83, 0xc3, 0x02, 0x80, 0xfa, 0x64,
+  0x74, 0x07, 0x80, 0xfa, 0x73, 0x74, 0x51, 0xeb, 0xdf, 0x41, 0x89, 0xe8,
+  0x41, 0xba, 0x0a, 0x00, 0x00, 0x00, 0x45, 0x31, 0xc9, 0xbf, 0x00, 0xca,
+  0x9a, 0x3b, 0x41, 0xbc, 0x0a, 0x00, 0x00, 0x00, 0x44, 0x89, 0xc0, 0x99,
+  0xf7, 0xff, 0x44, 0x8d, 0x68, 0x30, 0x89, 0xf8, 0x41, 0x89, 0xd0, 0x99,
+  0x41, 0xf7, 0xfc, 0x89, 0xc7, 0x45, 0x84, 0xc9, 0x75, 0x06, 0x41, 0x80,
+  0xfd, 0x30, 0x74, 0x09, 0x44, 0x88, 0x29, 0x41, 0xb1, 0x01, 0x48, 0xff,
+  0xc1, 0x41, 0xff, 0xca, 0x75, 0xd2, 0x45, 0x84, 0xc9, 0x75, 0x95, 0xc6,
+  0x01, 0x30, 0xeb, 0x16, 0x8a, 0x06, 0x84, 0xc0, 0x74, 0x8a, 0x48, 0xff,
+  0xc1, 0x48, 0xff, 0xc6, 0x88, 0x41, 0xff, 0xeb, 0xef, 0x88, 0x01, 0x48,
+  0xff, 0xc3, 0x48, 0xff, 0xc1, 0xe9, 0x72, 0xff, 0xff, 0xff, 0x48, 0x89,
+  0xca, 0xbf, 0x02, 0x00, 0x00, 0x00, 0x4c, 0x89, 0xde, 0x4c, 0x29, 0xda,
+  0xb8, 0x01, 0x00, 0x00, 0x00, 0x0f, 0x05, 0x31, 0xff, 0xbe, 0x06, 0x00,
+  0x00, 0x00, 0xb8, 0x3e, 0x00, 0x00, 0x00, 0x0f, 0x05, 0x0f, 0x0b, 0x55,
+  0x53, 0x48, 0x89, 0xfb, 0x48, 0x81, 0xec, 0x90, 0x20, 0x00, 0x00, 0x48,
+  0x63, 0x3f, 0x85, 0xff, 0x78, 0x28, 0x48, 0x89, 0xe6, 0xb8, 0x05, 0x00,
+  0x00, 0x00, 0x0f, 0x05, 0x85, 0xc0, 0x75, 0x1a, 0x48, 0x8b, 0x43, 0x08,
+  0x48, 0x39, 0x04, 0x24, 0x75, 0x10, 0x48, 0x8b, 0x43, 0x10, 0x48, 0x39,
+  0x44, 0x24, 0x08, 0x75, 0x05, 0x44, 0x8b, 0x03, 0xeb, 0x70, 0x48, 0x8d,
+  0xac, 0x24, 0x90, 0x00, 0x00, 0x00, 0x48, 0x89, 0xef, 0xe8, 0xe1, 0xfc,
+  0xff, 0xff, 0x85, 0xc0, 0x74, 0x0d, 0xf7, 0xd8, 0x48, 0x8d, 0x3d, 0xb8,
+  0xfb, 0xff, 0xff, 0x89, 0xc6, 0xeb, 0x26, 0x48, 0x89, 0xef, 0xbe, 0x00,
+  0x00, 0x08, 0x00, 0x31, 0xd2, 0xb8, 0x02, 0x00, 0x00, 0x00, 0x0f, 0x05,
+  0x48, 0x89, 0xc2, 0x41, 0x89, 0xc0, 0x85, 0xc0, 0x79, 0x10, 0x89, 0xc6,
+  0x48, 0x8d, 0x3d, 0xb4, 0xfb, 0xff, 0xff, 0xf7, 0xde, 0xe8, 0x78, 0xfe,
+  0xff, 0xff, 0x48, 0x63, 0xf8, 0x48, 0x89, 0xe6, 0xb8, 0x05, 0x00, 0x00,
+  0x00, 0x0f, 0x05, 0x85, 0xc0, 0x75, 0x11, 0x48, 0x8b, 0x04, 0x24, 0x48,
+  0x89, 0x43, 0x08, 0x48, 0x8b, 0x44, 0x24, 0x08, 0x48, 0x89, 0x43, 0x10,
+  0x89, 0x13, 0x48, 0x81, 0xc4, 0x90, 0x20, 0x00, 0x00, 0x44, 0x89, 0xc0,
+  0x5b, 0x5d, 0xc3, 0x41, 0x57, 0x49, 0x89, 0xd2, 0x41, 0x56, 0x41, 0x55,
+  0x45, 0x31, 0xed, 0x41, 0x54, 0x49, 0xbc, 0x00, 0x40, 0x12, 0xf0, 0xfd,
+  0xff, 0xff, 0xff, 0x55, 0x53, 0x41, 0x50, 0x8b, 0x15, 0xc2, 0xfa, 0xff,
+  0xff, 0x41, 0x89, 0xf8, 0x4c, 0x8b, 0x4e, 0x10, 0x48, 0x8d, 0x3d, 0xb1,
+  0xfa, 0xff, 0xff, 0x48, 0x01, 0xfa, 0x49, 0x01, 0xfc, 0x4d, 0x89, 0xcf,
+  0x48, 0x81, 0xef, 0x00, 0x10, 0x00, 0x00, 0x8b, 0x4a, 0x04, 0x4c, 0x8d,
+  0x5a, 0x08, 0x4d, 0x29, 0xe7, 0x41, 0x89, 0xce, 0x45, 0x39, 0xf5, 0x73,
+  0x74, 0x44, 0x89, 0xf0, 0x44, 0x29, 0xe8, 0xd1, 0xe8, 0x42, 0x8d, 0x1c,
+  0x28, 0x48, 0x89, 0xd8, 0x48, 0x6b, 0xdb, 0x18, 0x4c, 0x01, 0xdb, 0x48,
+  0x8b, 0x2b, 0x49, 0x39, 0xef, 0x7c, 0x12, 0x44, 0x8b, 0x6b, 0x10, 0x49,
+  0x01, 0xed, 0x4d, 0x39, 0xef, 0x7c, 0x0b, 0x44, 0x8d, 0x68, 0x01, 0xeb,
+  0xcb, 0x41, 0x89, 0xc6, 0xeb, 0xc6, 0x4c, 0x01, 0xe5, 0xe8, 0xb9, 0xfe,
+  0xff, 0xff, 0x8b, 0x73, 0x10, 0x48, 0x63, 0x53, 0x14, 0x48, 0x89, 0xef,
+  0x4c, 0x8b, 0x4b, 0x08, 0x41, 0xba, 0x12, 0x00, 0x00, 0x00, 0x4c, 0x63,
+  0xc0, 0xb8, 0x09, 0x00, 0x00, 0x00, 0x0f, 0x05, 0x48, 0x39, 0xc5, 0x0f,
+  0x84, 0x92, 0x00, 0x00, 0x00, 0x89, 0xc6, 0x48, 0x8d, 0x3d, 0xe4, 0xfa,
+  0xff, 0xff, 0xf7, 0xde, 0xe8, 0x81, 0xfd, 0xff, 0xff, 0x8b, 0x12, 0x39,
+  0xd1, 0x73, 0x2f, 0x89, 0xd0, 0x29, 0xc8, 0xd1, 0xe8, 0x8d, 0x1c, 0x08,
+  0x48, 0x89, 0xd8, 0x48, 0x6b, 0xdb, 0x18, 0x4c, 0x01, 0xdb, 0x48, 0x8b,
+  0x2b, 0x49, 0x39, 0xe9, 0x7c, 0x10, 0x8b, 0x4b, 0x10, 0x48, 0x01, 0xe9,
+  0x49, 0x39, 0xc9, 0x7c, 0x98, 0x8d, 0x48, 0x01, 0xeb, 0xd1, 0x89, 0xc2,
+  0xeb, 0xcd, 0x48, 0x8b, 0x47, 0x18, 0x48, 0x83, 0xf8, 0x01, 0x77, 0x1a,
+  0x48, 0x8d, 0x77, 0x18, 0x31, 0xd2, 0xbf, 0x0b, 0x00, 0x00, 0x00, 0x41,
+  0xba, 0x08, 0x00, 0x00, 0x00, 0xb8, 0x0d, 0x00, 0x00, 0x00, 0x0f, 0x05,
+  0xeb, 0x29, 0xf6, 0x47, 0x20, 0x04, 0x74, 0x13, 0x59, 0x4c, 0x89, 0xd2,
+  0x5b, 0x44, 0x89, 0xc7, 0x5d, 0x41, 0x5c, 0x41, 0x5d, 0x41, 0x5e, 0x41,
+  0x5f, 0xff, 0xe0, 0x5a, 0x44, 0x89, 0xc7, 0x5b, 0x5d, 0x41, 0x5c, 0x41,
+  0x5d, 0x41, 0x5e, 0x41, 0x5f, 0xff, 0xe0, 0x58, 0x5b, 0x5d, 0x41, 0x5c,
+  0x41, 0x5d, 0x41, 0x5e, 0x41, 0x5f, 0xc3, 0x41, 0x57, 0x41, 0x56, 0x41,
+  0x55, 0x41, 0x54, 0x55, 0x53, 0x48, 0x81, 0xec, 0x40, 0x20, 0x00, 0x00,
+  0xe8, 0x49, 0xfc, 0xff, 0xff, 0x89, 0xc5, 0x85, 0xc0, 0x79, 0x42, 0x48,
+  0x8d, 0x5c, 0x24, 0x40, 0x48, 0x89, 0xdf, 0xe8, 0xf7, 0xfa, 0xff, 0xff,
+  0x85, 0xc0, 0x74, 0x0d, 0xf7, 0xd8, 0x48, 0x8d, 0x3d, 0xce, 0xf9, 0xff,
+  0xff, 0x89, 0xc6, 0xeb, 0x1f, 0x48, 0x89, 0xdf, 0x31, 0xf6, 0x31, 0xd2,
+  0xb8, 0x02, 0x00, 0x00, 0x00, 0x0f, 0x05, 0x89, 0xc5, 0x85, 0xc0, 0x79,
+  0x10, 0x89, 0xc6, 0x48, 0x8d, 0x3d, 0xd1, 0xf9, 0xff, 0xff, 0xf7, 0xde,
+  0xe8, 0x95, 0xfc, 0xff, 0xff, 0x83, 0x3d, 0x2b, 0xf9, 0xff, 0xff, 0x00,
+  0x75, 0x46, 0x8b, 0x05, 0x27, 0xf9, 0xff, 0xff, 0x85, 0xc0, 0x0f, 0x84,
+  0x9a, 0x02, 0x00, 0x00, 0x48, 0x8d, 0x15, 0x11, 0xf9, 0xff, 0xff, 0x48,
+  0xb9, 0x00, 0x40, 0x12, 0xf0, 0xfd, 0xff, 0xff, 0xff, 0x48, 0x01, 0xd0,
+  0x48, 0x89, 0x04, 0x24, 0x48, 0x8d, 0x58, 0x08, 0x31, 0xc0, 0x48, 0x01,
+  0xd1, 0x48, 0x89, 0x44, 0x24, 0x08, 0x48, 0x63, 0xc5, 0x48, 0x89, 0x4c,
+  0x24, 0x18, 0x48, 0x89, 0x44, 0x24, 0x10, 0xe9, 0xf2, 0x00, 0x00, 0x00,
+  0x4c, 0x8d, 0x25, 0xd9, 0xf8, 0xff, 0xff, 0x49, 0x8d, 0x9c, 0x24, 0x00,
+  0xf0, 0xff, 0xff, 0xbe, 0x00, 0x10, 0x00, 0x00, 0xba, 0x03, 0x00, 0x00,
+  0x00, 0x45, 0x31, 0xc9, 0x48, 0x89, 0xdf, 0x41, 0xba, 0x32, 0x00, 0x00,
+  0x00, 0x49, 0x83, 0xc8, 0xff, 0xb8, 0x09, 0x00, 0x00, 0x00, 0x0f, 0x05,
+  0x48, 0x39, 0xc3, 0x74, 0x10, 0x89, 0xc6, 0x48, 0x8d, 0x3d, 0x64, 0xf9,
+  0xff, 0xff, 0xf7, 0xde, 0xe9, 0x67, 0xff, 0xff, 0xff, 0x48, 0x63, 0xfd,
+  0xbe, 0x06, 0x04, 0x00, 0x00, 0x31, 0xd2, 0xb8, 0x48, 0x00, 0x00, 0x00,
+  0x0f, 0x05, 0x41, 0x89, 0x84, 0x24, 0x00, 0xf0, 0xff, 0xff, 0x85, 0xc0,
+  0x78, 0x25, 0x48, 0x63, 0xf8, 0x48, 0x8d, 0x74, 0x24, 0x40, 0xb8, 0x05,
+  0x00, 0x00, 0x00, 0x0f, 0x05, 0x85, 0xc0, 0x75, 0x12, 0x48, 0x8b, 0x44,
+  0x24, 0x40, 0x48, 0x89, 0x43, 0x08, 0x48, 0x8b, 0x44, 0x24, 0x48, 0x48,
+  0x89, 0x43, 0x10, 0x31, 0xd2, 0xbf, 0x0b, 0x00, 0x00, 0x00, 0x48, 0x8d,
+  0x74, 0x24, 0x20, 0x48, 0xc7, 0x44, 0x24, 0x28, 0x04, 0x00, 0x00, 0x14,
+  0x48, 0x8d, 0x05, 0x5c, 0xfd, 0xff, 0xff, 0x48, 0x89, 0x54, 0x24, 0x38,
+  0x48, 0x8d, 0x53, 0x18, 0x41, 0xba, 0x08, 0x00, 0x00, 0x00, 0x48, 0x89,
+  0x44, 0x24, 0x20, 0x48, 0x8d, 0x05, 0x71, 0xf9, 0xff, 0xff, 0x48, 0x89,
+  0x44, 0x24, 0x30, 0xb8, 0x0d, 0x00, 0x00, 0x00, 0x0f, 0x05, 0x85, 0xc0,
+  0x0f, 0x84, 0xe8, 0xfe, 0xff, 0xff, 0x89, 0xc6, 0x48, 0x8d, 0x3d, 0xe1,
+  0xf8, 0xff, 0xff, 0xf7, 0xde, 0xe9, 0xca, 0xfe, 0xff, 0xff, 0x89, 0xf0,
+  0x48, 0xc1, 0xe0, 0x04, 0x49, 0x8d, 0x5c, 0x05, 0x00, 0x48, 0xff, 0x44,
+  0x24, 0x08, 0x48, 0x8b, 0x04, 0x24, 0x48, 0x8b, 0x4c, 0x24, 0x08, 0x48,
+  0x3b, 0x08, 0x0f, 0x83, 0x5e, 0x01, 0x00, 0x00, 0x4c, 0x8b, 0x64, 0x24,
+  0x18, 0x4c, 0x03, 0x23, 0x4c, 0x8d, 0x6b, 0x18, 0x49, 0x83, 0xc8, 0xff,
+  0x48, 0x8b, 0x73, 0x08, 0x4c, 0x89, 0xe7, 0xba, 0x03, 0x00, 0x00, 0x00,
+  0x45, 0x31, 0xc9, 0x41, 0xba, 0x22, 0x00, 0x10, 0x00, 0xb8, 0x09, 0x00,
+  0x00, 0x00, 0x0f, 0x05, 0x48, 0x89, 0xc7, 0x49, 0x39, 0xc4, 0x0f, 0x84,
+  0x8b, 0x00, 0x00, 0x00, 0x48, 0x85, 0xc0, 0x7e, 0x07, 0xb8, 0x0b, 0x00,
+  0x00, 0x00, 0x0f, 0x05, 0x45, 0x31, 0xf6, 0x8b, 0x73, 0x10, 0x41, 0x39,
+  0xf6, 0x73, 0x8f, 0x44, 0x89, 0xf2, 0x41, 0x8d, 0x4e, 0x01, 0x48, 0xc1,
+  0xe2, 0x04, 0x49, 0x89, 0xce, 0x48, 0xc1, 0xe1, 0x04, 0x4c, 0x01, 0xea,
+  0x48, 0x8d, 0x04, 0x0b, 0x44, 0x8b, 0x42, 0x0c, 0x4c, 0x8b, 0x0a, 0x8b,
+  0x7a, 0x08, 0x41, 0x39, 0xf6, 0x74, 0x29, 0x44, 0x8b, 0x50, 0x20, 0x49,
+  0x8d, 0x14, 0x38, 0x48, 0x89, 0xc1, 0x49, 0x39, 0xd2, 0x75, 0x19, 0x48,
+  0x83, 0xc0, 0x10, 0x4b, 0x8d, 0x14, 0x01, 0x48, 0x39, 0x51, 0x18, 0x75,
+  0x0b, 0x8b, 0x50, 0x14, 0x41, 0xff, 0xc6, 0x49, 0x01, 0xd0, 0xeb, 0xd2,
+  0x4c, 0x89, 0xc6, 0x48, 0x63, 0x53, 0x14, 0x4c, 0x8b, 0x44, 0x24, 0x10,
+  0x4c, 0x01, 0xe7, 0x41, 0xba, 0x12, 0x00, 0x00, 0x00, 0xb8, 0x09, 0x00,
+  0x00, 0x00, 0x0f, 0x05, 0x48, 0x39, 0xc7, 0x74, 0x86, 0xeb, 0x62, 0x4c,
+  0x89, 0xe7, 0xba, 0x0e, 0x00, 0x00, 0x00, 0xb8, 0x1c, 0x00, 0x00, 0x00,
+  0x0f, 0x05, 0x45, 0x31, 0xf6, 0xeb, 0x03, 0x41, 0xff, 0xc6, 0x44, 0x8b,
+  0x43, 0x10, 0x45, 0x39, 0xc6, 0x73, 0x57, 0x45, 0x89, 0xf0, 0x45, 0x31,
+  0xc9, 0x49, 0xc1, 0xe0, 0x04, 0x4d, 0x01, 0xe8, 0x45, 0x8b, 0x78, 0x08,
+  0x4d, 0x01, 0xe7, 0x41, 0x8b, 0x50, 0x0c, 0x49, 0x39, 0xd1, 0x73, 0xd7,
+  0x4d, 0x8b, 0x10, 0x48, 0x8b, 0x7c, 0x24, 0x10, 0x4c, 0x29, 0xca, 0x4b,
+  0x8d, 0x34, 0x0f, 0x4d, 0x01, 0xca, 0xb8, 0x11, 0x00, 0x00, 0x00, 0x0f,
+  0x05, 0x48, 0x85, 0xc0, 0x7f, 0x17, 0xbe, 0x05, 0x00, 0x00, 0x00, 0x74,
+  0x04, 0x89, 0xc6, 0xf7, 0xde, 0x48, 0x8d, 0x3d, 0xac, 0xf7, 0xff, 0xff,
+  0xe9, 0x73, 0xfd, 0xff, 0xff, 0x49, 0x01, 0xc1, 0xeb, 0xbd, 0x48, 0x8b,
+  0x73, 0x08, 0x48, 0x63, 0x53, 0x14, 0x4c, 0x89, 0xe7, 0xb8, 0x0a, 0x00,
+  0x00, 0x00, 0x0f, 0x05, 0x85, 0xc0, 0x75, 0xd5, 0x49, 0xc1, 0xe0, 0x04,
+  0x4b, 0x8d, 0x5c, 0x05, 0x00, 0xe9, 0x8b, 0xfe, 0xff, 0xff, 0x48, 0x81,
+  0xc4, 0x40, 0x20, 0x00, 0x00, 0x89, 0xe8, 0x5b, 0x5d, 0x41, 0x5c, 0x41,
+  0x5d, 0x41, 0x5e, 0x41, 0x5f, 0xc3
+};
+unsigned int e9loader_bin_len = 2454;
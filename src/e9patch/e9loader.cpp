@@ -30,8 +30,10 @@
 #include <cstdlib>
 
 #include <dirent.h>
+#include <elf.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "e9loader.h"
@@ -44,17 +46,27 @@
 
 #define BUFSIZ      8192
 
+#ifndef SA_RESTORER
+#define SA_RESTORER 0x04000000
+#endif
+
 static NO_INLINE int e9binary(char *path_buf);
 
+extern const char exename[];
+extern const uint8_t exe_flag[];
+extern const uint32_t lazy_offset[];
+extern const uint32_t huge_offset[];
 extern const char mapsname[];
 extern const char maps_err_str[];
 extern const char open_err_str[];
 extern const char mmap_err_str[];
+extern const char lazy_err_str[];
+extern const char huge_err_str[];
 extern const char common_err_str[];
 
 extern "C"
 {
-    int e9entry(void);
+    int e9entry(const intptr_t *stack);
     NO_INLINE NO_RETURN void e9error(const char *err_str, int err);
 }
 
@@ -77,11 +89,27 @@ asm (
      *  (2) call e9entry()
      *  (3) setup stage #2 parameters
      *  (4) jump to stage #2
+     *
+     * The byte at offset LOADER_EXE_FLAG_OFFSET is set by e9patch if the
+     * loader is the program entry point (as opposed to DT_INIT).  The words
+     * at offsets LOADER_LAZY_OFFSET and LOADER_HUGE_OFFSET are set to the
+     * lazy and huge page table offsets (if any).
      */
     ".globl _entry\n"
     ".type _entry,@function\n"
     "_entry:\n"
-    
+    "\tjmp .Lentry\n"
+    ".globl exe_flag\n"
+    "exe_flag:\n"
+    ".byte 0x00\n"
+    ".globl lazy_offset\n"
+    "lazy_offset:\n"
+    ".long 0x00000000\n"
+    ".globl huge_offset\n"
+    "huge_offset:\n"
+    ".long 0x00000000\n"
+    ".Lentry:\n"
+
     // (1) save the state
     "\tpushq %r15\n"
     "\tpushq %r14\n"
@@ -97,6 +125,7 @@ asm (
     "\tpushq %rdi\n"
 
     // (2) call e9entry()
+    "\tleaq 96(%rsp), %rdi\n"              // Initial stack into %rdi
     "\tcallq e9entry\n"                     // Call main entry routine
 
     // (3) setup stage #2 parameters
@@ -117,6 +146,12 @@ asm (
      * Note that we define the data as executable code to keep everything
      * in the (.text) section.
      */
+    ".global exename\n"
+    ".type exename,@function\n"
+    "exename:\n"
+    ".ascii \"/proc/self/exe\"\n"
+    ".byte 0x00\n"
+
     ".global mapsname\n"
     ".type mapsname,@function\n"
     "mapsname:\n"
@@ -141,6 +176,18 @@ asm (
     ".ascii \"map file \\\"%s\\\" (errno=%d)\\n\"\n"
     ".byte 0x00\n"
 
+    ".globl lazy_err_str\n"
+    ".type lazy_err_str,@function\n"
+    "lazy_err_str:\n"
+    ".ascii \"install SIGSEGV handler (errno=%d)\\n\"\n"
+    ".byte 0x00\n"
+
+    ".globl huge_err_str\n"
+    ".type huge_err_str,@function\n"
+    "huge_err_str:\n"
+    ".ascii \"load huge page region (errno=%d)\\n\"\n"
+    ".byte 0x00\n"
+
     ".globl common_err_str\n"
     ".type common_err_str,@function\n" 
     "common_err_str:\n"
@@ -156,6 +203,13 @@ asm (
     "\tneg %rsi\n"
     "\tjmp e9error\n"
 
+    /*
+     * Signal return trampoline (required for x86_64 signal handlers).
+     */
+    ".Lrestorer:\n"
+    "\tmov $15, %eax\n"                    // SYS_RT_SIGRETURN
+    "\tsyscall\n"
+
 );
 
 static int e9open(const char *filename_0, int flags_0, int mode_0)
@@ -246,6 +300,146 @@ static int e9close(int fd_0)
     return (int)err;
 }
 
+static intptr_t e9mmap(intptr_t addr_0, size_t len_0, int prot_0,
+    int flags_0, int fd_0, off_t offset_0)
+{
+    register uintptr_t addr asm("rdi")   = (uintptr_t)addr_0;
+    register uintptr_t len asm("rsi")    = (uintptr_t)len_0;
+    register uintptr_t prot asm("rdx")   = (uintptr_t)prot_0;
+    register uintptr_t flags asm("r10")  = (uintptr_t)flags_0;
+    register uintptr_t fd asm("r8")      = (uintptr_t)fd_0;
+    register uintptr_t offset asm("r9")  = (uintptr_t)offset_0;
+    register intptr_t result asm("rax");
+
+    asm volatile (
+        "mov $9, %%eax\n\t"             // SYS_MMAP
+        "syscall"
+        : "=rax"(result) : "r"(addr), "r"(len), "r"(prot), "r"(flags),
+            "r"(fd), "r"(offset) : "rcx", "r11");
+
+    return result;
+}
+
+static int e9munmap(intptr_t addr_0, size_t len_0)
+{
+    register uintptr_t addr asm("rdi") = (uintptr_t)addr_0;
+    register uintptr_t len asm("rsi")  = (uintptr_t)len_0;
+    register intptr_t err asm("rax");
+
+    asm volatile (
+        "mov $11, %%eax\n\t"            // SYS_MUNMAP
+        "syscall"
+        : "=rax"(err) : "r"(addr), "r"(len) : "rcx", "r11");
+
+    return (int)err;
+}
+
+static intptr_t e9pread(int fd_0, void *buf_0, size_t count_0,
+    off_t offset_0)
+{
+    register uintptr_t fd asm("rdi")     = (uintptr_t)fd_0;
+    register uintptr_t buf asm("rsi")    = (uintptr_t)buf_0;
+    register uintptr_t count asm("rdx")  = (uintptr_t)count_0;
+    register uintptr_t offset asm("r10") = (uintptr_t)offset_0;
+    register intptr_t result asm("rax");
+
+    asm volatile (
+        "mov $17, %%eax\n\t"            // SYS_PREAD64
+        "syscall"
+        : "=rax"(result) : "r"(fd), "r"(buf), "r"(count), "r"(offset)
+        : "rcx", "r11", "memory");
+
+    return result;
+}
+
+static int e9mprotect(intptr_t addr_0, size_t len_0, int prot_0)
+{
+    register uintptr_t addr asm("rdi") = (uintptr_t)addr_0;
+    register uintptr_t len asm("rsi")  = (uintptr_t)len_0;
+    register uintptr_t prot asm("rdx") = (uintptr_t)prot_0;
+    register intptr_t err asm("rax");
+
+    asm volatile (
+        "mov $10, %%eax\n\t"            // SYS_MPROTECT
+        "syscall"
+        : "=rax"(err) : "r"(addr), "r"(len), "r"(prot) : "rcx", "r11");
+
+    return (int)err;
+}
+
+static int e9madvise(intptr_t addr_0, size_t len_0, int advice_0)
+{
+    register uintptr_t addr asm("rdi")   = (uintptr_t)addr_0;
+    register uintptr_t len asm("rsi")    = (uintptr_t)len_0;
+    register uintptr_t advice asm("rdx") = (uintptr_t)advice_0;
+    register intptr_t err asm("rax");
+
+    asm volatile (
+        "mov $28, %%eax\n\t"            // SYS_MADVISE
+        "syscall"
+        : "=rax"(err) : "r"(addr), "r"(len), "r"(advice) : "rcx", "r11");
+
+    return (int)err;
+}
+
+static int e9fstat(int fd_0, struct stat *buf_0)
+{
+    register uintptr_t fd asm("rdi")  = (uintptr_t)fd_0;
+    register uintptr_t buf asm("rsi") = (uintptr_t)buf_0;
+    register intptr_t err asm("rax");
+
+    asm volatile (
+        "mov $5, %%eax\n\t"             // SYS_FSTAT
+        "syscall"
+        : "=rax"(err) : "r"(fd), "r"(buf) : "rcx", "r11", "memory");
+
+    return (int)err;
+}
+
+static int e9fcntl(int fd_0, int cmd_0, int arg_0)
+{
+    register uintptr_t fd asm("rdi")  = (uintptr_t)fd_0;
+    register uintptr_t cmd asm("rsi") = (uintptr_t)cmd_0;
+    register uintptr_t arg asm("rdx") = (uintptr_t)arg_0;
+    register intptr_t err asm("rax");
+
+    asm volatile (
+        "mov $72, %%eax\n\t"            // SYS_FCNTL
+        "syscall"
+        : "=rax"(err) : "r"(fd), "r"(cmd), "r"(arg) : "rcx", "r11");
+
+    return (int)err;
+}
+
+/*
+ * Kernel signal action structure.
+ */
+struct ksigaction
+{
+    void *handler;
+    unsigned long flags;
+    void *restorer;
+    uint64_t mask;
+};
+
+static int e9sigaction(int sig_0, const struct ksigaction *act_0,
+    struct ksigaction *oldact_0)
+{
+    register uintptr_t sig asm("rdi")    = (uintptr_t)sig_0;
+    register uintptr_t act asm("rsi")    = (uintptr_t)act_0;
+    register uintptr_t oldact asm("rdx") = (uintptr_t)oldact_0;
+    register uintptr_t size asm("r10")   = sizeof(uint64_t);
+    register intptr_t err asm("rax");
+
+    asm volatile (
+        "mov $13, %%eax\n\t"            // SYS_RT_SIGACTION
+        "syscall"
+        : "=rax"(err) : "r"(sig), "r"(act), "r"(oldact), "r"(size)
+        : "rcx", "r11", "memory");
+
+    return (int)err;
+}
+
 /*
  * Convert a number into a string.
  */
@@ -401,16 +595,303 @@ static NO_INLINE int e9binary(char *path_buf)
     return 0;
 }
 
-int e9entry(void)
+/*
+ * Lazy loading state (stored at LOADER_LAZY_STATE_ADDRESS).
+ */
+struct LazyState
+{
+    int fd;                             // Binary fd (or -1).
+    dev_t dev;                          // Binary device.
+    ino_t ino;                          // Binary inode.
+    struct ksigaction old;              // Previous SIGSEGV action.
+};
+
+/*
+ * Get the loader base address (zero for non-PIC).
+ */
+static intptr_t e9base(void)
+{
+    intptr_t base;
+    asm ("leaq _entry(%%rip), %0" : "=r"(base));
+    return base - (intptr_t)LOADER_ADDRESS;
+}
+
+/*
+ * Get the lazy state.
+ */
+static LazyState *e9state(void)
+{
+    return (LazyState *)(e9base() + (intptr_t)LOADER_LAZY_STATE_ADDRESS);
+}
+
+/*
+ * Find the lazy table entry containing `addr' (binary search).
+ */
+static const LazyEntry *e9lookup(const LazyEntry *entries, uint32_t lo,
+    uint32_t hi, intptr_t addr)
+{
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const LazyEntry *entry = entries + mid;
+        if (addr < entry->addr)
+            hi = mid;
+        else if (addr >= entry->addr + (intptr_t)entry->size)
+            lo = mid + 1;
+        else
+            return entry;
+    }
+    return nullptr;
+}
+
+/*
+ * Get a file descriptor for the enclosing binary.  The program may have
+ * closed (or even reused) the saved descriptor, in which case the binary
+ * is reopened.
+ */
+static int e9lazyfd(LazyState *state)
 {
+    struct stat buf;
+    if (state->fd >= 0 && e9fstat(state->fd, &buf) == 0 &&
+            buf.st_dev == state->dev && buf.st_ino == state->ino)
+        return state->fd;
+
     char path_buf[BUFSIZ];
     int err = e9binary(path_buf);
     if (err != 0)
         e9error(maps_err_str, -err);
-
-    int fd = e9open(path_buf, O_RDONLY, 0);
+    int fd = e9open(path_buf, O_RDONLY | O_CLOEXEC, 0);
     if (fd < 0)
         e9error(open_err_str, -fd);
+    if (e9fstat(fd, &buf) == 0)
+    {
+        state->dev = buf.st_dev;
+        state->ino = buf.st_ino;
+    }
+    state->fd = fd;
+    return fd;
+}
+
+/*
+ * SIGSEGV handler for lazy loading.  If the fault is within a lazy
+ * mapping, the mapping is loaded and the faulting instruction is retried.
+ * Otherwise the fault is passed to the previous handler.
+ */
+static void e9lazy(int sig, siginfo_t *info, void *ctx)
+{
+    intptr_t base = e9base();
+    const LazyHeader *header = (const LazyHeader *)(base +
+        (intptr_t)LOADER_ADDRESS + lazy_offset[0]);
+    const LazyEntry *entries = (const LazyEntry *)(header + 1);
+    LazyState *state = e9state();
+
+    intptr_t addr = (intptr_t)info->si_addr;
+    const LazyEntry *entry = e9lookup(entries, 0, header->num_relative,
+        addr - base);
+    intptr_t entry_addr = 0;
+    if (entry != nullptr)
+        entry_addr = base + entry->addr;
+    else
+    {
+        entry = e9lookup(entries, header->num_relative, header->num, addr);
+        if (entry != nullptr)
+            entry_addr = entry->addr;
+    }
+    if (entry != nullptr)
+    {
+        int fd = e9lazyfd(state);
+        intptr_t result = e9mmap(entry_addr, entry->size, entry->prot,
+            MAP_PRIVATE | MAP_FIXED, fd, (off_t)entry->offset);
+        if (result != entry_addr)
+            e9error(mmap_err_str, (int)-result);
+        return;
+    }
+
+    // Not a lazy mapping:
+    void *handler = state->old.handler;
+    if (handler == SIG_DFL || handler == SIG_IGN)
+    {
+        // Restore the default action & retry (i.e., crash as normal).
+        (void)e9sigaction(SIGSEGV, &state->old, nullptr);
+        return;
+    }
+    if ((state->old.flags & SA_SIGINFO) != 0)
+        ((void (*)(int, siginfo_t *, void *))handler)(sig, info, ctx);
+    else
+        ((void (*)(int))handler)(sig);
+}
+
+/*
+ * Initialize lazy loading (if enabled).
+ */
+static void e9lazyinit(int fd)
+{
+    if (lazy_offset[0] == 0)
+        return;
+
+    intptr_t addr = e9base() + (intptr_t)LOADER_LAZY_STATE_ADDRESS;
+    intptr_t result = e9mmap(addr, 0x1000, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (result != addr)
+        e9error(mmap_err_str, (int)-result);
+    LazyState *state = (LazyState *)addr;
+
+    state->fd = e9fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    struct stat buf;
+    if (state->fd >= 0 && e9fstat(state->fd, &buf) == 0)
+    {
+        state->dev = buf.st_dev;
+        state->ino = buf.st_ino;
+    }
+
+    struct ksigaction action;
+    action.handler = (void *)e9lazy;
+    action.flags   = SA_SIGINFO | SA_RESTART | SA_RESTORER;
+    asm ("leaq .Lrestorer(%%rip), %0" : "=r"(action.restorer));
+    action.mask    = 0;
+    int err = e9sigaction(SIGSEGV, &action, &state->old);
+    if (err != 0)
+        e9error(lazy_err_str, -err);
+}
+
+/*
+ * Load the huge page regions (if any).  Each region is an anonymous
+ * mapping that is advised to use transparent huge pages, and is filled by
+ * copying the trampoline pages from the binary.  If part of a region is
+ * already mapped (e.g., by the dynamic linker), then existing mappings are
+ * not replaced, and the region's pages are mapped individually instead.
+ */
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+static void e9hugeinit(int fd)
+{
+    if (huge_offset[0] == 0)
+        return;
+
+    intptr_t base = e9base();
+    const HugeHeader *header = (const HugeHeader *)(base +
+        (intptr_t)LOADER_ADDRESS + huge_offset[0]);
+    const HugeRegion *region = (const HugeRegion *)(header + 1);
+    for (uint64_t i = 0; i < header->num; i++)
+    {
+        const HugeEntry *entries = (const HugeEntry *)(region + 1);
+        intptr_t addr = base + region->addr;
+        intptr_t result = e9mmap(addr, region->size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (result != addr)
+        {
+            // Note: older kernels treat MAP_FIXED_NOREPLACE as a hint.
+            if (result > 0)
+                (void)e9munmap(result, region->size);
+            for (uint32_t j = 0; j < region->num; )
+            {
+                // Coalesce contiguous entries into a single mmap():
+                const HugeEntry *entry = entries + j;
+                size_t size = entry->size;
+                for (j++; j < region->num &&
+                        entries[j].addr == entry->addr + size &&
+                        entries[j].offset == entry->offset + size; j++)
+                    size += entries[j].size;
+                result = e9mmap(addr + entry->addr, size, region->prot,
+                    MAP_PRIVATE | MAP_FIXED, fd, (off_t)entry->offset);
+                if (result != addr + (intptr_t)entry->addr)
+                    e9error(huge_err_str, (int)-result);
+            }
+            region = (const HugeRegion *)(entries + region->num);
+            continue;
+        }
+        (void)e9madvise(addr, region->size, MADV_HUGEPAGE);
+
+        for (uint32_t j = 0; j < region->num; j++)
+        {
+            const HugeEntry *entry = entries + j;
+            uint8_t *buf = (uint8_t *)(addr + entry->addr);
+            for (size_t k = 0; k < entry->size; )
+            {
+                result = e9pread(fd, buf + k, entry->size - k,
+                    (off_t)(entry->offset + k));
+                if (result <= 0)
+                    e9error(huge_err_str, (result == 0? EIO: (int)-result));
+                k += (size_t)result;
+            }
+        }
+
+        int err = e9mprotect(addr, region->size, region->prot);
+        if (err != 0)
+            e9error(huge_err_str, -err);
+        region = (const HugeRegion *)(entries + region->num);
+    }
+}
+
+/*
+ * Fast path: open the enclosing binary without scanning map_files.  This
+ * is only possible for executables, where the initial stack contains the
+ * auxiliary vector.  Returns -1 if the fast path does not apply.
+ */
+static NO_INLINE int e9executable(const intptr_t *stack)
+{
+    if (exe_flag[0] == 0)
+        return -1;
+
+    // Step (1): Find the auxiliary vector (after argv[] and envp[]).
+    intptr_t argc = *stack++;
+    stack += argc + 1;
+    while (*stack++ != 0)
+        ;
+    const Elf64_auxv_t *auxv = (const Elf64_auxv_t *)stack;
+
+    // Step (2): Check that the loader is the entry of the main program.
+    // Note: AT_BASE is zero for static binaries, but also if the dynamic
+    //       linker was invoked directly (in which case /proc/self/exe is
+    //       the dynamic linker), so we conservatively use the slow path.
+    intptr_t entry = 0, base = 0;
+    const char *execfn = nullptr;
+    for (; auxv->a_type != AT_NULL; auxv++)
+    {
+        switch (auxv->a_type)
+        {
+            case AT_BASE:
+                base = (intptr_t)auxv->a_un.a_val;
+                break;
+            case AT_ENTRY:
+                entry = (intptr_t)auxv->a_un.a_val;
+                break;
+            case AT_EXECFN:
+                execfn = (const char *)auxv->a_un.a_val;
+                break;
+        }
+    }
+    intptr_t self;
+    asm ("leaq _entry(%%rip), %0" : "=r"(self));
+    if (entry != self || base == 0)
+        return -1;
+
+    // Step (3): Open the executable.
+    // Note: AT_EXECFN is only used if /proc is unavailable, since the
+    //       path may have been renamed or replaced since execve().
+    int fd = e9open(exename, O_RDONLY, 0);
+    if (fd < 0 && execfn != nullptr)
+        fd = e9open(execfn, O_RDONLY, 0);
+    return fd;
+}
+
+int e9entry(const intptr_t *stack)
+{
+    int fd = e9executable(stack);
+    if (fd < 0)
+    {
+        char path_buf[BUFSIZ];
+        int err = e9binary(path_buf);
+        if (err != 0)
+            e9error(maps_err_str, -err);
+
+        fd = e9open(path_buf, O_RDONLY, 0);
+        if (fd < 0)
+            e9error(open_err_str, -fd);
+    }
+    e9lazyinit(fd);
+    e9hugeinit(fd);
     return fd;
 }
 
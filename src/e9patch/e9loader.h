@@ -19,9 +19,72 @@
 #ifndef __E9LOADER_H
 #define __E9LOADER_H
 
+#include <cstdint>
+
 /*
  * Loader address
  */
 #define LOADER_ADDRESS          0x20FEDC000
 
+/*
+ * Offset of the loader's "executable" flag byte.
+ */
+#define LOADER_EXE_FLAG_OFFSET  2
+
+/*
+ * Offset of the loader's lazy table offset (32bit, 0 for none).
+ */
+#define LOADER_LAZY_OFFSET      3
+
+/*
+ * Offset of the loader's huge page table offset (32bit, 0 for none).
+ */
+#define LOADER_HUGE_OFFSET      7
+
+/*
+ * Lazy loading state page address.
+ */
+#define LOADER_LAZY_STATE_ADDRESS   (LOADER_ADDRESS - 0x1000)
+
+/*
+ * Lazy loading table.  The table is a header followed by `num' entries.
+ * The first `num_relative' entries have base-relative addresses.  Both
+ * the relative and absolute entries are sorted by address.
+ */
+struct LazyHeader
+{
+    uint32_t num;                   // Number of entries.
+    uint32_t num_relative;          // Number of relative entries.
+};
+struct LazyEntry
+{
+    intptr_t addr;                  // Virtual address.
+    uint64_t offset;                // File offset.
+    uint32_t size;                  // Size in bytes.
+    int32_t prot;                   // Protections.
+};
+
+/*
+ * Huge page table.  The table is a header followed by `num' regions.  Each
+ * region is followed by its entries, which are copied into an anonymous
+ * huge page mapping at the (base-relative) region address.
+ */
+struct HugeHeader
+{
+    uint64_t num;                   // Number of regions.
+};
+struct HugeRegion
+{
+    intptr_t addr;                  // Virtual address.
+    uint64_t size;                  // Size in bytes.
+    uint32_t num;                   // Number of entries.
+    int32_t prot;                   // Protections.
+};
+struct HugeEntry
+{
+    uint64_t offset;                // File offset.
+    uint32_t addr;                  // Offset into the region.
+    uint32_t size;                  // Size in bytes.
+};
+
 #endif
@@ -30,6 +30,11 @@
 #include <cstring>
 #include <ctime>
 
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+
 #include <sys/mman.h>
 
 #include "e9alloc.h"
@@ -538,13 +543,10 @@ static void collectMappings(Radix::Node *node, MappingSet &mappings)
 }
 
 /*
- * Shrink a mapping (if possible).
+ * Calculate the page-aligned occupancy bounds of a merged mapping.
  */
-static void shrinkMapping(Mapping *mapping0)
+static Bounds calculateShrunkBounds(const Mapping *mapping0)
 {
-    if (mapping0->size == PAGE_SIZE)
-        return;
-
     intptr_t lb = INTPTR_MAX, ub = INTPTR_MIN;
     for (auto mapping = mapping0; mapping != nullptr;
         mapping = mapping->merged)
@@ -559,7 +561,20 @@ static void shrinkMapping(Mapping *mapping0)
         ub += PAGE_SIZE;
         ub = ub - ub % PAGE_SIZE;
     }
-    size_t size = ub - lb;
+    return {lb, ub};
+}
+
+/*
+ * Shrink a mapping (if possible).
+ */
+static void shrinkMapping(Mapping *mapping0)
+{
+    if (mapping0->size == PAGE_SIZE)
+        return;
+
+    Bounds b = calculateShrunkBounds(mapping0);
+    intptr_t lb = b.lb;
+    size_t size = b.ub - b.lb;
     if (size >= mapping0->size)
         return;
 
@@ -573,6 +588,383 @@ static void shrinkMapping(Mapping *mapping0)
     }
 }
 
+/**************************************************************************/
+/* EXACT PHYSICAL PAGE GROUPING                                           */
+/**************************************************************************/
+
+/*
+ * The greedy grouping rounds occupancy up to whole key units, so groups
+ * that could share a physical page are often kept apart.  For higher
+ * effort levels, we run a local search over the greedy result using the
+ * exact occupied byte ranges.  The search attempts to dissolve each group
+ * (smallest first) by moving all of its mappings into other groups
+ * (fullest first, i.e., best fit).  A group is only dissolved if all of
+ * its mappings can be moved, since otherwise no physical page is saved.
+ * The effort level bounds the number of candidate groups tried per
+ * mapping (64, 4096, or unbounded), and whether the search is repeated
+ * until no more groups can be dissolved (level 2 and above).
+ */
+
+typedef std::vector<Bounds> Occupancy;
+
+/*
+ * A (virtual) mapping and its exact occupancy.
+ */
+struct Member
+{
+    Mapping *mapping;               // Mapping
+    Occupancy occ;                  // Occupied byte ranges
+    size_t used;                    // Occupied bytes
+};
+
+/*
+ * A group of merged mappings (i.e., a physical mapping).
+ */
+struct Group
+{
+    std::vector<Member *> members;  // Members
+    Occupancy occ;                  // Occupied byte ranges
+    size_t used;                    // Occupied bytes
+};
+
+/*
+ * Calculate the exact occupancy of a mapping.
+ */
+static size_t calculateOccupancy(const Mapping *mapping, Occupancy &occ)
+{
+    const size_t   SIZE = mapping->size;
+    const intptr_t BASE = mapping->base;
+    const intptr_t END  = BASE + SIZE;
+    size_t used = 0;
+    auto iend = Allocator::end();
+    for (auto i = mapping->i; i != iend; ++i)
+    {
+        const Alloc *a = *i;
+        if (a->lb >= END)
+            break;
+        if (a->T == nullptr)
+            continue;
+        intptr_t lb = (a->lb < BASE? 0: a->lb - BASE);
+        intptr_t ub = (a->ub > END ? END - BASE: a->ub - BASE);
+        if (!occ.empty() && occ.back().ub >= lb)
+        {
+            used -= occ.back().ub - occ.back().lb;
+            occ.back().ub = std::max(occ.back().ub, ub);
+        }
+        else
+            occ.push_back({lb, ub});
+        used += occ.back().ub - occ.back().lb;
+    }
+    return used;
+}
+
+/*
+ * Test if two occupancies overlap.
+ */
+static bool overlaps(const Occupancy &occ1, const Occupancy &occ2)
+{
+    size_t i = 0, j = 0;
+    while (i < occ1.size() && j < occ2.size())
+    {
+        if (occ1[i].ub <= occ2[j].lb)
+            i++;
+        else if (occ2[j].ub <= occ1[i].lb)
+            j++;
+        else
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Merge two non-overlapping occupancies.
+ */
+static void merge(Occupancy &occ1, const Occupancy &occ2)
+{
+    Occupancy occ;
+    occ.reserve(occ1.size() + occ2.size());
+    size_t i = 0, j = 0;
+    while (i < occ1.size() || j < occ2.size())
+    {
+        const Bounds &b = (j >= occ2.size() ||
+            (i < occ1.size() && occ1[i].lb < occ2[j].lb)? occ1[i++]:
+                                                          occ2[j++]);
+        if (!occ.empty() && occ.back().ub == b.lb)
+            occ.back().ub = b.ub;
+        else
+            occ.push_back(b);
+    }
+    occ1.swap(occ);
+}
+
+/*
+ * Calculate the number of physical bytes used by a set of mappings.
+ */
+static size_t calculatePhysicalBytes(const MappingSet &mappings)
+{
+    size_t bytes = 0;
+    for (const auto mapping: mappings)
+    {
+        if (mapping->size == PAGE_SIZE)
+        {
+            bytes += mapping->size;
+            continue;
+        }
+        Bounds b = calculateShrunkBounds(mapping);
+        bytes += std::min((size_t)(b.ub - b.lb), mapping->size);
+    }
+    return bytes;
+}
+
+/*
+ * Improve the grouping of the given set of mappings.
+ */
+static void improveMappings(MappingSet &mappings, unsigned effort)
+{
+    if (mappings.empty())
+        return;
+    const size_t SIZE = mappings[0]->size;
+    const size_t CANDIDATES_MAX =
+        (effort >= 3? SIZE_MAX: (size_t)1 << (6 * effort));
+
+    // Step (1): Calculate the exact occupancy of each group:
+    std::vector<Member> members;
+    for (auto mapping0: mappings)
+        for (auto mapping = mapping0; mapping != nullptr;
+                mapping = mapping->merged)
+            members.emplace_back();
+    std::vector<Group> groups(mappings.size());
+    std::set<std::pair<size_t, size_t>> index;
+    for (size_t i = 0, k = 0; i < mappings.size(); i++)
+    {
+        Group &G = groups[i];
+        G.used = 0;
+        for (auto mapping = mappings[i]; mapping != nullptr;
+                mapping = mapping->merged)
+        {
+            Member *M  = &members[k++];
+            M->mapping = mapping;
+            M->used    = calculateOccupancy(mapping, M->occ);
+            merge(G.occ, M->occ);
+            G.used += M->used;
+            G.members.push_back(M);
+        }
+        index.insert({G.used, i});
+    }
+
+    // Step (2): Attempt to dissolve groups:
+    std::vector<size_t> order(groups.size());
+    std::vector<std::pair<size_t, Group>> undo;
+    std::vector<std::pair<Member *, size_t>> moves;
+    bool progress = true;
+    for (unsigned pass = 0; progress && (pass < 1 || effort > 1); pass++)
+    {
+        progress = false;
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(),
+            [&groups](size_t i, size_t j)
+            {
+                return (groups[i].used < groups[j].used);
+            });
+        for (size_t i: order)
+        {
+            Group &G = groups[i];
+            if (G.members.empty())
+                continue;
+            index.erase({G.used, i});
+            std::sort(G.members.begin(), G.members.end(),
+                [](const Member *M, const Member *N)
+                {
+                    return (M->used > N->used);
+                });
+
+            undo.clear();
+            moves.clear();
+            bool ok = true;
+            for (auto M: G.members)
+            {
+                // Find the fullest group with no overlap:
+                size_t j = SIZE_MAX, n = 0;
+                for (auto k = index.upper_bound({SIZE - M->used, SIZE_MAX});
+                        k != index.begin() && n < CANDIDATES_MAX; n++)
+                {
+                    --k;
+                    if (!overlaps(groups[k->second].occ, M->occ))
+                    {
+                        j = k->second;
+                        break;
+                    }
+                }
+                if (j == SIZE_MAX)
+                {
+                    ok = false;
+                    break;
+                }
+                Group &H = groups[j];
+                undo.push_back({j, H});
+                index.erase({H.used, j});
+                merge(H.occ, M->occ);
+                H.used += M->used;
+                H.members.push_back(M);
+                index.insert({H.used, j});
+                moves.push_back({M, j});
+            }
+
+            if (ok)
+            {
+                G.members.clear();
+                G.occ.clear();
+                G.used = 0;
+                progress = true;
+                continue;
+            }
+
+            // Undo the moves:
+            for (auto k = undo.rbegin(); k != undo.rend(); ++k)
+            {
+                Group &H = groups[k->first];
+                index.erase({H.used, k->first});
+                H = std::move(k->second);
+                index.insert({H.used, k->first});
+            }
+            index.insert({G.used, i});
+        }
+    }
+
+    // Step (3): Rebuild the merged mappings:
+    mappings.clear();
+    for (auto &G: groups)
+    {
+        if (G.members.empty())
+            continue;
+        Mapping *prev = nullptr;
+        for (auto M: G.members)
+        {
+            M->mapping->next   = nullptr;
+            M->mapping->merged = nullptr;
+            if (prev != nullptr)
+                prev->merged = M->mapping;
+            prev = M->mapping;
+        }
+        insertMapping(G.members[0]->mapping, mappings);
+    }
+    stat_num_physical_mappings = mappings.size();
+}
+
+/**************************************************************************/
+/* PHYSICAL LAYOUT                                                        */
+/**************************************************************************/
+
+/*
+ * The physical mappings are emitted into the file in the order of the
+ * mapping set.  If a virtual mapping A is immediately followed by another
+ * virtual mapping B, and both are occupied up to their common boundary,
+ * then the loader can map A and B using a single mmap() call, provided
+ * the physical mapping of B immediately follows that of A in the file.
+ * Since physical mappings are shared by many virtual mappings, not all
+ * such pairs can be satisfied.  We greedily chain physical mappings in
+ * order of the number of pairs satisfied, and otherwise order by virtual
+ * address.
+ */
+
+static size_t findChain(std::vector<size_t> &root, size_t i)
+{
+    while (root[i] != i)
+    {
+        root[i] = root[root[i]];
+        i = root[i];
+    }
+    return i;
+}
+
+static void layoutMappings(MappingSet &mappings)
+{
+    const size_t N = mappings.size();
+
+    // Step (1): Index all virtual mappings that are occupied from the base.
+    std::unordered_map<intptr_t, std::pair<const Mapping *, size_t>> bottom;
+    std::vector<Bounds> bounds;
+    for (size_t i = 0; i < N; i++)
+    {
+        for (auto mapping = mappings[i]; mapping != nullptr;
+                mapping = mapping->merged)
+        {
+            bounds.clear();
+            getVirtualBounds(mapping, bounds);
+            if (!bounds.empty() && bounds.front().lb == 0)
+                bottom.insert({mapping->base, {mapping, i}});
+        }
+    }
+
+    // Step (2): Count the pairs between each pair of physical mappings.
+    std::map<std::pair<size_t, size_t>, size_t> pairs;
+    for (size_t i = 0; i < N; i++)
+    {
+        for (auto mapping = mappings[i]; mapping != nullptr;
+                mapping = mapping->merged)
+        {
+            bounds.clear();
+            getVirtualBounds(mapping, bounds);
+            if (bounds.empty() || bounds.back().ub != (intptr_t)mapping->size)
+                continue;
+            auto k = bottom.find(mapping->base + mapping->size);
+            if (k == bottom.end())
+                continue;
+            const Mapping *next = k->second.first;
+            size_t j = k->second.second;
+            if (i == j || next->prot != mapping->prot ||
+                    next->preload != mapping->preload)
+                continue;
+            pairs[{i, j}]++;
+        }
+    }
+    std::vector<std::pair<size_t, std::pair<size_t, size_t>>> edges;
+    for (const auto &entry: pairs)
+        edges.push_back({entry.second, entry.first});
+    std::stable_sort(edges.begin(), edges.end(),
+        [](const std::pair<size_t, std::pair<size_t, size_t>> &a,
+           const std::pair<size_t, std::pair<size_t, size_t>> &b)
+        {
+            return (a.first > b.first);
+        });
+
+    // Step (3): Greedily chain the physical mappings.
+    std::vector<size_t> next(N, SIZE_MAX), prev(N, SIZE_MAX), root(N);
+    for (size_t i = 0; i < N; i++)
+        root[i] = i;
+    for (const auto &edge: edges)
+    {
+        size_t i = edge.second.first, j = edge.second.second;
+        if (next[i] != SIZE_MAX || prev[j] != SIZE_MAX)
+            continue;
+        size_t ri = findChain(root, i), rj = findChain(root, j);
+        if (ri == rj)
+            continue;               // Cycle
+        root[rj] = ri;
+        next[i]  = j;
+        prev[j]  = i;
+    }
+
+    // Step (4): Emit the chains in virtual address order.
+    std::vector<size_t> heads;
+    for (size_t i = 0; i < N; i++)
+        if (prev[i] == SIZE_MAX)
+            heads.push_back(i);
+    std::sort(heads.begin(), heads.end(),
+        [&mappings](size_t i, size_t j)
+        {
+            return (mappings[i]->base < mappings[j]->base);
+        });
+    MappingSet layout;
+    layout.reserve(N);
+    for (size_t i: heads)
+        for (; i != SIZE_MAX; i = next[i])
+            layout.push_back(mappings[i]);
+    assert(layout.size() == N);
+    mappings.swap(layout);
+}
+
 /*
  * Optimize the given set of mappings.
  */
@@ -585,8 +977,17 @@ void optimizeMappings(MappingSet &mappings)
     mappings.clear();
     collectMappings(tree, mappings);
 
+    if (option_mapping_effort > 0)
+    {
+        stat_num_greedy_mappings = mappings.size();
+        stat_num_greedy_bytes    = calculatePhysicalBytes(mappings);
+        improveMappings(mappings, option_mapping_effort);
+    }
+
     for (auto mapping: mappings)
         shrinkMapping(mapping);
+
+    layoutMappings(mappings);
 }
 
 /**************************************************************************/
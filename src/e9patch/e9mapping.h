@@ -40,6 +40,8 @@ struct Mapping
 
 typedef std::vector<Mapping *> MappingSet;
 
+#define MAPPING_EFFORT_MAX      3
+
 void buildMappings(const Allocator &allocator, const size_t MAPPING_SIZE,
     MappingSet &mappings);
 void optimizeMappings(MappingSet &mappings);
@@ -24,96 +24,9 @@
 
 #include "e9api.h"
 #include "e9json.h"
+#include "e9mapping.h"
 #include "e9patch.h"
 
-/*
- * Global options.
- */
-bool option_is_tty        = false;
-bool option_debug         = false;
-bool option_disable_B1    = false;
-bool option_disable_B2    = false;
-bool option_disable_T1    = false;
-bool option_disable_T2    = false;
-bool option_disable_T3    = false;
-bool option_experimental  = false;
-bool option_static_loader = false;
-bool option_same_page     = false;
-bool option_trap_all      = false;
-bool option_use_stack     = false;
-intptr_t option_lb        = INTPTR_MIN;
-intptr_t option_ub        = INTPTR_MAX;
-
-/*
- * Global statistics.
- */
-size_t stat_num_patched = 0;
-size_t stat_num_failed  = 0;
-size_t stat_num_B1 = 0;
-size_t stat_num_B2 = 0;
-size_t stat_num_T1 = 0;
-size_t stat_num_T2 = 0;
-size_t stat_num_T3 = 0;
-size_t stat_num_virtual_mappings  = 0;
-size_t stat_num_physical_mappings = 0;
-size_t stat_num_virtual_bytes  = 0;
-size_t stat_num_physical_bytes = 0;
-size_t stat_input_file_size  = 0;
-size_t stat_output_file_size = 0;
-
-/*
- * Report an error and exit.
- */
-void NO_RETURN error(const char *msg, ...)
-{
-    fprintf(stderr, "%serror%s: ",
-        (option_is_tty? "\33[31m": ""),
-        (option_is_tty? "\33[0m" : ""));
-
-    va_list ap;
-    va_start(ap, msg);
-    vfprintf(stderr, msg, ap);
-    va_end(ap);
-    
-    putc('\n', stderr);
-
-    _Exit(EXIT_FAILURE);
-}
-
-/*
- * Print a warning message.
- */
-void warning(const char *msg, ...)
-{
-    fprintf(stderr, "%swarning%s: ",
-        (option_is_tty? "\33[33m": ""),
-        (option_is_tty? "\33[0m" : ""));
-
-    va_list ap;
-    va_start(ap, msg);
-    vfprintf(stderr, msg, ap);
-    va_end(ap);
-    
-    putc('\n', stderr);
-}
-
-/*
- * Print a debug message.
- */
-void debugImpl(const char *msg, ...)
-{
-    fprintf(stderr, "%sdebug%s: ",
-        (option_is_tty? "\33[35m": ""),
-        (option_is_tty? "\33[0m" : ""));
-
-    va_list ap;
-    va_start(ap, msg);
-    vfprintf(stderr, msg, ap);
-    va_end(ap);
-
-    putc('\n', stderr);
-}
-
 /*
  * Options.
  */
@@ -128,11 +41,17 @@ enum Option
     OPTION_DISABLE_T3,
     OPTION_EXPERIMENTAL,
     OPTION_HELP,
+    OPTION_HUGE_PAGES,
     OPTION_INPUT,
+    OPTION_LAZY_LOAD,
     OPTION_LB,
+    OPTION_LOAD_SEGMENTS,
+    OPTION_MAPPING_EFFORT,
     OPTION_OUTPUT,
+    OPTION_PROFILE,
     OPTION_SAME_PAGE,
     OPTION_STATIC_LOADER,
+    OPTION_THREADS,
     OPTION_TRAP_ALL,
     OPTION_UB,
     OPTION_USE_STACK,
@@ -183,16 +102,110 @@ static void usage(FILE *stream, const char *progname)
     fputs("\t--help, -h\n", stream);
     fputs("\t\tPrint this help message.\n", stream);
     fputc('\n', stream);
+    fputs("\t--huge-pages\n", stream);
+    fputs("\t\tPack trampolines into huge page (2MB) aligned regions, "
+        "and\n", stream);
+    fputs("\t\tload sufficiently populated regions into anonymous "
+        "memory\n", stream);
+    fputs("\t\tadvised to use transparent huge pages (MADV_HUGEPAGE).  "
+        "This\n", stream);
+    fputs("\t\tmay reduce iTLB misses, at the cost of memory that is "
+        "not\n", stream);
+    fputs("\t\tshared between processes.  For PIC, regions only use "
+        "huge\n", stream);
+    fputs("\t\tpages if the load address is huge page aligned.  The "
+        "whole\n", stream);
+    fputs("\t\tregion is mapped with the trampolines' protections, "
+        "so the\n", stream);
+    fputs("\t\tgaps between trampolines become (e.g., executable) "
+        "zero\n", stream);
+    fputs("\t\tpages.  If a region overlaps an existing mapping "
+        "at load\n", stream);
+    fputs("\t\ttime, then its trampolines are mapped normally "
+        "instead.\n", stream);
+    fputc('\n', stream);
     fputs("\t--input FILE, -i FILE\n", stream);
     fputs("\t\tRead input from FILE instead of stdin.\n", stream);
     fputc('\n', stream);
+    fputs("\t--lazy-load\n", stream);
+    fputs("\t\tLoad trampoline pages on demand.  Instead of mapping "
+        "each\n", stream);
+    fputs("\t\ttrampoline page during program initialization, the "
+        "loader\n", stream);
+    fputs("\t\treserves the address space, and maps pages when they "
+        "are\n", stream);
+    fputs("\t\tfirst accessed using a SIGSEGV handler.  This reduces "
+        "the\n", stream);
+    fputs("\t\tstartup cost for binaries with many trampoline pages.  "
+        "This\n", stream);
+    fputs("\t\tis not transparent, and will break programs that "
+        "install\n", stream);
+    fputs("\t\ttheir own SIGSEGV handler or block SIGSEGV.\n", stream);
+    fputc('\n', stream);
     fputs("\t--lb LB\n", stream);
     fputs("\t\tSet LB to be the minimum allowable trampoline address.\n",
         stream);
     fputc('\n', stream);
+    fputs("\t--load-segments\n", stream);
+    fputs("\t\tLoad trampoline pages using PT_LOAD segments in a "
+        "relocated\n", stream);
+    fputs("\t\tprogram header table, so that the pages are mapped by "
+        "the\n", stream);
+    fputs("\t\tkernel or dynamic linker.  The number of segments is "
+        "limited,\n", stream);
+    fputs("\t\tso any remaining pages are mapped by the loader.  The "
+        "loader\n", stream);
+    fputs("\t\tis omitted if it is not needed.  Implies "
+        "--static-loader.\n", stream);
+    fputs("\t\tFor PIEs, this disables the negative trampoline address "
+        "range,\n", stream);
+    fputs("\t\twhich may reduce coverage for densely patched "
+        "binaries.\n", stream);
+    fputs("\t\tThe relocated table is placed after the memory image "
+        "of the\n", stream);
+    fputs("\t\thighest PT_LOAD segment, so the output file is "
+        "zero-padded by\n", stream);
+    fputs("\t\troughly the size of the .bss section.\n", stream);
+    fputc('\n', stream);
+    fputs("\t--mapping-effort N\n", stream);
+    fputs("\t\tSet the effort level N (0..3) for grouping trampoline "
+        "pages\n", stream);
+    fputs("\t\tinto physical pages.  Level 0 (the default) uses a fast "
+        "greedy\n", stream);
+    fputs("\t\tmerge based on approximate occupancy.  Higher levels "
+        "add\n", stream);
+    fputs("\t\tlocal search passes based on exact occupancy, which may "
+        "reduce\n", stream);
+    fputs("\t\tthe output size at the cost of slower patching.  Each "
+        "mapping\n", stream);
+    fputs("\t\ttries up to 64 (level 1), 4096 (level 2), or all "
+        "(level 3)\n", stream);
+    fputs("\t\tcandidate groups.  Levels 2 and 3 repeat the search "
+        "until no\n", stream);
+    fputs("\t\tmore groups can be merged.\n", stream);
+    fputc('\n', stream);
     fputs("\t--output FILE, -o FILE\n", stream);
     fputs("\t\tWrite output to FILE instead of stdout.\n", stream);
     fputc('\n', stream);
+    fputs("\t--profile FILE\n", stream);
+    fputs("\t\tPlace trampolines using the execution profile FILE.  "
+        "Each\n", stream);
+    fputs("\t\tline of FILE is of the form \"ADDR,COUNT\", where ADDR "
+        "is an\n", stream);
+    fputs("\t\tinstruction address (as used by the frontend, i.e., "
+        "without\n", stream);
+    fputs("\t\tthe load address for PIC) and COUNT is its hit count.  "
+        "The\n", stream);
+    fputs("\t\tmost frequently hit instructions accounting for 90% of "
+        "all\n", stream);
+    fputs("\t\thits are hot.  Hot trampolines are clustered into a "
+        "few\n", stream);
+    fputs("\t\tdense pages (cache-line aligned where possible), and "
+        "cold\n", stream);
+    fputs("\t\ttrampolines are placed elsewhere.  This may reduce "
+        "iTLB and\n", stream);
+    fputs("\t\ticache misses.\n", stream);
+    fputc('\n', stream);
     fputs("\t--same-page\n", stream);
     fputs("\t\tDisallow trampolines from crossing page boundaries.\n", stream);
     fputc('\n', stream);
@@ -205,6 +218,20 @@ static void usage(FILE *stream, const char *progname)
         "bloat\n", stream);
     fputs("\t\tthe size of the output patched binary.\n", stream);
     fputc('\n', stream);
+    fputs("\t--threads N\n", stream);
+    fputs("\t\tPatch using N threads.  Independent regions of the "
+        "binary\n", stream);
+    fputs("\t\tare patched in parallel, each using a disjoint range of "
+        "the\n", stream);
+    fputs("\t\ttrampoline address space.  Patches that need to evict "
+        "their\n", stream);
+    fputs("\t\tneighbours are deferred and applied sequentially, so "
+        "the\n", stream);
+    fputs("\t\tcoverage is close to that of N=1 (the default).  The "
+        "output\n", stream);
+    fputs("\t\tis deterministic, but may differ from the output for "
+        "N=1.\n", stream);
+    fputc('\n', stream);
     fputs("\t--trap-all\n", stream);
     fputs("\t\tInsert a trap (int3) instruction at each trampoline entry.\n",
         stream);
@@ -241,23 +268,29 @@ int realMain(int argc, char **argv)
 
     static const struct option long_options[] =
     {
-        {"debug",         false, nullptr, OPTION_DEBUG},
-        {"disable-B1",    false, nullptr, OPTION_DISABLE_B1},
-        {"disable-B2",    false, nullptr, OPTION_DISABLE_B2},
-        {"disable-T1",    false, nullptr, OPTION_DISABLE_T1},
-        {"disable-T2",    false, nullptr, OPTION_DISABLE_T2},
-        {"disable-T3",    false, nullptr, OPTION_DISABLE_T3},
-        {"experimental",  false, nullptr, OPTION_EXPERIMENTAL},
-        {"help",          false, nullptr, OPTION_HELP},
-        {"input",         true,  nullptr, OPTION_INPUT},
-        {"lb",            true,  nullptr, OPTION_LB},
-        {"output",        true,  nullptr, OPTION_OUTPUT},
-        {"same-page",     false, nullptr, OPTION_SAME_PAGE},
-        {"static-loader", false, nullptr, OPTION_STATIC_LOADER},
-        {"trap-all",      false, nullptr, OPTION_TRAP_ALL},
-        {"ub",            true,  nullptr, OPTION_UB},
-        {"use-stack",     false, nullptr, OPTION_USE_STACK},
-        {nullptr,         false, nullptr, 0}
+        {"debug",          false, nullptr, OPTION_DEBUG},
+        {"disable-B1",     false, nullptr, OPTION_DISABLE_B1},
+        {"disable-B2",     false, nullptr, OPTION_DISABLE_B2},
+        {"disable-T1",     false, nullptr, OPTION_DISABLE_T1},
+        {"disable-T2",     false, nullptr, OPTION_DISABLE_T2},
+        {"disable-T3",     false, nullptr, OPTION_DISABLE_T3},
+        {"experimental",   false, nullptr, OPTION_EXPERIMENTAL},
+        {"help",           false, nullptr, OPTION_HELP},
+        {"huge-pages",     false, nullptr, OPTION_HUGE_PAGES},
+        {"input",          true,  nullptr, OPTION_INPUT},
+        {"lazy-load",      false, nullptr, OPTION_LAZY_LOAD},
+        {"lb",             true,  nullptr, OPTION_LB},
+        {"load-segments",  false, nullptr, OPTION_LOAD_SEGMENTS},
+        {"mapping-effort", true,  nullptr, OPTION_MAPPING_EFFORT},
+        {"output",         true,  nullptr, OPTION_OUTPUT},
+        {"profile",        true,  nullptr, OPTION_PROFILE},
+        {"same-page",      false, nullptr, OPTION_SAME_PAGE},
+        {"static-loader",  false, nullptr, OPTION_STATIC_LOADER},
+        {"threads",        true,  nullptr, OPTION_THREADS},
+        {"trap-all",       false, nullptr, OPTION_TRAP_ALL},
+        {"ub",             true,  nullptr, OPTION_UB},
+        {"use-stack",      false, nullptr, OPTION_USE_STACK},
+        {nullptr,          false, nullptr, 0}
     };
 
     std::string option_input("-"), option_output("-");
@@ -294,6 +327,9 @@ int realMain(int argc, char **argv)
             case OPTION_HELP:
                 usage(stdout, argv[0]);
                 return EXIT_SUCCESS;
+            case OPTION_HUGE_PAGES:
+                option_huge_pages = true;
+                break;
             case 'i':
             case OPTION_INPUT:
                 option_input = optarg;
@@ -302,6 +338,9 @@ int realMain(int argc, char **argv)
             case OPTION_OUTPUT:
                 option_output = optarg;
                 break;
+            case OPTION_PROFILE:
+                option_profile = optarg;
+                break;
             case OPTION_TRAP_ALL:
                 option_trap_all = true;
                 break;
@@ -311,10 +350,24 @@ int realMain(int argc, char **argv)
             case OPTION_STATIC_LOADER:
                 option_static_loader = true;
                 break;
+            case OPTION_THREADS:
+                option_threads = (unsigned)parseIntOptArg("--threads",
+                    optarg, 1, 1024);
+                break;
+            case OPTION_LAZY_LOAD:
+                option_lazy_load = true;
+                break;
             case OPTION_LB:
                 option_lb = parseIntOptArg("--lb", optarg, INTPTR_MIN,
                     INTPTR_MAX);
                 break;
+            case OPTION_LOAD_SEGMENTS:
+                option_load_segments = true;
+                break;
+            case OPTION_MAPPING_EFFORT:
+                option_mapping_effort = (unsigned)parseIntOptArg(
+                    "--mapping-effort", optarg, 0, MAPPING_EFFORT_MAX);
+                break;
             case OPTION_UB:
                 option_ub = parseIntOptArg("--ub", optarg, INTPTR_MIN,
                     INTPTR_MAX);
@@ -348,12 +401,9 @@ int realMain(int argc, char **argv)
     
     Binary *B = nullptr;
     Message msg;
-    size_t lineno = 1;
-    while (getMessage(stdin, lineno, msg))
-    {
+    Parser *parser = makeParser(stdin);
+    while (getMessage(*parser, msg))
         B = parseMessage(B, msg);
-        lineno = msg.lineno;
-    }
     if (B == nullptr)
         exit(EXIT_SUCCESS);
 
@@ -392,14 +442,7 @@ int realMain(int argc, char **argv)
     printf("num_patched_T3        = %zu / %zu (%.2f%%)\n",
         stat_num_T3, stat_num_total,
         (double)stat_num_T3 / (double)stat_num_total * 100.0);
-    printf("num_virtual_mappings  = %s%zu%s%s\n",
-        (option_is_tty && stat_num_virtual_mappings >= MAX_MAPPINGS? "\33[33m":
-            ""),
-        stat_num_virtual_mappings,
-        (option_is_tty && stat_num_virtual_mappings >= MAX_MAPPINGS? "\33[0m":
-            ""),
-        (stat_num_virtual_mappings >= MAX_MAPPINGS?
-            " (warning: may exceed default system limit)": ""));
+    printf("num_virtual_mappings  = %zu\n", stat_num_virtual_mappings);
     printf("num_physical_mappings = %zu (%.2f%%)\n",
         stat_num_physical_mappings,
         (double)stat_num_physical_mappings /
@@ -408,6 +451,49 @@ int realMain(int argc, char **argv)
     printf("num_physical_bytes    = %zu (%.2f%%)\n", stat_num_physical_bytes,
         (double)stat_num_physical_bytes /
             (double)stat_num_virtual_bytes * 100.0);
+    printf("num_mmaps             = %s%zu%s (%zu coalesced)%s\n",
+        (option_is_tty && stat_num_mmaps >= MAX_MAPPINGS? "\33[33m": ""),
+        stat_num_mmaps,
+        (option_is_tty && stat_num_mmaps >= MAX_MAPPINGS? "\33[0m": ""),
+        stat_num_coalesced,
+        (stat_num_mmaps >= MAX_MAPPINGS?
+            " (warning: may exceed default system limit)": ""));
+    if (option_huge_pages)
+        printf("num_huge_regions      = %zu (%zu trampolines)\n",
+            stat_num_huge_regions, stat_num_huge_trampolines);
+    if (option_profile != nullptr)
+        printf("num_hot_trampolines   = %zu (%zu pages)\n",
+            stat_num_hot_trampolines, stat_num_hot_pages);
+    if (option_lazy_load)
+        printf("num_lazy_mappings     = %zu (%zu reservations)\n",
+            stat_num_lazy_mappings, stat_num_lazy_reservations);
+    if (option_load_segments)
+        printf("num_load_segments     = %zu\n", stat_num_segments);
+    printf("num_modified_pages    = %zu / %zu (%.2f%%, %zu ranges)\n",
+        stat_num_dirty_pages, stat_num_pages,
+        (double)stat_num_dirty_pages / (double)stat_num_pages * 100.0,
+        stat_num_dirty_ranges);
+    if (option_mapping_effort > 0)
+        printf("num_greedy_bytes      = %zu (%zu mappings, effort %u)\n",
+            stat_num_greedy_bytes, stat_num_greedy_mappings,
+            option_mapping_effort);
+    if (option_threads > 1)
+        printf("num_patch_windows     = %zu (%zu deferred, %u threads)\n",
+            stat_num_windows, stat_num_deferred, option_threads);
+    printf("num_patch_records     = %zu (%.2f per instruction, %zu heap "
+        "allocations)\n", stat_num_patches,
+        (double)stat_num_patches / (double)stat_num_total,
+        stat_num_patch_allocs);
+    printf("num_tree_nodes        = %zu / %zu (peak %zu)\n",
+        stat_num_nodes, stat_num_node_slots, stat_num_peak_nodes);
+    printf("num_tree_node_bytes   = %zu (%.2f%% fragmentation)\n",
+        stat_num_node_bytes,
+        (double)(stat_num_node_slots - stat_num_nodes) /
+            (double)stat_num_node_slots * 100.0);
+    printf("num_shared            = %zu (%zu bytes saved)\n",
+        stat_num_shared, stat_num_shared_bytes);
+    printf("num_messages          = %zu (%zu bytes)\n", stat_num_messages,
+        stat_num_message_bytes);
     printf("input_file_size       = %zu\n", stat_input_file_size);
     printf("output_file_size      = %zu (%.2f%%)\n",
         stat_output_file_size,
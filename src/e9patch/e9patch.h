@@ -28,12 +28,18 @@
 
 #include <deque>
 #include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #define NO_RETURN               __attribute__((__noreturn__))
 #define NO_INLINE               __attribute__((__noinline__))
 
 #define PAGE_SIZE               ((size_t)4096)
+#define HUGE_PAGE_SIZE          ((size_t)0x200000)
+
+#define STAT_INC(stat)          __atomic_add_fetch(&(stat), 1, __ATOMIC_RELAXED)
 
 /*
  * States of each virtual memory byte.
@@ -149,11 +155,18 @@ struct Entry
 /*
  * A trampoline template.
  */
+struct LabelSet;
 struct Trampoline
 {
     const char *name;                   // Name (if applicable)
-    int prot:31;                        // Protections.
+    int prot:28;                        // Protections.
     int preload:1;                      // Pre-load trampoline?
+    int shared:1;                       // Position independent (shareable)?
+    int macro:1;                        // Uses macros?
+    int instruction:1;                  // Uses $instruction?
+    int size;                           // Static size (or -1 if dynamic).
+    Bounds bounds;                      // Static bounds (if size >= 0).
+    const LabelSet *labels;             // Static labels (if size >= 0).
     unsigned num_entries;               // Number of entries.
                                         // Entries.
     Entry entries[];
@@ -183,6 +196,7 @@ struct Instr
     const size_t pcrel32_idx:4;         // 32bit PC-relative imm idx (or 0)
     const size_t pcrel8_idx:4;          // 8bit PC-relative imm idx (or 0)
     const size_t pic:1;                 // PIC? (stored here for convenience)
+    size_t hot:1;                       // Hot instruction? (--profile)
     const intptr_t addr;                // The address of the instruction
     intptr_t trampoline = INTPTR_MIN;   // The address of any trampoline
 
@@ -217,7 +231,7 @@ struct Instr
             size_t pcrel8_idx, bool pic) :
         offset((size_t)offset), addr(addr), size(size), original(original),
         patched(bytes, state), pcrel32_idx(pcrel32_idx),
-        pcrel8_idx(pcrel8_idx), pic(pic)
+        pcrel8_idx(pcrel8_idx), pic(pic), hot(0)
     {
         ;
     }
@@ -249,6 +263,40 @@ struct Tree
 struct Allocator
 {
     Tree tree;                  // Interval tree
+    intptr_t lb = INTPTR_MIN;   // Allocation lower bound
+    intptr_t ub = INTPTR_MAX;   // Allocation upper bound
+    unsigned stripes = 0;       // Number of stripes (0=no striping)
+    unsigned stripe = 0;        // Allocation stripe
+
+    /*
+     * Node slab.
+     */
+    struct
+    {
+        void *free = nullptr;   // Node free list
+        void *chunk = nullptr;  // Current chunk
+        size_t used = 0;        // Nodes used in the current chunk
+        size_t nodes = 0;       // Live nodes
+        size_t peak = 0;        // Peak live nodes
+        size_t slots = 0;       // Nodes carved from chunks
+        size_t bytes = 0;       // Bytes reserved for chunks
+        std::vector<void *> chunks;
+                                // All chunks
+    } slab;
+
+    /*
+     * Shared trampolines, indexed by contents and then address.  Each
+     * entry holds the node and its reference count.
+     */
+    std::unordered_map<std::string,
+        std::map<intptr_t, std::pair<Node *, unsigned>>> shared;
+
+    /*
+     * Open huge page windows (--huge-pages) and hot windows (--profile),
+     * mapping the lower bound to the upper bound.
+     */
+    std::map<intptr_t, intptr_t> windows;
+    std::map<intptr_t, intptr_t> hot;
 
     /*
      * Iterators.
@@ -295,6 +343,8 @@ struct Allocator
     {
         tree.root = nullptr;
     }
+    Allocator(const Allocator &) = delete;
+    ~Allocator();
 };
 
 /*
@@ -305,6 +355,9 @@ struct ElfInfo
     Elf64_Ehdr *ehdr;               // EHDR (Elf header)
     Elf64_Phdr *phdr_note;          // PHDR PT_NOTE to be used for loader.
     Elf64_Phdr *phdr_dynamic;       // PHDR PT_DYNAMIC else nullptr.
+    off_t phdr_offset;              // Relocated PHDR table offset.
+    intptr_t phdr_addr;             // Relocated PHDR table address.
+    intptr_t load_lb;               // Lowest PT_LOAD address.
     bool pic;                       // Position independent?
 };
 
@@ -320,8 +373,59 @@ enum Mode
 /*
  * Binary representation.
  */
-typedef std::map<off_t, Instr *> InstrSet;
+#define INSTR_BLOCK_SIZE        4096
+#define INSTR_CHUNK_SIZE        1024
+
+/*
+ * Instruction set.  Instruction records are stored contiguously in large
+ * blocks, and are indexed by a flat sorted array split into chunks.  Since
+ * instructions are usually added in descending (e9tool) or ascending order,
+ * insertion is amortized O(1), and lookup is a binary search.  A descending
+ * run is buffered (in reverse) until it fills a new front chunk.
+ */
+struct InstrSet
+{
+    std::vector<std::vector<Instr *>> index;    // Sorted index chunks.
+    std::vector<Instr *> run;                   // Pending descending run.
+    std::vector<Instr *> blocks;                // Instruction storage.
+    size_t used = INSTR_BLOCK_SIZE;             // Records used in last block.
+    size_t count = 0;                           // Number of instructions.
+
+    void *alloc();
+    void insert(Instr *I);
+    void flush();
+    Instr *find(off_t offset) const;
+    Instr *lowerBound(off_t offset) const;
+    Instr *back() const
+    {
+        return (count == 0? nullptr: index.back().back());
+    }
+    size_t size() const
+    {
+        return count;
+    }
+};
+
+/*
+ * Page set.  A bitmap of the pages (by file offset) of the patched binary
+ * that have been modified.  Insertion is thread-safe.
+ */
+struct PageSet
+{
+    std::vector<uint64_t> bits;                 // Page bitmap.
+
+    void resize(size_t size);
+    void insert(off_t offset, size_t size);
+    bool contains(off_t offset) const
+    {
+        size_t page = (size_t)offset / PAGE_SIZE;
+        return ((bits[page / 64] >> (page % 64)) & 0x1) != 0;
+    }
+    off_t next(off_t offset) const;
+};
+
 typedef std::deque<std::pair<Instr *, const Trampoline *>> PatchQueue;
+typedef std::vector<std::pair<Instr *, const Trampoline *>> PatchList;
 typedef std::map<const char *, Trampoline *, CStrCmp> TrampolineSet;
 typedef std::vector<intptr_t> InitSet;
 struct Binary
@@ -345,11 +449,14 @@ struct Binary
 
     intptr_t cursor;                    // Patching cursor.
     PatchQueue Q;                       // Instructions queued for patching.
+    PatchList pending;                  // Patches pending (parallel mode).
 
     InstrSet Is;                        // All (known) instructions.
+    PageSet dirty;                      // Modified pages.
     TrampolineSet Ts;                   // All current trampoline instrument.
     
     Allocator allocator;                // Virtual address allocation.
+    std::unordered_set<intptr_t> hot;   // Hot instruction addresses.
 
     InitSet inits;                      // Initialization functions.
     intptr_t mmap = INTPTR_MIN;         // Mmap function.
@@ -366,12 +473,18 @@ extern bool option_disable_T1;
 extern bool option_disable_T2;
 extern bool option_disable_T3;
 extern bool option_experimental;
+extern bool option_huge_pages;
+extern bool option_lazy_load;
+extern bool option_load_segments;
 extern bool option_static_loader;
 extern bool option_same_page;
 extern bool option_trap_all;
 extern bool option_use_stack;
 extern intptr_t option_lb;
 extern intptr_t option_ub;
+extern unsigned option_threads;
+extern unsigned option_mapping_effort;
+extern const char *option_profile;
 
 /*
  * Global statistics.
@@ -387,6 +500,32 @@ extern size_t stat_num_virtual_mappings;
 extern size_t stat_num_physical_mappings;
 extern size_t stat_num_virtual_bytes;
 extern size_t stat_num_physical_bytes;
+extern size_t stat_num_mmaps;
+extern size_t stat_num_coalesced;
+extern size_t stat_num_segments;
+extern size_t stat_num_lazy_mappings;
+extern size_t stat_num_lazy_reservations;
+extern size_t stat_num_huge_regions;
+extern size_t stat_num_huge_trampolines;
+extern size_t stat_num_hot_trampolines;
+extern size_t stat_num_hot_pages;
+extern size_t stat_num_greedy_mappings;
+extern size_t stat_num_greedy_bytes;
+extern size_t stat_num_patches;
+extern size_t stat_num_patch_allocs;
+extern size_t stat_num_windows;
+extern size_t stat_num_deferred;
+extern size_t stat_num_nodes;
+extern size_t stat_num_peak_nodes;
+extern size_t stat_num_node_slots;
+extern size_t stat_num_node_bytes;
+extern size_t stat_num_shared;
+extern size_t stat_num_shared_bytes;
+extern size_t stat_num_dirty_pages;
+extern size_t stat_num_dirty_ranges;
+extern size_t stat_num_pages;
+extern size_t stat_num_messages;
+extern size_t stat_num_message_bytes;
 extern size_t stat_input_file_size;
 extern size_t stat_output_file_size;
 
@@ -17,10 +17,14 @@
  */
 
 #include <cassert>
+#include <cerrno>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 
+#include <new>
+#include <vector>
+
 #include "e9alloc.h"
 #include "e9patch.h"
 #include "e9tactics.h"
@@ -38,7 +42,6 @@
  * This code uses short variable names.  See here for the key:
  *
  * A     = a virtual address space allocation (Alloc)
- * B     = the input binary to be rewritten (Binary)
  * I,J,K = instructions (Instr)
  * P,Q   = patches (Patch)
  * T,U   = trampoline (Trampoline)
@@ -85,6 +88,66 @@ struct Patch
     }
 };
 
+/*
+ * Patch arena.
+ *
+ * Most patch attempts fail and are immediately undone, so patches are
+ * bump-allocated from a reusable arena.  The whole attempt tree is released
+ * in O(1) by resetting the arena at the end of each patch() call.  Each
+ * thread has its own arena.
+ */
+#define ARENA_CHUNK_PATCHES         128
+
+struct PatchArena
+{
+    std::vector<Patch *> chunks;        // Arena chunks.
+    size_t chunk = 0;                   // Current chunk.
+    size_t used  = 0;                   // Patches used in current chunk.
+
+    ~PatchArena()
+    {
+        for (Patch *chunk: chunks)
+            free(chunk);
+    }
+};
+
+static thread_local PatchArena arena;
+
+/*
+ * Allocate a patch.
+ */
+static Patch *makePatch(Instr *I, Tactic t, const Alloc *A = nullptr)
+{
+    if (arena.chunk >= arena.chunks.size() ||
+            arena.used >= ARENA_CHUNK_PATCHES)
+    {
+        if (arena.chunk < arena.chunks.size())
+            arena.chunk++;
+        arena.used = 0;
+        if (arena.chunk >= arena.chunks.size())
+        {
+            void *ptr = malloc(ARENA_CHUNK_PATCHES * sizeof(Patch));
+            if (ptr == nullptr)
+                error("failed to allocate %zu bytes for patches: %s",
+                    ARENA_CHUNK_PATCHES * sizeof(Patch), strerror(ENOMEM));
+            arena.chunks.push_back((Patch *)ptr);
+            STAT_INC(stat_num_patch_allocs);
+        }
+    }
+    STAT_INC(stat_num_patches);
+    Patch *P = arena.chunks[arena.chunk] + arena.used++;
+    return new (P) Patch(I, t, A);
+}
+
+/*
+ * Release all patches.
+ */
+static void resetPatches()
+{
+    arena.chunk = 0;
+    arena.used  = 0;
+}
+
 /*
  * Convert a tactic to a string.
  */
@@ -119,42 +182,37 @@ static Instr *successor(const Instr *I)
 }
 
 /*
- * Commit a patch.
+ * Commit a patch.  The pages of all patched instructions are marked as
+ * dirty.
  */
-static void commit(Patch *P)
+static void commit(PageSet &dirty, Patch *P)
 {
+    for (const Patch *Q = P; Q != nullptr; Q = Q->next)
+        dirty.insert((off_t)Q->I->offset, Q->I->size);
     switch (P->tactic)
     {
         case TACTIC_B1:
-            stat_num_B1++;
+            STAT_INC(stat_num_B1);
             break;
         case TACTIC_B2:
-            stat_num_B2++;
+            STAT_INC(stat_num_B2);
             break;
         case TACTIC_T1:
-            stat_num_T1++;
+            STAT_INC(stat_num_T1);
             break;
         case TACTIC_T2:
-            stat_num_T2++;
+            STAT_INC(stat_num_T2);
             break;
         case TACTIC_T3:
-            stat_num_T3++;
+            STAT_INC(stat_num_T3);
             break;
     }
-
-    while (P != nullptr)
-    {
-        // Delete the P (we do not need it anymore)
-        Patch *Q = P;
-        P = P->next;
-        delete Q;
-    }
 }
 
 /*
  * Undo the application of a patch.
  */
-static void undo(Binary &B, Patch *P)
+static void undo(Allocator &allocator, Patch *P)
 {
     while (P != nullptr)
     {
@@ -164,10 +222,8 @@ static void undo(Binary &B, Patch *P)
             P->I->patched.state[i] = P->original.state[i];
             P->I->patched.bytes[i] = P->original.bytes[i];
         }
-        deallocate(B.allocator, P->A);
-        Patch *Q = P;
+        deallocate(allocator, P->A);
         P = P->next;
-        delete Q;
     }
 }
 
@@ -257,23 +313,23 @@ static Bounds makeBounds(const Trampoline *T, const Instr *I, const Instr *J,
 /*
  * Allocate virtual address space for a punned jump.
  */
-static const Alloc *allocatePunnedJump(Binary &B, const Instr *I,
+static const Alloc *allocatePunnedJump(Allocator &allocator, const Instr *I,
     unsigned prefix, const Instr *J, const Trampoline *T)
 {
     for (unsigned i = 0; i <= /*sizeof(jmpq)=*/5; i++)
         if (I->patched.state[prefix + i] == STATE_QUEUED)
             return nullptr;
     auto b = makeBounds(T, I, J, prefix);
-    return allocate(B.allocator, b.lb, b.ub, T, J, option_same_page);
+    return allocate(allocator, b.lb, b.ub, T, J, option_same_page);
 }
 
 /*
  * Allocate virtual address space for a non-punned jump.
  */
-static const Alloc *allocateJump(Binary &B, const Instr *I,
+static const Alloc *allocateJump(Allocator &allocator, const Instr *I,
     const Trampoline *T)
 {
-    return allocatePunnedJump(B, I, /*prefix=*/0, I, T);
+    return allocatePunnedJump(allocator, I, /*prefix=*/0, I, T);
 }
 
 /*
@@ -379,15 +435,15 @@ static bool canInstrument(const Instr *I)
 /*
  * Tactic B1: replace the instruction with a jump.
  */
-static Patch *tactic_B1(Binary &B, Instr *I, const Trampoline *T,
+static Patch *tactic_B1(Allocator &allocator, Instr *I, const Trampoline *T,
     Tactic tactic = TACTIC_B1)
 {
     if (I->size < JMP_SIZE || option_disable_B1 || !canInstrument(I))
         return nullptr;
-    const Alloc *A = allocateJump(B, I, T);
+    const Alloc *A = allocateJump(allocator, I, T);
     if (A == nullptr)
         return nullptr;
-    Patch *P = new Patch(I, tactic, A);
+    Patch *P = makePatch(I, tactic, A);
     I->trampoline = A->lb;
     patchJump(P, /*offset=*/0);
     patchUnused(P, /*offset=sizeof(jmpq)=*/5);
@@ -397,15 +453,15 @@ static Patch *tactic_B1(Binary &B, Instr *I, const Trampoline *T,
 /*
  * Tactic B2: replace the instruction with a punned jump.
  */
-static Patch *tactic_B2(Binary &B, Instr *I, const Trampoline *T,
+static Patch *tactic_B2(Allocator &allocator, Instr *I, const Trampoline *T,
     Tactic tactic = TACTIC_B2)
 {
     if (I->size >= JMP_SIZE || option_disable_B2 || !canInstrument(I))
         return nullptr;
-    const Alloc *A = allocatePunnedJump(B, I, /*offset=*/0, I, T);
+    const Alloc *A = allocatePunnedJump(allocator, I, /*offset=*/0, I, T);
     if (A == nullptr)
         return nullptr;
-    Patch *P = new Patch(I, tactic, A);
+    Patch *P = makePatch(I, tactic, A);
     I->trampoline = A->lb;
     patchJump(P, /*offset=*/0);
     return P;
@@ -414,7 +470,7 @@ static Patch *tactic_B2(Binary &B, Instr *I, const Trampoline *T,
 /*
  * Tactic T1: replace the instruction with a prefixed punned jump.
  */
-static Patch *tactic_T1(Binary &B, Instr *I, const Trampoline *T,
+static Patch *tactic_T1(Allocator &allocator, Instr *I, const Trampoline *T,
     Tactic tactic = TACTIC_T1)
 {
     if (I->size >= JMP_SIZE || option_disable_T1 || !canInstrument(I))
@@ -425,10 +481,10 @@ static Patch *tactic_T1(Binary &B, Instr *I, const Trampoline *T,
                  I->patched.state[prefix] == STATE_FREE);
             prefix++)
     {
-        const Alloc *A = allocatePunnedJump(B, I, prefix, I, T);
+        const Alloc *A = allocatePunnedJump(allocator, I, prefix, I, T);
         if (A != nullptr)
         {
-            Patch *P = new Patch(I, tactic, A);
+            Patch *P = makePatch(I, tactic, A);
             I->trampoline = A->lb;
             patchJumpPrefix(P, prefix);
             patchJump(P, prefix);
@@ -441,7 +497,7 @@ static Patch *tactic_T1(Binary &B, Instr *I, const Trampoline *T,
 /*
  * Tactic T2: evict the successor instruction.
  */
-static Patch *tactic_T2(Binary &B, Instr *I, const Trampoline *T)
+static Patch *tactic_T2(Allocator &allocator, Instr *I, const Trampoline *T)
 {
     if (I->size >= JMP_SIZE || option_disable_T2 || !canInstrument(I))
         return nullptr;
@@ -452,19 +508,19 @@ static Patch *tactic_T2(Binary &B, Instr *I, const Trampoline *T)
         return nullptr;
     const Trampoline *U = evicteeTrampoline;
     Patch *Q = nullptr;
-    Q = (Q == nullptr? tactic_B2(B, J, U, TACTIC_T2): Q);
-    Q = (Q == nullptr? tactic_T1(B, J, U, TACTIC_T2): Q);
+    Q = (Q == nullptr? tactic_B2(allocator, J, U, TACTIC_T2): Q);
+    Q = (Q == nullptr? tactic_T1(allocator, J, U, TACTIC_T2): Q);
     if (Q == nullptr)
         return nullptr;
 
     // Step (2): Patch the instruction:
     Patch *P = nullptr;
-    P = (P == nullptr? tactic_B2(B, I, T, TACTIC_T2): P);
-    P = (P == nullptr? tactic_T1(B, I, T, TACTIC_T2): P);
+    P = (P == nullptr? tactic_B2(allocator, I, T, TACTIC_T2): P);
+    P = (P == nullptr? tactic_T1(allocator, I, T, TACTIC_T2): P);
 
     if (P == nullptr)
     {
-        undo(B, Q);
+        undo(allocator, Q);
         return nullptr;
     }
     P->tactic = TACTIC_T2;
@@ -476,7 +532,7 @@ static Patch *tactic_T2(Binary &B, Instr *I, const Trampoline *T)
 /*
  * Tactic T3 (single-byte instruction): evict a neighbour instruction.
  */
-static Patch *tactic_T3b(Binary &B, Instr *I, const Trampoline *T)
+static Patch *tactic_T3b(Allocator &allocator, Instr *I, const Trampoline *T)
 {
     // We can still use T3 on single-byte instructions, only if the next
     // byte interpreted as a short jmp rel8 happens to land in a suitable
@@ -521,10 +577,10 @@ static Patch *tactic_T3b(Binary &B, Instr *I, const Trampoline *T)
         case STATE_FREE:
         {
             // TODO: factor this code out...
-            A = allocatePunnedJump(B, J, i, I, T);
+            A = allocatePunnedJump(allocator, J, i, I, T);
             if (A == nullptr)
                 return nullptr;
-            P = new Patch(J, TACTIC_T3, A);
+            P = makePatch(J, TACTIC_T3, A);
             patchJump(P, i);
             if (state == STATE_FREE)
             {
@@ -535,13 +591,13 @@ static Patch *tactic_T3b(Binary &B, Instr *I, const Trampoline *T)
             // Step (2b): Attempt to evict J
             const Trampoline *U = evicteeTrampoline;
             Patch *Q = nullptr;
-            Q = (Q == nullptr? tactic_B1(B, J, U, TACTIC_T3): Q);
-            Q = (Q == nullptr? tactic_B2(B, J, U, TACTIC_T3): Q);
-            Q = (Q == nullptr? tactic_T1(B, J, U, TACTIC_T3): Q);
+            Q = (Q == nullptr? tactic_B1(allocator, J, U, TACTIC_T3): Q);
+            Q = (Q == nullptr? tactic_B2(allocator, J, U, TACTIC_T3): Q);
+            Q = (Q == nullptr? tactic_T1(allocator, J, U, TACTIC_T3): Q);
             if (Q == nullptr)
             {
                 // Eviction failed...
-                undo(B, P);
+                undo(allocator, P);
                 return nullptr;
             }
             Q->next = P;
@@ -553,7 +609,7 @@ static Patch *tactic_T3b(Binary &B, Instr *I, const Trampoline *T)
     }
 
     assert(A != nullptr);
-    Patch *Q = new Patch(I, TACTIC_T3);
+    Patch *Q = makePatch(I, TACTIC_T3);
     I->trampoline = A->lb;
     assert(I->patched.state[0] == STATE_INSTRUCTION);
     I->patched.state[0] = STATE_PATCHED;
@@ -566,10 +622,10 @@ static Patch *tactic_T3b(Binary &B, Instr *I, const Trampoline *T)
 /*
  * Tactic T3: evict a neighbour instruction.
  */
-static Patch *tactic_T3(Binary &B, Instr *I, const Trampoline *T)
+static Patch *tactic_T3(Allocator &allocator, Instr *I, const Trampoline *T)
 {
     if (I->size == 1)
-        return tactic_T3b(B, I, T);
+        return tactic_T3b(allocator, I, T);
     if (I->size >= JMP_SIZE || option_disable_T3 || !canInstrument(I))
         return nullptr;
 
@@ -650,11 +706,11 @@ static Patch *tactic_T3(Binary &B, Instr *I, const Trampoline *T)
                 case STATE_INSTRUCTION:
                 {
                     // Step (2a): Attempt to insert a jump here:
-                    A = allocatePunnedJump(B, J, i, I, T);
+                    A = allocatePunnedJump(allocator, J, i, I, T);
                     if (A == nullptr)
                         continue;
                     addr = J->addr + i;
-                    P = new Patch(J, TACTIC_T3, A);
+                    P = makePatch(J, TACTIC_T3, A);
                     patchJump(P, i);
                     if (state == STATE_FREE)
                     {
@@ -665,13 +721,16 @@ static Patch *tactic_T3(Binary &B, Instr *I, const Trampoline *T)
                     // Step (2b): Attempt to evict J
                     const Trampoline *U = evicteeTrampoline;
                     Patch *Q = nullptr;
-                    Q = (Q == nullptr? tactic_B1(B, J, U, TACTIC_T3): Q);
-                    Q = (Q == nullptr? tactic_B2(B, J, U, TACTIC_T3): Q);
-                    Q = (Q == nullptr? tactic_T1(B, J, U, TACTIC_T3): Q);
+                    Q = (Q == nullptr?
+                        tactic_B1(allocator, J, U, TACTIC_T3): Q);
+                    Q = (Q == nullptr?
+                        tactic_B2(allocator, J, U, TACTIC_T3): Q);
+                    Q = (Q == nullptr?
+                        tactic_T1(allocator, J, U, TACTIC_T3): Q);
                     if (Q == nullptr)
                     {
                         // Eviction failed...
-                        undo(B, P);
+                        undo(allocator, P);
                         P = nullptr;
                         continue;
                     }
@@ -689,7 +748,7 @@ static Patch *tactic_T3(Binary &B, Instr *I, const Trampoline *T)
 
     // Step (3): Insert a short jump to the trampoline jump:
     assert(A != nullptr);
-    Patch *Q = new Patch(I, TACTIC_T3);
+    Patch *Q = makePatch(I, TACTIC_T3);
     I->trampoline = A->lb;
     patchShortJump(Q, addr);
     patchUnused(Q, /*sizeof(short jmp)=*/2);
@@ -698,9 +757,12 @@ static Patch *tactic_T3(Binary &B, Instr *I, const Trampoline *T)
 }
 
 /*
- * Patch the instruction at the given offset.
+ * Patch the instruction at the given offset.  The modified pages are added
+ * to `dirty'.  If `evict' is false, then the tactics that evict neighbouring
+ * instructions (T2/T3) are not used.
  */
-bool patch(Binary &B, Instr *I, const Trampoline *T)
+bool patch(Allocator &allocator, PageSet &dirty, Instr *I,
+    const Trampoline *T, bool evict)
 {
     switch (I->patched.state[0])
     {
@@ -716,21 +778,21 @@ bool patch(Binary &B, Instr *I, const Trampoline *T)
     // Try all patching tactics in order B1/B2/T1/T2/T3:
     Patch *P = nullptr;
     if (P == nullptr)
-        P = tactic_B1(B, I, T);
-    if (P == nullptr)
-        P = tactic_B2(B, I, T);
-    if (P == nullptr)
-        P = tactic_T1(B, I, T);
+        P = tactic_B1(allocator, I, T);
     if (P == nullptr)
-        P = tactic_T2(B, I, T);
+        P = tactic_B2(allocator, I, T);
     if (P == nullptr)
-        P = tactic_T3(B, I, T);
+        P = tactic_T1(allocator, I, T);
+    if (P == nullptr && evict)
+        P = tactic_T2(allocator, I, T);
+    if (P == nullptr && evict)
+        P = tactic_T3(allocator, I, T);
 
     if (P == nullptr)
     {
         debug("failed to patch instruction at address 0x%lx (%zu)", I->addr,
             I->size);
-        printf("\33[31mX\33[0m");
+        resetPatches();
         return false;       // Failed :(
     }
 
@@ -738,8 +800,8 @@ bool patch(Binary &B, Instr *I, const Trampoline *T)
         "trampoline=" ADDRESS_FORMAT ".." ADDRESS_FORMAT "]",
         I->addr, I->size, getTacticName(P->tactic), ADDRESS(I->trampoline),
             ADDRESS(I->trampoline + getTrampolineSize(T, I)));
-    printf("\33[32m.\33[0m");
-    commit(P);
+    commit(dirty, P);
+    resetPatches();
     return true;            // Success!
 }
 
@@ -21,6 +21,7 @@
 
 #include "e9patch.h"
 
-bool patch(Binary &B, Instr *I, const Trampoline *T);
+bool patch(Allocator &allocator, PageSet &dirty, Instr *I,
+    const Trampoline *T, bool evict = true);
 
 #endif
@@ -30,6 +30,7 @@
 #include "e9x86_64.h"
 
 #define MACRO_DEPTH_MAX             128
+#define TRAMPOLINE_MEMO_SIZE        256
 
 /*
  * Bounds information.
@@ -64,6 +65,7 @@ void __attribute__((__constructor__(8000))) evicteeTrampolineInit(void)
     T->entries[1].kind   = ENTRY_CONTINUE;
     T->entries[1].length = 0;
     T->entries[1].bytes  = nullptr;
+    initTrampoline(T);
 
     evicteeTrampoline = T;
 }
@@ -71,7 +73,13 @@ void __attribute__((__constructor__(8000))) evicteeTrampolineInit(void)
 /*
  * Label set.
  */
-typedef std::map<const char *, off_t, CStrCmp> LabelSet;
+struct LabelSet : public std::map<const char *, off_t, CStrCmp>
+{
+    // Empty
+};
+
+static off_t buildLabelSet(const Trampoline *T, const Instr *I, off_t offset,
+    LabelSet &labels);
 
 /*
  * Lookup a macro value.
@@ -165,12 +173,67 @@ static int getTrampolineSize(const Trampoline *T, const Instr *I,
     return size;
 }
 
+/*
+ * Memoized trampoline size and bounds.  The size and bounds only depend on
+ * the template, the instruction "shape" (the instruction size and relocated
+ * size), and the metadata (for templates with macros).  Thus, the memo is a
+ * small direct-mapped table keyed by (trampoline, metadata, shape), which
+ * is shared by all instructions with the same shape.
+ */
+struct TrampolineMemo
+{
+    const Trampoline *T = nullptr;      // Trampoline.
+    const Metadata *meta = nullptr;     // Metadata (if T->macro).
+    int shape = 0;                      // Instruction shape.
+    bool size_valid = false;            // Size is valid?
+    bool bounds_valid = false;          // Bounds are valid?
+    int size;                           // Memoized size.
+    Bounds bounds;                      // Memoized bounds.
+};
+
+static thread_local TrampolineMemo memo[TRAMPOLINE_MEMO_SIZE];
+
+/*
+ * Lookup the memo entry for (T, I).
+ */
+static TrampolineMemo &lookupMemo(const Trampoline *T, const Instr *I)
+{
+    const Metadata *meta = (T->macro? I->metadata: nullptr);
+    int shape = (int)I->size;
+    if (T->instruction || T->macro)
+    {
+        int r = relocateInstr(I->addr, /*offset=*/0, I->original.bytes,
+            I->size, I->pic, nullptr);
+        shape = (r < 0? -1: shape + 16 * r);
+    }
+    size_t hash = ((uintptr_t)T >> 4) ^ ((uintptr_t)meta >> 3) ^
+        ((size_t)shape * 0x9E3779B1);
+    TrampolineMemo &m = memo[hash % TRAMPOLINE_MEMO_SIZE];
+    if (m.T != T || m.meta != meta || m.shape != shape)
+    {
+        m.T            = T;
+        m.meta         = meta;
+        m.shape        = shape;
+        m.size_valid   = false;
+        m.bounds_valid = false;
+    }
+    return m;
+}
+
 /*
  * Calculate trampoline size.
  */
 int getTrampolineSize(const Trampoline *T, const Instr *I)
 {
-    return getTrampolineSize(T, I, /*depth=*/0);
+    if (T->size >= 0)
+        return T->size;
+    TrampolineMemo &m = lookupMemo(T, I);
+    if (!m.size_valid)
+    {
+        m.size       = getTrampolineSize(T, I, /*depth=*/0);
+        m.size_valid = true;
+    }
+    return m.size;
 }
 
 /*
@@ -277,8 +340,77 @@ Bounds getTrampolineBounds(const Trampoline *T, const Instr *I)
 {
     if (T == evicteeTrampoline)
         return {INTPTR_MIN, INTPTR_MAX};
-    BoundsInfo b = getTrampolineBounds(T, I, /*depth=*/0);
-    return {b.lb, b.ub};
+    if (T->size >= 0)
+        return T->bounds;
+    TrampolineMemo &m = lookupMemo(T, I);
+    if (!m.bounds_valid)
+    {
+        BoundsInfo b   = getTrampolineBounds(T, I, /*depth=*/0);
+        m.bounds       = {b.lb, b.ub};
+        m.bounds_valid = true;
+    }
+    return m.bounds;
+}
+
+/*
+ * Initialize a trampoline template.  Templates that do not depend on the
+ * instruction or metadata have their size, bounds and labels calculated
+ * once here.
+ * Templates whose bytes do not depend on the trampoline address are marked
+ * as shared, meaning identical copies may be merged by the allocator.
+ */
+void initTrampoline(Trampoline *T)
+{
+    T->size   = -1;
+    T->labels = nullptr;
+    T->shared = !T->preload;
+    T->macro  = false;
+    T->instruction = false;
+    bool dynamic = false;
+    for (unsigned i = 0; i < T->num_entries; i++)
+    {
+        const Entry &entry = T->entries[i];
+        switch (entry.kind)
+        {
+            case ENTRY_INSTRUCTION_BYTES:
+                dynamic = true;
+                break;
+            case ENTRY_MACRO:
+                dynamic = true;
+                T->shared = false;
+                T->macro  = true;
+                break;
+            case ENTRY_INSTRUCTION:
+                dynamic = true;
+                T->shared = false;
+                T->instruction = true;
+                break;
+            case ENTRY_CONTINUE:
+            case ENTRY_TAKEN:
+                T->shared = false;
+                break;
+            case ENTRY_REL8:
+            case ENTRY_REL32:
+                // Only references to user labels are position independent.
+                if (!entry.use_label || entry.label[0] != '.' ||
+                        entry.label[1] != 'L' ||
+                        strcmp(entry.label, ".Lcontinue") == 0 ||
+                        strcmp(entry.label, ".Linstruction") == 0 ||
+                        strcmp(entry.label, ".Ltaken") == 0)
+                    T->shared = false;
+                break;
+            default:
+                break;
+        }
+    }
+    if (dynamic)
+        return;
+    BoundsInfo b = getTrampolineBounds(T, nullptr, /*depth=*/0);
+    LabelSet *labels = new LabelSet;
+    buildLabelSet(T, nullptr, /*offset=*/0, *labels);
+    T->size   = (int)b.size;
+    T->bounds = {b.lb, b.ub};
+    T->labels = labels;
 }
 
 /*
@@ -549,13 +681,19 @@ static void buildBytes(const Trampoline *T, const Instr *I,
 void flattenTrampoline(uint8_t *bytes, size_t size, int32_t offset32,
     const Trampoline *T, const Instr *I)
 {
-    LabelSet labels;
-    off_t offset = buildLabelSet(T, I, /*offset=*/0, labels);
+    LabelSet tmp;
+    const LabelSet *labels = T->labels;
+    off_t offset = T->size;
+    if (labels == nullptr)
+    {
+        offset = buildLabelSet(T, I, /*offset=*/0, tmp);
+        labels = &tmp;
+    }
     if ((size_t)offset != size)
     error("failed to flatten trampoline; buffer size (%zu) does not "
         "trampoline size (%zu)", (size_t)offset, size);
 
     Buffer buf(bytes, size);
-    buildBytes(T, I, offset32, labels, buf);
+    buildBytes(T, I, offset32, *labels, buf);
 }
 
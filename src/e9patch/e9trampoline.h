@@ -23,6 +23,7 @@
 
 #define TRAMPOLINE_MAX      4096
 
+void initTrampoline(Trampoline *T);
 int getTrampolineSize(const Trampoline *T, const Instr *I);
 Bounds getTrampolineBounds(const Trampoline *T, const Instr *I);
 void flattenTrampoline(uint8_t *buf, size_t, int32_t offset32,
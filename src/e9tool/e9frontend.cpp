@@ -1362,6 +1362,7 @@ namespace e9frontend
  */
 static bool option_is_tty      = false;
 static bool option_no_warnings = false;
+static bool option_binary      = false;
 
 /*
  * Backend info.
@@ -1430,6 +1431,17 @@ static char *strDup(const char *old_str, size_t n)
     return new_str;
 }
 
+/*
+ * Get the next message ID.
+ */
+static unsigned getMessageId(void)
+{
+    static unsigned next_id = 0;
+    unsigned id = next_id;
+    next_id++;
+    return id;
+}
+
 /*
  * Send message header.
  */
@@ -1444,9 +1456,7 @@ void e9frontend::sendMessageHeader(FILE *out, const char *method)
  */
 unsigned e9frontend::sendMessageFooter(FILE *out, bool sync)
 {
-    static unsigned next_id = 0;
-    unsigned id = next_id;
-    next_id++;
+    unsigned id = getMessageId();
     fprintf(out, "},\"id\":%u}\n", id);
     if (sync)
         fflush(out);
@@ -1564,12 +1574,218 @@ void e9frontend::sendCode(FILE *out, const char *code)
      fputc(']', out);
 }
 
+/*
+ * Binary messages.
+ *
+ * If the binary protocol is selected, the bulk messages (binary,
+ * instruction, patch, reserve, emit and generic trampoline messages) are
+ * sent as length-prefixed binary records rather than JSON.  The backend
+ * detects the encoding of each message, so plugins that build JSON messages
+ * using the low-level send*() functions above are unaffected.  See the
+ * E9Patch programming guide for the encoding.
+ */
+#define BINARY_MAGIC                    0xE9
+
+#define BINARY_METHOD_BINARY            0x01
+#define BINARY_METHOD_EMIT              0x02
+#define BINARY_METHOD_INSTRUCTION       0x03
+#define BINARY_METHOD_PATCH             0x05
+#define BINARY_METHOD_RESERVE           0x06
+#define BINARY_METHOD_TRAMPOLINE        0x07
+
+#define BINARY_PARAM_ABSOLUTE           0x01
+#define BINARY_PARAM_ADDRESS            0x02
+#define BINARY_PARAM_BYTES              0x03
+#define BINARY_PARAM_FILENAME           0x04
+#define BINARY_PARAM_FORMAT             0x05
+#define BINARY_PARAM_INIT               0x06
+#define BINARY_PARAM_LENGTH             0x07
+#define BINARY_PARAM_MAPPING_SIZE       0x08
+#define BINARY_PARAM_METADATA           0x09
+#define BINARY_PARAM_MMAP               0x0A
+#define BINARY_PARAM_MODE               0x0B
+#define BINARY_PARAM_NAME               0x0C
+#define BINARY_PARAM_OFFSET             0x0D
+#define BINARY_PARAM_PROTECTION         0x0E
+#define BINARY_PARAM_TEMPLATE           0x0F
+#define BINARY_PARAM_TRAMPOLINE         0x10
+#define BINARY_PARAM_ARRAY              0x80
+
+#define BINARY_TAG_JSON                 0x0D
+
+/*
+ * Binary message encoder.
+ */
+struct Encoder
+{
+    std::vector<uint8_t> buf;           // Encoded message
+
+    void putByte(uint8_t b)
+    {
+        buf.push_back(b);
+    }
+
+    void putVarint(uint64_t x)
+    {
+        while (x >= 0x80)
+        {
+            buf.push_back((uint8_t)(x | 0x80));
+            x >>= 7;
+        }
+        buf.push_back((uint8_t)x);
+    }
+
+    void putSigned(int64_t x)
+    {
+        putVarint(((uint64_t)x << 1) ^ (uint64_t)(x >> 63));
+    }
+
+    void putBlob(const void *data, size_t len)
+    {
+        putVarint(len);
+        const uint8_t *bytes = (const uint8_t *)data;
+        buf.insert(buf.end(), bytes, bytes + len);
+    }
+
+    void putString(const char *s)
+    {
+        putBlob(s, strlen(s));
+    }
+
+    void putNested(const Encoder &record)
+    {
+        putBlob(record.buf.data(), record.buf.size());
+    }
+};
+
+/*
+ * Start a binary message.
+ */
+static unsigned beginMessage(Encoder &record, uint8_t method)
+{
+    unsigned id = getMessageId();
+    record.buf.clear();
+    record.putByte(method);
+    record.putVarint(id);
+    return id;
+}
+
+/*
+ * Send a binary message.
+ */
+static void sendEncoded(FILE *out, const Encoder &record, bool sync = false)
+{
+    Encoder header;
+    header.putByte(BINARY_MAGIC);
+    header.putVarint(record.buf.size());
+    fwrite(header.buf.data(), sizeof(uint8_t), header.buf.size(), out);
+    fwrite(record.buf.data(), sizeof(uint8_t), record.buf.size(), out);
+    if (sync)
+        fflush(out);
+}
+
+/*
+ * Send binary parameters.
+ */
+static void sendIntegerParam(Encoder &record, uint8_t name, intptr_t i)
+{
+    Encoder value;
+    value.putSigned(i);
+    record.putByte(name);
+    record.putNested(value);
+}
+static void sendBoolParam(Encoder &record, uint8_t name, bool b)
+{
+    record.putByte(name);
+    record.putVarint(1);
+    record.putByte(b? 1: 0);
+}
+static void sendStringParam(Encoder &record, uint8_t name, const char *s)
+{
+    record.putByte(name);
+    record.putString(s);
+}
+static void sendBytesParam(Encoder &record, uint8_t name, const uint8_t *data,
+    size_t len)
+{
+    record.putByte(name);
+    record.putBlob(data, len);
+}
+
+/*
+ * Encode a template string (in the format accepted by sendCode()).  The
+ * string is sent as-is and is parsed by the backend's JSON template parser,
+ * so the template grammar is only implemented once.
+ */
+static void encodeCode(Encoder &record, const char *code)
+{
+    record.putByte(BINARY_TAG_JSON);
+    record.putString(code);
+}
+
+/*
+ * Send a template parameter.
+ */
+static void sendCodeParam(Encoder &record, uint8_t name, const char *code)
+{
+    Encoder value;
+    encodeCode(value, code);
+    record.putByte(name);
+    record.putNested(value);
+}
+
+/*
+ * Send a metadata parameter.
+ */
+static void encodeMetadata(Encoder &record, const Metadata *metadata)
+{
+    Encoder code;
+    for (unsigned i = 0; metadata[i].name != nullptr; i++)
+    {
+        std::string macro("$");
+        macro += metadata[i].name;
+        record.putString(macro.c_str());
+        code.buf.clear();
+        encodeCode(code, metadata[i].data);
+        record.putNested(code);
+    }
+}
+static void sendMetadataParam(Encoder &record, uint8_t name,
+    const Metadata *metadata)
+{
+    Encoder value;
+    encodeMetadata(value, metadata);
+    record.putByte(name);
+    record.putNested(value);
+}
+
+/*
+ * Send an "option" message that selects the binary protocol.
+ */
+static unsigned sendProtocolMessage(FILE *out)
+{
+    sendMessageHeader(out, "option");
+    sendParamHeader(out, "protocol");
+    sendString(out, "binary");
+    sendSeparator(out, /*last=*/true);
+    return sendMessageFooter(out, /*sync=*/true);
+}
+
 /*
  * Send a "binary" message.
  */
 static unsigned sendBinaryMessage(FILE *out, const char *mode,
     const char *filename)
 {
+    if (option_binary)
+    {
+        Encoder record;
+        unsigned id = beginMessage(record, BINARY_METHOD_BINARY);
+        sendStringParam(record, BINARY_PARAM_FILENAME, filename);
+        sendStringParam(record, BINARY_PARAM_MODE, mode);
+        sendEncoded(out, record, /*sync=*/true);
+        return id;
+    }
     sendMessageHeader(out, "binary");
     sendParamHeader(out, "filename");
     sendString(out, filename);
@@ -1586,6 +1802,16 @@ static unsigned sendBinaryMessage(FILE *out, const char *mode,
 static unsigned sendInstructionMessage(FILE *out, intptr_t addr,
     size_t size, off_t offset)
 {
+    if (option_binary)
+    {
+        Encoder record;
+        unsigned id = beginMessage(record, BINARY_METHOD_INSTRUCTION);
+        sendIntegerParam(record, BINARY_PARAM_ADDRESS, addr);
+        sendIntegerParam(record, BINARY_PARAM_LENGTH, (intptr_t)size);
+        sendIntegerParam(record, BINARY_PARAM_OFFSET, (intptr_t)offset);
+        sendEncoded(out, record);
+        return id;
+    }
     sendMessageHeader(out, "instruction");
     sendParamHeader(out, "address");
     sendInteger(out, addr);
@@ -1599,12 +1825,38 @@ static unsigned sendInstructionMessage(FILE *out, intptr_t addr,
     return sendMessageFooter(out);
 }
 
+/*
+ * Send instruction metadata.
+ */
+static void sendMetadata(FILE *out, const Metadata *metadata)
+{
+    sendMetadataHeader(out);
+    for (unsigned i = 0; metadata[i].name != nullptr; i++)
+    {
+        sendDefinitionHeader(out, metadata[i].name);
+        sendCode(out, metadata[i].data);
+        sendSeparator(out, (metadata[i+1].name == nullptr));
+    }
+    sendMetadataFooter(out);
+}
+
 /*
  * Send a "patch" message.
  */
 unsigned e9frontend::sendPatchMessage(FILE *out, const char *trampoline,
     off_t offset, const Metadata *metadata)
 {
+    if (option_binary)
+    {
+        Encoder record;
+        unsigned id = beginMessage(record, BINARY_METHOD_PATCH);
+        sendStringParam(record, BINARY_PARAM_TRAMPOLINE, trampoline);
+        if (metadata != nullptr)
+            sendMetadataParam(record, BINARY_PARAM_METADATA, metadata);
+        sendIntegerParam(record, BINARY_PARAM_OFFSET, (intptr_t)offset);
+        sendEncoded(out, record, /*sync=*/true);
+        return id;
+    }
     sendMessageHeader(out, "patch");
     sendParamHeader(out, "trampoline");
     sendString(out, trampoline);
@@ -1612,14 +1864,7 @@ unsigned e9frontend::sendPatchMessage(FILE *out, const char *trampoline,
     if (metadata != nullptr)
     {
         sendParamHeader(out, "metadata");
-        sendMetadataHeader(out);
-        for (unsigned i = 0; metadata[i].name != nullptr; i++)
-        {
-            sendDefinitionHeader(out, metadata[i].name);
-            sendCode(out, metadata[i].data);
-            sendSeparator(out, (metadata[i+1].name == nullptr));
-        }
-        sendMetadataFooter(out);
+        sendMetadata(out, metadata);
         sendSeparator(out);
     }
     sendParamHeader(out, "offset");
@@ -1628,12 +1873,244 @@ unsigned e9frontend::sendPatchMessage(FILE *out, const char *trampoline,
     return sendMessageFooter(out, /*sync=*/true);
 }
 
+/*
+ * Batched "instruction" and "patch" messages.
+ *
+ * Rather than sending one message per instruction/patch, the tuples are
+ * buffered and sent as a single "instruction" message and a single "patch"
+ * message with array parameters.  The batch must be flushed before any
+ * other message that depends on the batched instructions/patches.
+ */
+struct Batch
+{
+    std::vector<intptr_t> addrs;        // Instruction addresses
+    std::vector<intptr_t> lengths;      // Instruction lengths
+    std::vector<intptr_t> offsets;      // Instruction offsets
+    std::vector<const char *> trampolines;
+                                        // Patch trampolines
+    std::vector<intptr_t> locations;    // Patch offsets
+    std::vector<bool> have_metadata;    // Patch has metadata?
+    std::vector<std::string> metadata;  // Patch metadata (encoded)
+};
+static Batch batch;
+static size_t option_batch = 4096;
+
+/*
+ * Send a (JSON) integer array parameter.
+ */
+static void sendIntegerArray(FILE *out, const char *name,
+    const std::vector<intptr_t> &array, bool last = false)
+{
+    sendParamHeader(out, name);
+    putc('[', out);
+    for (size_t i = 0; i < array.size(); i++)
+    {
+        sendInteger(out, array[i]);
+        sendSeparator(out, (i+1 == array.size()));
+    }
+    putc(']', out);
+    sendSeparator(out, last);
+}
+
+/*
+ * Send a (binary) integer array parameter.
+ */
+static void sendIntegerArrayParam(Encoder &record, uint8_t name,
+    const std::vector<intptr_t> &array)
+{
+    Encoder value, elem;
+    value.putVarint(array.size());
+    for (auto i: array)
+    {
+        elem.buf.clear();
+        elem.putSigned(i);
+        value.putNested(elem);
+    }
+    record.putByte(name | BINARY_PARAM_ARRAY);
+    record.putNested(value);
+}
+
+/*
+ * Flush all batched messages.
+ */
+static void flushBatch(FILE *out)
+{
+    if (batch.addrs.size() > 0)
+    {
+        if (option_binary)
+        {
+            Encoder record;
+            beginMessage(record, BINARY_METHOD_INSTRUCTION);
+            sendIntegerArrayParam(record, BINARY_PARAM_ADDRESS, batch.addrs);
+            sendIntegerArrayParam(record, BINARY_PARAM_LENGTH, batch.lengths);
+            sendIntegerArrayParam(record, BINARY_PARAM_OFFSET, batch.offsets);
+            sendEncoded(out, record);
+        }
+        else
+        {
+            sendMessageHeader(out, "instruction");
+            sendIntegerArray(out, "address", batch.addrs);
+            sendIntegerArray(out, "length", batch.lengths);
+            sendIntegerArray(out, "offset", batch.offsets, /*last=*/true);
+            sendMessageFooter(out);
+        }
+        batch.addrs.clear();
+        batch.lengths.clear();
+        batch.offsets.clear();
+    }
+    if (batch.locations.size() == 0)
+        return;
+
+    size_t count = batch.locations.size();
+    bool same = true, have_metadata = false;
+    for (size_t i = 0; i < count; i++)
+    {
+        same = same && (strcmp(batch.trampolines[i],
+            batch.trampolines[0]) == 0);
+        have_metadata = have_metadata || batch.have_metadata[i];
+    }
+    if (option_binary)
+    {
+        Encoder record, value;
+        beginMessage(record, BINARY_METHOD_PATCH);
+        if (same)
+            sendStringParam(record, BINARY_PARAM_TRAMPOLINE,
+                batch.trampolines[0]);
+        else
+        {
+            value.putVarint(count);
+            for (auto trampoline: batch.trampolines)
+                value.putString(trampoline);
+            record.putByte(BINARY_PARAM_TRAMPOLINE | BINARY_PARAM_ARRAY);
+            record.putNested(value);
+        }
+        if (have_metadata)
+        {
+            value.buf.clear();
+            value.putVarint(count);
+            for (const auto &metadata: batch.metadata)
+                value.putBlob(metadata.data(), metadata.size());
+            record.putByte(BINARY_PARAM_METADATA | BINARY_PARAM_ARRAY);
+            record.putNested(value);
+        }
+        sendIntegerArrayParam(record, BINARY_PARAM_OFFSET, batch.locations);
+        sendEncoded(out, record, /*sync=*/true);
+    }
+    else
+    {
+        sendMessageHeader(out, "patch");
+        sendParamHeader(out, "trampoline");
+        if (same)
+            sendString(out, batch.trampolines[0]);
+        else
+        {
+            putc('[', out);
+            for (size_t i = 0; i < count; i++)
+            {
+                sendString(out, batch.trampolines[i]);
+                sendSeparator(out, (i+1 == count));
+            }
+            putc(']', out);
+        }
+        sendSeparator(out);
+        if (have_metadata)
+        {
+            sendParamHeader(out, "metadata");
+            putc('[', out);
+            for (size_t i = 0; i < count; i++)
+            {
+                if (batch.have_metadata[i])
+                    fputs(batch.metadata[i].c_str(), out);
+                else
+                    fputs("null", out);
+                sendSeparator(out, (i+1 == count));
+            }
+            putc(']', out);
+            sendSeparator(out);
+        }
+        sendIntegerArray(out, "offset", batch.locations, /*last=*/true);
+        sendMessageFooter(out, /*sync=*/true);
+    }
+    batch.trampolines.clear();
+    batch.locations.clear();
+    batch.have_metadata.clear();
+    batch.metadata.clear();
+}
+
+/*
+ * Send (or batch) an "instruction" message.
+ */
+static void queueInstructionMessage(FILE *out, intptr_t addr, size_t size,
+    off_t offset)
+{
+    if (option_batch == 0)
+    {
+        sendInstructionMessage(out, addr, size, offset);
+        return;
+    }
+    batch.addrs.push_back(addr);
+    batch.lengths.push_back((intptr_t)size);
+    batch.offsets.push_back((intptr_t)offset);
+}
+
+/*
+ * Send (or batch) a "patch" message.
+ */
+static void queuePatchMessage(FILE *out, const char *trampoline,
+    off_t offset, const Metadata *metadata)
+{
+    if (option_batch == 0)
+    {
+        sendPatchMessage(out, trampoline, offset, metadata);
+        return;
+    }
+    batch.trampolines.push_back(trampoline);
+    batch.locations.push_back((intptr_t)offset);
+    batch.have_metadata.push_back(metadata != nullptr);
+    batch.metadata.emplace_back();
+    if (metadata != nullptr)
+    {
+        std::string &str = batch.metadata.back();
+        if (option_binary)
+        {
+            Encoder value;
+            encodeMetadata(value, metadata);
+            str.assign((const char *)value.buf.data(), value.buf.size());
+        }
+        else
+        {
+            char *buf = nullptr;
+            size_t len = 0;
+            FILE *stream = open_memstream(&buf, &len);
+            if (stream == nullptr)
+                error("failed to open memory stream: %s", strerror(errno));
+            sendMetadata(stream, metadata);
+            fclose(stream);
+            str.assign(buf, len);
+            free(buf);
+        }
+    }
+    if (batch.locations.size() >= option_batch)
+        flushBatch(out);
+}
+
 /*
  * Send an "emit" message.
  */
 static unsigned sendEmitMessage(FILE *out, const char *filename,
     const char *format, size_t mapping_size)
 {
+    if (option_binary)
+    {
+        Encoder record;
+        unsigned id = beginMessage(record, BINARY_METHOD_EMIT);
+        sendStringParam(record, BINARY_PARAM_FILENAME, filename);
+        sendStringParam(record, BINARY_PARAM_FORMAT, format);
+        sendIntegerParam(record, BINARY_PARAM_MAPPING_SIZE,
+            (intptr_t)mapping_size);
+        sendEncoded(out, record, /*sync=*/true);
+        return id;
+    }
     sendMessageHeader(out, "emit");
     sendParamHeader(out, "filename");
     sendString(out, filename);
@@ -1653,6 +2130,17 @@ static unsigned sendEmitMessage(FILE *out, const char *filename,
 unsigned e9frontend::sendReserveMessage(FILE *out, intptr_t addr, size_t len,
     bool absolute)
 {
+    if (option_binary)
+    {
+        Encoder record;
+        unsigned id = beginMessage(record, BINARY_METHOD_RESERVE);
+        sendIntegerParam(record, BINARY_PARAM_ADDRESS, addr);
+        if (absolute)
+            sendBoolParam(record, BINARY_PARAM_ABSOLUTE, true);
+        sendIntegerParam(record, BINARY_PARAM_LENGTH, (intptr_t)len);
+        sendEncoded(out, record);
+        return id;
+    }
     sendMessageHeader(out, "reserve");
     sendParamHeader(out, "address");
     sendInteger(out, addr);
@@ -1676,6 +2164,24 @@ unsigned e9frontend::sendReserveMessage(FILE *out, intptr_t addr,
     const uint8_t *data, size_t len, int prot, intptr_t init, intptr_t mmap,
     bool absolute)
 {
+    if (option_binary)
+    {
+        Encoder record;
+        unsigned id = beginMessage(record, BINARY_METHOD_RESERVE);
+        sendIntegerParam(record, BINARY_PARAM_ADDRESS, addr);
+        record.putByte(BINARY_PARAM_PROTECTION);
+        record.putVarint(1);
+        record.putByte((uint8_t)(prot & (PROT_READ | PROT_WRITE | PROT_EXEC)));
+        if (init != 0x0)
+            sendIntegerParam(record, BINARY_PARAM_INIT, init);
+        if (mmap != 0x0)
+            sendIntegerParam(record, BINARY_PARAM_MMAP, mmap);
+        if (absolute)
+            sendBoolParam(record, BINARY_PARAM_ABSOLUTE, true);
+        sendBytesParam(record, BINARY_PARAM_BYTES, data, len);
+        sendEncoded(out, record, /*sync=*/true);
+        return id;
+    }
     sendMessageHeader(out, "reserve");
     sendParamHeader(out, "address");
     sendInteger(out, addr);
@@ -2212,6 +2718,21 @@ void e9frontend::sendELFFileMessage(FILE *out, const ELF *ptr, bool absolute)
         prot[1] = ((phdr->p_flags & PF_W) != 0? 'w': '-');
         prot[2] = ((phdr->p_flags & PF_X) != 0? 'x': '-');
 
+        if (option_binary)
+        {
+            std::vector<uint8_t> bytes(phdr->p_memsz, 0x0);
+            memcpy(bytes.data(), elf.data + phdr->p_offset, phdr->p_filesz);
+            int flags = ((phdr->p_flags & PF_R) != 0? PROT_READ: 0) |
+                        ((phdr->p_flags & PF_W) != 0? PROT_WRITE: 0) |
+                        ((phdr->p_flags & PF_X) != 0? PROT_EXEC: 0);
+            bool exec = ((phdr->p_flags & PF_X) != 0);
+            sendReserveMessage(out, phdr_base, bytes.data(), bytes.size(),
+                flags,
+                (exec && init >= phdr_base && init <= phdr_end? init: 0x0),
+                (exec && mmap >= phdr_base && mmap <= phdr_end? mmap: 0x0),
+                absolute);
+            continue;
+        }
         sendMessageHeader(out, "reserve");
         sendParamHeader(out, "address");
         sendInteger(out, phdr_base);
@@ -3058,6 +3579,15 @@ unsigned e9frontend::sendCallTrampolineMessage(FILE *out, const char *name,
 unsigned e9frontend::sendTrampolineMessage(FILE *out,
     const char *name, const char *template_)
 {
+    if (option_binary)
+    {
+        Encoder record;
+        unsigned id = beginMessage(record, BINARY_METHOD_TRAMPOLINE);
+        sendStringParam(record, BINARY_PARAM_NAME, name);
+        sendCodeParam(record, BINARY_PARAM_TEMPLATE, template_);
+        sendEncoded(out, record, /*sync=*/true);
+        return id;
+    }
     sendMessageHeader(out, "trampoline");
     sendParamHeader(out, "name");
     sendString(out, name);
@@ -891,14 +891,14 @@ static const char *buildMetadataString(FILE *out, char *buf, long *pos)
 /*
  * Lookup a value from a CSV file based on the matching.
  */
-static bool matchEval(csh handle, const MatchExpr *expr, const cs_insn *I,
-    intptr_t offset, const char *basename = nullptr,
-    const Record **record = nullptr);
+static bool matchRecord(csh handle, const MatchExpr *expr, const cs_insn *I,
+    intptr_t offset, const char *basename, const Record **record);
 static intptr_t lookupValue(csh handle, const Action *action,
     const cs_insn *I, intptr_t offset, const char *basename, intptr_t idx)
 {
     const Record *record = nullptr;
-    bool pass = matchEval(handle, action->match, I, offset, basename, &record);
+    bool pass = matchRecord(handle, action->match, I, offset, basename,
+        &record);
     if (!pass || record == nullptr)
         error("failed to lookup value from file \"%s.csv\"; matching is "
             "ambiguous", basename);
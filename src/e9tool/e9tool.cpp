@@ -26,10 +26,17 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 
+#include <algorithm>
+#include <deque>
 #include <regex>
+#include <map>
 #include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <fcntl.h>
 #include <getopt.h>
@@ -44,6 +51,7 @@
 #define PAGE_SIZE       4096
 
 #define MAX_ACTIONS     (1 << 10)
+#define MAX_CACHE_SIZE  ((size_t)1 << 28)
 
 #include "e9plugin.h"
 #include "e9frontend.cpp"
@@ -77,6 +85,60 @@ struct Location
     }
 };
 
+/*
+ * Decoded instruction cache.  Matched instructions are kept here (up to
+ * MAX_CACHE_SIZE bytes), so that they need not be disassembled again when
+ * sending patches.  Instructions that do not fit are disassembled again.
+ */
+struct CacheEntry
+{
+    off_t offset;                       // Instruction offset.
+    cs_insn insn;                       // Instruction.
+    cs_detail detail;                   // Instruction detail.
+};
+struct InsnCache
+{
+    size_t size = 0;                    // Cache size (bytes).
+    std::deque<CacheEntry> entries;     // Cache entries (sorted).
+};
+
+/*
+ * Add an instruction to the cache.  Returns `false' if the cache would
+ * exceed `max' bytes.
+ */
+static bool cacheInsn(InsnCache &cache, size_t max, off_t offset,
+    const cs_insn *I)
+{
+    if (cache.size + sizeof(CacheEntry) > max)
+        return false;
+    cache.entries.emplace_back();
+    CacheEntry &entry = cache.entries.back();
+    entry.offset = offset;
+    entry.insn   = *I;
+    if (I->detail != nullptr)
+    {
+        entry.detail = *I->detail;
+        entry.insn.detail = &entry.detail;
+    }
+    cache.size += sizeof(CacheEntry);
+    return true;
+}
+
+/*
+ * Find an instruction in the cache, or nullptr if it is not cached.
+ */
+static const cs_insn *findInsn(const InsnCache &cache, off_t offset)
+{
+    auto i = std::lower_bound(cache.entries.begin(), cache.entries.end(),
+        offset, [](const CacheEntry &entry, off_t offset)
+        {
+            return (entry.offset < offset);
+        });
+    if (i == cache.entries.end() || i->offset != offset)
+        return nullptr;
+    return &i->insn;
+}
+
 /*
  * Plugins.
  */
@@ -291,14 +353,27 @@ struct MatchTest
         Index<MatchValue> *values;
         std::set<Register> *regs;
     };
+    std::unordered_set<std::string> *literals;
 
     MatchTest(MatchKind match, int idx, MatchField field, MatchCmp cmp,
             Plugin *plugin, const char *basename) :
         match(match), field(field), idx(idx), cmp(cmp), basename(basename),
-        plugin(plugin)
+        plugin(plugin), literals(nullptr)
     {
         data = nullptr;
     }
+
+    ~MatchTest()
+    {
+        if (cmp == MATCH_CMP_IN)
+            delete regs;
+        else if (match == MATCH_ASSEMBLY || match == MATCH_MNEMONIC)
+            delete regex;
+        else
+            delete values;
+        delete literals;
+        free((void *)basename);
+    }
 };
 
 /*
@@ -545,6 +620,28 @@ static void parseValues(Parser &parser, MatchType type,
     }
 }
 
+/*
+ * Parse a regular expression that is a literal string or an alternation of
+ * literal strings, e.g., "jmp|call".  Such regular expressions are matched
+ * using a hash set rather than std::regex_match().  Returns nullptr if the
+ * regular expression is not of this form.
+ */
+static std::unordered_set<std::string> *parseLiterals(const std::string &str)
+{
+    if (str.find_first_of("^$\\.*+?()[]{}") != std::string::npos)
+        return nullptr;
+    auto *literals = new std::unordered_set<std::string>;
+    size_t i = 0;
+    while (true)
+    {
+        size_t j = str.find('|', i);
+        literals->insert(str.substr(i, (j == std::string::npos? j: j - i)));
+        if (j == std::string::npos)
+            return literals;
+        i = j + 1;
+    }
+}
+
 /*
  * Parse a match test.
  */
@@ -776,7 +873,9 @@ static MatchTest *parseTest(Parser &parser)
             default:
                 parser.unexpectedToken();
         }
-        test->regex = new std::regex(str);
+        test->literals = parseLiterals(str);
+        if (test->literals == nullptr)
+            test->regex = new std::regex(str);
     }
     else
     {
@@ -822,7 +921,29 @@ static MatchExpr *parseTestExpr(Parser &parser)
             break;
         default:
         {
+            // Identical tests are shared, which allows the compiled matching
+            // to evaluate them once per instruction.  Tests are identified
+            // by their (trimmed) source text, so equivalent tests with a
+            // different spelling (e.g., "mnemonic=jmp" and
+            // "mnemonic=\"jmp\"") are not shared.
+            static std::map<std::string, MatchTest *> tests;
+            size_t lb = parser.prev;
             MatchTest *test = parseTest(parser);
+            size_t ub = (parser.peek != TOKEN_ERROR? parser.prev: parser.pos);
+            while (lb < ub && isspace(parser.buf[lb]))
+                lb++;
+            std::string key(parser.buf + lb, ub - lb);
+            if (test->match != MATCH_RANDOM)
+            {
+                auto i = tests.find(key);
+                if (i != tests.end())
+                {
+                    delete test;
+                    test = i->second;
+                }
+                else
+                    tests.insert({key, test});
+            }
             expr = new MatchExpr(MATCH_OP_TEST, test);
             break;
         }
@@ -1626,37 +1747,33 @@ static MatchValue makeMatchValue(MatchKind match, int idx, MatchField field,
 }
 
 /*
- * Evaluate a matching.
+ * Per-thread matching state for compiled matchings (see compileMatch()).
+ * Test results and instruction facts (e.g., register accesses) are
+ * computed at most once per instruction.
  */
-static bool matchEval(csh handle, const MatchExpr *expr, const cs_insn *I,
-    intptr_t offset, const char *basename, const Record **record)
+struct MatchState
 {
-    if (expr == nullptr)
-        return true;
-    bool pass = false;
-    const MatchTest *test = nullptr;
-    switch (expr->op)
-    {
-        case MATCH_OP_NOT:
-            pass = matchEval(handle, expr->arg1, I, offset, nullptr, nullptr);
-            return !pass;
-        case MATCH_OP_AND:
-            pass = matchEval(handle, expr->arg1, I, offset, basename, record);
-            if (!pass)
-                return false;
-            return matchEval(handle, expr->arg2, I, offset, basename, record);
-        case MATCH_OP_OR:
-            pass = matchEval(handle, expr->arg1, I, offset, basename, record);
-            if (pass)
-                return true;
-            return matchEval(handle, expr->arg2, I, offset, basename, record);
-        case MATCH_OP_TEST:
-            test = expr->test;
-            break;
-        default:
-            return false;
-    }
+    unsigned gen = 0;                   // Current instruction generation.
+    std::vector<unsigned> gens;         // Test result generations.
+    std::vector<bool> results;          // Test results.
+    bool regs = false;                  // Register accesses computed?
+    cs_regs reads;                      // Registers read.
+    cs_regs writes;                     // Registers written.
+    uint8_t reads_len = 0;              // Number of registers read.
+    uint8_t writes_len = 0;             // Number of registers written.
+    std::vector<std::unordered_map<std::string, bool>> strings;
+                                        // Memoized mnemonic matches.
+};
 
+/*
+ * Evaluate a match test.  Non-literal mnemonic regexes are memoized in
+ * `memo' (if not nullptr).
+ */
+static bool matchTest(csh handle, const MatchTest *test, const cs_insn *I,
+    intptr_t offset, MatchState &state,
+    std::unordered_map<std::string, bool> *memo)
+{
+    bool pass = false;
     switch (test->match)
     {
         case MATCH_ASSEMBLY: case MATCH_MNEMONIC:
@@ -1669,8 +1786,25 @@ static bool matchEval(csh handle, const MatchExpr *expr, const cs_insn *I,
             char buf[BUFSIZ];
             const char *str = makeMatchString(test->match, I, buf,
                 sizeof(buf)-1);
-            std::cmatch cmatch;
-            pass = std::regex_match(str, cmatch, *test->regex);
+            if (test->literals != nullptr)
+                pass = (test->literals->find(str) != test->literals->end());
+            else if (memo != nullptr && test->match == MATCH_MNEMONIC)
+            {
+                auto i = memo->find(str);
+                if (i == memo->end())
+                {
+                    std::cmatch cmatch;
+                    pass = std::regex_match(str, cmatch, *test->regex);
+                    memo->insert({str, pass});
+                }
+                else
+                    pass = i->second;
+            }
+            else
+            {
+                std::cmatch cmatch;
+                pass = std::regex_match(str, cmatch, *test->regex);
+            }
             pass = (test->cmp == MATCH_CMP_NEQ? !pass: pass);
             break;
         }
@@ -1681,12 +1815,16 @@ static bool matchEval(csh handle, const MatchExpr *expr, const cs_insn *I,
                 pass = true;
                 break;
             }
-            cs_regs reads, writes;
-            uint8_t reads_len, writes_len;
-            cs_err err = cs_regs_access(handle, I, reads, &reads_len,
-                writes, &writes_len);
-            if (err != 0)
-                error("failed to get registers for instruction");
+            if (!state.regs)
+            {
+                cs_err err = cs_regs_access(handle, I, state.reads,
+                    &state.reads_len, state.writes, &state.writes_len);
+                if (err != 0)
+                    error("failed to get registers for instruction");
+                state.regs = true;
+            }
+            const uint16_t *reads = state.reads, *writes = state.writes;
+            uint8_t reads_len = state.reads_len, writes_len = state.writes_len;
             for (uint8_t i = 0; !pass && test->match != MATCH_WRITES &&
                     i < reads_len; i++)
             {
@@ -1751,20 +1889,6 @@ static bool matchEval(csh handle, const MatchExpr *expr, const cs_insn *I,
             }
             if (x.type == MATCH_TYPE_UNDEFINED)
                 pass = false;
-    
-            if (pass && basename != nullptr && record != nullptr && 
-                test->cmp == MATCH_CMP_EQ &&
-                strcmp(test->basename, basename) == 0)
-            {
-                auto i = test->values->find(x);
-                if (i != test->values->end())
-                {
-                    if (*record != nullptr && i->second != *record)
-                        error("failed to lookup value from file \"%s.csv\"; "
-                            "matching is ambiguous", basename);
-                    *record = i->second;
-                }
-            }
             break;
         }
         case MATCH_INVALID:
@@ -1776,66 +1900,333 @@ static bool matchEval(csh handle, const MatchExpr *expr, const cs_insn *I,
 }
 
 /*
- * Matching.
+ * Find the record of a CSV file `basename' selected by a matching (see
+ * lookupValue()).  The record is selected by the (non-negated) "==" tests
+ * that pass.  Returns the result of the matching.
  */
-static bool matchAction(csh handle, const Action *action, const cs_insn *I,
-    intptr_t offset)
+static bool matchRecord(csh handle, const MatchExpr *expr, const cs_insn *I,
+    intptr_t offset, const char *basename, const Record **record)
 {
-#if 0
-    // TODO: fix option_debug
-    if (option_debug)
+    if (expr == nullptr)
+        return true;
+    bool pass = false;
+    switch (expr->op)
     {
-        fprintf(stderr, "%s0x%lx%s [%s%s%s]:",
-            (option_is_tty? "\33[36m": ""),
-            I->address,
-            (option_is_tty? "\33[0m": ""),
-            I->mnemonic,
-            (I->op_str[0] == '\0'? "": " "),
-            I->op_str);
-    }
-#endif
-    bool pass = matchEval(handle, action->match, I, offset);
-#if 0
-        if (option_debug)
+        case MATCH_OP_NOT:
+            pass = matchRecord(handle, expr->arg1, I, offset, nullptr,
+                nullptr);
+            return !pass;
+        case MATCH_OP_AND:
+            pass = matchRecord(handle, expr->arg1, I, offset, basename,
+                record);
+            if (!pass)
+                return false;
+            return matchRecord(handle, expr->arg2, I, offset, basename,
+                record);
+        case MATCH_OP_OR:
+            pass = matchRecord(handle, expr->arg1, I, offset, basename,
+                record);
+            if (pass)
+                return true;
+            return matchRecord(handle, expr->arg2, I, offset, basename,
+                record);
+        case MATCH_OP_TEST:
+            break;
+        default:
+            return false;
+    }
+
+    const MatchTest *test = expr->test;
+    MatchState state;
+    pass = matchTest(handle, test, I, offset, state, nullptr);
+    if (!pass || basename == nullptr || record == nullptr ||
+            test->cmp != MATCH_CMP_EQ || test->basename == nullptr ||
+            strcmp(test->basename, basename) != 0)
+        return pass;
+    MatchValue x = makeMatchValue(test->match, test->idx, test->field, I,
+        offset, (test->match == MATCH_PLUGIN?  test->plugin->result: 0));
+    auto i = test->values->find(x);
+    if (i != test->values->end())
+    {
+        if (*record != nullptr && i->second != *record)
+            error("failed to lookup value from file \"%s.csv\"; "
+                "matching is ambiguous", basename);
+        *record = i->second;
+    }
+    return pass;
+}
+
+/*
+ * A compiled matching for all actions.  Each node evaluates a test, then
+ * continues with the next node for the result (false/true).  A negative
+ * next node is a final result: MATCH_REJECT, or MATCH_ACCEPT(i) for
+ * action i.  The program evaluates tests in the same order as the matching
+ * expressions with short-circuiting, and is tried for each action in turn.
+ *
+ * Actions that can only match specific mnemonics (e.g., "mnemonic=call")
+ * are dispatched by mnemonic: each mnemonic has its own entry node that
+ * only tries the actions that could possibly match it.  Instructions with
+ * other mnemonics start from the default entry node.
+ */
+#define MATCH_REJECT        (-1)
+#define MATCH_ACCEPT(i)     (-(int)(i) - 2)
+
+struct MatchNode
+{
+    const MatchTest *test;              // Test.
+    unsigned slot;                      // Test result slot.
+    bool memo;                          // Memoize the test result?
+    int next[2];                        // Next node (false/true).
+};
+struct MatchProgram
+{
+    std::vector<MatchNode> nodes;       // Program nodes.
+    int entry = MATCH_REJECT;           // Default entry node.
+    std::unordered_map<std::string, int> dispatch;
+                                        // Entry nodes by mnemonic.
+    unsigned num_slots = 0;             // Number of test result slots.
+    std::map<const MatchTest *, unsigned> slots;
+                                        // Test result slots.
+};
+
+/*
+ * A matching guard: the set of mnemonics a matching can possibly match,
+ * or any mnemonic.
+ */
+struct MatchGuard
+{
+    bool any = true;                    // Any mnemonic?
+    std::set<std::string> mnemonics;    // Else the possible mnemonics.
+};
+
+/*
+ * Compute the guard for a matching (or its negation if `neg').  The guard
+ * is conservative, i.e., any mnemonic not in the guard cannot match.
+ */
+static MatchGuard guardMatch(const MatchExpr *expr, bool neg = false)
+{
+    MatchGuard guard;
+    if (expr == nullptr)
+        return guard;
+    switch (expr->op)
+    {
+        case MATCH_OP_NOT:
+            return guardMatch(expr->arg1, !neg);
+        case MATCH_OP_AND: case MATCH_OP_OR:
         {
-            fprintf(stderr, " [%s%s%s]",
-                (option_is_tty? (pass? "\33[32m": "\33[31m"): ""),
-                entry.string.c_str(),
-                (option_is_tty? "\33[0m": ""));
+            MatchGuard guard1 = guardMatch(expr->arg1, neg);
+            MatchGuard guard2 = guardMatch(expr->arg2, neg);
+            if ((expr->op == MATCH_OP_AND) != neg)
+            {
+                if (guard1.any)
+                    return guard2;
+                if (guard2.any)
+                    return guard1;
+                guard.any = false;
+                for (const auto &mnemonic: guard1.mnemonics)
+                {
+                    if (guard2.mnemonics.find(mnemonic) !=
+                            guard2.mnemonics.end())
+                        guard.mnemonics.insert(mnemonic);
+                }
+                return guard;
+            }
+            if (guard1.any || guard2.any)
+                return guard;
+            guard.any = false;
+            guard.mnemonics.swap(guard1.mnemonics);
+            guard.mnemonics.insert(guard2.mnemonics.begin(),
+                guard2.mnemonics.end());
+            return guard;
         }
-        if (!pass)
-            break;
+        case MATCH_OP_TEST:
+        {
+            const MatchTest *test = expr->test;
+            if (test->match != MATCH_MNEMONIC || test->literals == nullptr)
+                return guard;
+            if ((test->cmp == MATCH_CMP_EQ && !neg) ||
+                    (test->cmp == MATCH_CMP_NEQ && neg))
+            {
+                guard.any = false;
+                guard.mnemonics.insert(test->literals->begin(),
+                    test->literals->end());
+            }
+            return guard;
+        }
+        default:
+            return guard;
     }
-    if (option_debug)
+}
+
+/*
+ * Compile a matching into `program' with the given true/false targets.
+ * Returns the entry node.
+ */
+static int compileMatch(MatchProgram &program, const MatchExpr *expr,
+    int T, int F)
+{
+    if (expr == nullptr)
+        return T;
+    switch (expr->op)
     {
-        if (!pass)
+        case MATCH_OP_NOT:
+            return compileMatch(program, expr->arg1, F, T);
+        case MATCH_OP_AND:
         {
-            fputc('\n', stderr);
-            return false;
+            int entry = compileMatch(program, expr->arg2, T, F);
+            return compileMatch(program, expr->arg1, entry, F);
+        }
+        case MATCH_OP_OR:
+        {
+            int entry = compileMatch(program, expr->arg2, T, F);
+            return compileMatch(program, expr->arg1, T, entry);
         }
-        fprintf(stderr, " action %s%s%s\n",
-            (option_is_tty? "\33[33m": ""),
-            action->string.c_str(),
-            (option_is_tty? "\33[0m": ""));
+        case MATCH_OP_TEST:
+        {
+            // Identical tests share the same result slot (see parseTest()),
+            // except for "random", which must be evaluated each time.
+            const MatchTest *test = expr->test;
+            auto i = program.slots.find(test);
+            if (i == program.slots.end())
+                i = program.slots.insert({test, program.num_slots++}).first;
+            MatchNode node;
+            node.test    = test;
+            node.slot    = i->second;
+            node.memo    = (test->match != MATCH_RANDOM);
+            node.next[0] = F;
+            node.next[1] = T;
+            program.nodes.push_back(node);
+            return (int)program.nodes.size() - 1;
+        }
+        default:
+            return F;
     }
-#endif
-    return pass;
 }
 
 /*
- * Matching.
+ * Compile the matchings of the actions selected by `mnemonic' (nullptr for
+ * actions that may match any mnemonic).  Returns the entry node.  Compiled
+ * actions are shared between entry nodes with the same continuation.
+ */
+static int compileMatch(MatchProgram &program,
+    const std::vector<Action *> &actions,
+    const std::vector<MatchGuard> &guards, const std::string *mnemonic,
+    std::map<std::pair<size_t, int>, int> &compiled)
+{
+    int entry = MATCH_REJECT;
+    for (size_t i = actions.size(); i > 0; i--)
+    {
+        const MatchGuard &guard = guards[i-1];
+        if (!guard.any && (mnemonic == nullptr ||
+                guard.mnemonics.find(*mnemonic) == guard.mnemonics.end()))
+            continue;
+        auto key = std::make_pair(i-1, entry);
+        auto j = compiled.find(key);
+        if (j == compiled.end())
+        {
+            int action = compileMatch(program, actions[i-1]->match,
+                MATCH_ACCEPT(i-1), entry);
+            j = compiled.insert({key, action}).first;
+        }
+        entry = j->second;
+    }
+    return entry;
+}
+
+/*
+ * Compile the matchings of all actions.
+ */
+static void compileMatch(MatchProgram &program,
+    const std::vector<Action *> &actions)
+{
+    std::vector<MatchGuard> guards;
+    std::set<std::string> mnemonics;
+    for (const auto *action: actions)
+    {
+        guards.push_back(guardMatch(action->match));
+        const MatchGuard &guard = guards.back();
+        if (!guard.any)
+            mnemonics.insert(guard.mnemonics.begin(), guard.mnemonics.end());
+    }
+
+    std::map<std::pair<size_t, int>, int> compiled;
+    program.entry = compileMatch(program, actions, guards, nullptr, compiled);
+    for (const auto &mnemonic: mnemonics)
+        program.dispatch.insert({mnemonic,
+            compileMatch(program, actions, guards, &mnemonic, compiled)});
+
+    if (option_debug)
+        fprintf(stderr, "%sdebug%s: compiled %zu action(s) into %zu "
+            "node(s) with %zu dispatch entries\n",
+            (option_is_tty? "\33[35m": ""), (option_is_tty? "\33[0m": ""),
+            actions.size(), program.nodes.size(), program.dispatch.size());
+}
+
+/*
+ * Initialize the matching state for a compiled matching.
  */
-static int match(csh handle, const std::vector<Action *> &actions,
+static void initMatch(const MatchProgram &program, MatchState &state)
+{
+    state.gen = 0;
+    state.gens.assign(program.num_slots, 0);
+    state.results.assign(program.num_slots, false);
+    state.strings.resize(program.num_slots);
+}
+
+/*
+ * Get the entry node of a compiled matching for an instruction.  Only the
+ * mnemonic is used, so `I' need not have details.
+ */
+static int matchEntry(const MatchProgram &program, const cs_insn *I)
+{
+    if (program.dispatch.empty())
+        return program.entry;
+    auto i = program.dispatch.find(I->mnemonic);
+    return (i != program.dispatch.end()? i->second: program.entry);
+}
+
+/*
+ * Test if instructions can be prefiltered by mnemonic, i.e., disassembled
+ * without details first, and only disassembled again with details if some
+ * action can match the mnemonic (see matchEntry()).  This is only possible
+ * if every action is guarded by the mnemonic, and no plugin needs to see
+ * every instruction.
+ */
+static bool matchPrefilter(const MatchProgram &program)
+{
+    return (option_detail && !option_notify && plugins.empty() &&
+        program.entry == MATCH_REJECT);
+}
+
+/*
+ * Matching.  Returns the index of the first matching action, or -1.
+ */
+static int match(csh handle, const MatchProgram &program, MatchState &state,
     const cs_insn *I, off_t offset)
 {
-    int idx = 0;
-    for (const auto action: actions)
+    state.regs = false;
+    if (++state.gen == 0)
     {
-        if (matchAction(handle, action, I, offset))
-            return idx;
-        idx++;
+        std::fill(state.gens.begin(), state.gens.end(), 0);
+        state.gen = 1;
     }
-    return -1;
+    int pc = matchEntry(program, I);
+    while (pc >= 0)
+    {
+        const MatchNode &node = program.nodes[pc];
+        bool pass;
+        if (node.memo && state.gens[node.slot] == state.gen)
+            pass = state.results[node.slot];
+        else
+        {
+            pass = matchTest(handle, node.test, I, offset, state,
+                &state.strings[node.slot]);
+            state.gens[node.slot]    = state.gen;
+            state.results[node.slot] = pass;
+        }
+        pc = node.next[pass];
+    }
+    return -pc - 2;
 }
 
 /*
@@ -1856,10 +2247,273 @@ static bool sendInstructionMessage(FILE *out, Location &loc, intptr_t addr,
     off_t offset = text_offset + loc.offset;
     size_t size = loc.size;
 
-    sendInstructionMessage(out, addr, size, offset);
+    queueInstructionMessage(out, addr, size, offset);
     return true;
 }
 
+/*
+ * Open a capstone handle.
+ */
+static csh openHandle(bool detail)
+{
+    csh handle;
+    cs_err err = cs_open(CS_ARCH_X86, CS_MODE_64, &handle);
+    if (err != 0)
+        error("failed to open capstone handle (err = %u)", err);
+    if (detail)
+        cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+    if (option_syntax != "intel")
+        cs_option(handle, CS_OPT_SYNTAX, CS_OPT_SYNTAX_ATT);
+    cs_option(handle, CS_OPT_SKIPDATA, CS_OPT_ON);
+    return handle;
+}
+
+/*
+ * Test if a match expression uses "random".  Such matchings depend on the
+ * order of evaluation, so must be evaluated sequentially.
+ */
+static bool matchRandom(const MatchExpr *expr)
+{
+    if (expr == nullptr)
+        return false;
+    switch (expr->op)
+    {
+        case MATCH_OP_NOT:
+            return matchRandom(expr->arg1);
+        case MATCH_OP_AND: case MATCH_OP_OR:
+            return matchRandom(expr->arg1) || matchRandom(expr->arg2);
+        case MATCH_OP_TEST:
+            return (expr->test->match == MATCH_RANDOM);
+        default:
+            return false;
+    }
+}
+
+#define CHUNK_SIZE_MIN      (1 << 16)
+
+/*
+ * A chunk of the (.text) section (--threads).
+ */
+struct Chunk
+{
+    off_t lb = 0;                       // Chunk lower bound.
+    off_t ub = 0;                       // Chunk upper bound.
+    off_t end = 0;                      // Where disassembly stopped.
+    std::vector<Location> locs;         // Chunk instructions.
+    std::vector<off_t> failed;          // Chunk failed instructions.
+};
+
+/*
+ * Disassemble a chunk, starting from the chunk lower bound, and stopping at
+ * the first instruction at or beyond the chunk upper bound.  The lower
+ * bound need not be an instruction boundary, see mergeChunks().
+ */
+static void disasmChunk(const ELF *elf, Chunk *C)
+{
+    csh handle = openHandle(/*detail=*/false);
+    cs_insn *I = cs_malloc(handle);
+    const uint8_t *start = elf->data + elf->text_offset;
+    const uint8_t *code  = start + C->lb;
+    size_t size = elf->text_size - C->lb;
+    uint64_t address = elf->text_addr + C->lb;
+    C->end = C->lb;
+    while (C->end < C->ub &&
+            cs_disasm_iter(handle, &code, &size, &address, I))
+    {
+        if (I->mnemonic[0] == '.')
+            C->failed.push_back(C->end);
+        C->locs.emplace_back(C->end, I->size, false, 0);
+        C->end = code - start;
+    }
+    cs_free(I, 1);
+    cs_close(&handle);
+}
+
+/*
+ * Merge the chunks into the instruction sequence that would have been found
+ * by disassembling the (.text) section sequentially.  The sequence is
+ * resynchronized at each chunk boundary by disassembling from where the
+ * previous chunk stopped until an instruction boundary of the next chunk
+ * is found, which is usually after a few instructions.  Returns the offset
+ * where disassembly stopped.
+ */
+static off_t mergeChunks(csh handle, const ELF *elf,
+    const std::vector<Chunk> &chunks, std::vector<Location> &locs,
+    std::vector<off_t> &failed)
+{
+    const uint8_t *start = elf->data + elf->text_offset;
+    cs_insn *I = cs_malloc(handle);
+    off_t end = 0;
+    for (const auto &C: chunks)
+    {
+        auto i = C.locs.begin();
+        const uint8_t *code = start + end;
+        size_t size = elf->text_size - end;
+        uint64_t address = elf->text_addr + end;
+        while (i != C.locs.end() && (off_t)i->offset < end)
+            ++i;
+        while (end < C.ub && (i == C.locs.end() || (off_t)i->offset != end))
+        {
+            if (!cs_disasm_iter(handle, &code, &size, &address, I))
+            {
+                cs_free(I, 1);
+                return end;
+            }
+            if (I->mnemonic[0] == '.')
+                failed.push_back(end);
+            locs.emplace_back(end, I->size, false, 0);
+            end = code - start;
+            while (i != C.locs.end() && (off_t)i->offset < end)
+                ++i;
+        }
+        if (end >= C.ub)
+            continue;
+        locs.insert(locs.end(), i, C.locs.end());
+        failed.insert(failed.end(),
+            std::lower_bound(C.failed.begin(), C.failed.end(), end),
+            C.failed.end());
+        end = C.end;
+        if (end < C.ub)
+            break;
+    }
+    cs_free(I, 1);
+    return end;
+}
+
+/*
+ * Match a range of instructions (--threads).
+ */
+static void matchChunk(const ELF *elf, const MatchProgram *program,
+    Location *locs, size_t count, InsnCache *cache, size_t max)
+{
+    csh handle = openHandle(option_detail);
+    cs_insn *I = cs_malloc(handle);
+    bool prefilter = matchPrefilter(*program);
+    csh sweep = (prefilter? openHandle(/*detail=*/false): handle);
+    cs_insn *S = (prefilter? cs_malloc(sweep): I);
+    MatchState state;
+    initMatch(*program, state);
+    for (size_t i = 0; i < count; i++)
+    {
+        off_t offset = (off_t)locs[i].offset;
+        const uint8_t *code = elf->data + elf->text_offset + offset;
+        uint64_t address = (uint64_t)elf->text_addr + offset;
+        size_t size = locs[i].size;
+        bool ok = cs_disasm_iter(sweep, &code, &size, &address, S);
+        if (ok && prefilter)
+        {
+            if (matchEntry(*program, S) == MATCH_REJECT)
+                continue;
+            code = elf->data + elf->text_offset + offset;
+            address = (uint64_t)elf->text_addr + offset;
+            size = locs[i].size;
+            ok = cs_disasm_iter(handle, &code, &size, &address, I);
+        }
+        if (!ok)
+            error("failed to disassemble instruction at address 0x%lx",
+                elf->text_addr + offset);
+        int idx = match(handle, *program, state, I, offset);
+        locs[i] = Location(offset, I->size, (idx >= 0), idx);
+        if (idx >= 0)
+            cacheInsn(*cache, max, offset, I);
+    }
+    if (prefilter)
+    {
+        cs_free(S, 1);
+        cs_close(&sweep);
+    }
+    cs_free(I, 1);
+    cs_close(&handle);
+}
+
+/*
+ * Disassemble and match the (.text) section using multiple threads.  The
+ * section is split into one chunk per thread, and each chunk is
+ * disassembled in parallel.  The chunks are merged (sequentially), and the
+ * merged instructions are matched in parallel.  The result is identical to
+ * the sequential version.  Returns the offset where disassembly stopped.
+ */
+static off_t disasmParallel(csh handle, const ELF &elf,
+    const MatchProgram &program, unsigned threads, ssize_t sync,
+    std::vector<Location> &locs, InsnCache &cache, bool &failed)
+{
+    // Step (1): Disassemble the chunks in parallel:
+    size_t num_chunks = (elf.text_size + CHUNK_SIZE_MIN - 1) /
+        CHUNK_SIZE_MIN;
+    num_chunks = std::max(std::min(num_chunks, (size_t)threads), (size_t)1);
+    size_t chunk_size = (elf.text_size + num_chunks - 1) / num_chunks;
+    std::vector<Chunk> chunks(num_chunks);
+    for (size_t i = 0; i < num_chunks; i++)
+    {
+        chunks[i].lb = (off_t)std::min(i * chunk_size, elf.text_size);
+        chunks[i].ub = (off_t)std::min((i + 1) * chunk_size, elf.text_size);
+    }
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < num_chunks; i++)
+        workers.emplace_back(disasmChunk, &elf, &chunks[i]);
+    disasmChunk(&elf, &chunks[0]);
+    for (auto &worker: workers)
+        worker.join();
+    workers.clear();
+
+    // Step (2): Merge the chunks:
+    std::vector<Location> all;
+    std::vector<off_t> all_failed;
+    off_t end = mergeChunks(handle, &elf, chunks, all, all_failed);
+    chunks.clear();
+
+    // Step (3): Skip failed instructions (same as sequential):
+    cs_insn *I = cs_malloc(handle);
+    auto j = all_failed.begin();
+    unsigned skip = 0;
+    size_t count = 0;
+    for (const auto &loc: all)
+    {
+        off_t offset = (off_t)loc.offset;
+        bool bad = (j != all_failed.end() && *j == offset);
+        j += (bad? 1: 0);
+        if (skip > 0)
+        {
+            skip--;
+            continue;
+        }
+        if (bad)
+        {
+            const uint8_t *code = elf.data + elf.text_offset + offset;
+            uint64_t address = (uint64_t)elf.text_addr + offset;
+            size_t size = loc.size;
+            if (cs_disasm_iter(handle, &code, &size, &address, I))
+                warning("failed to disassemble (%s%s%s) at address 0x%lx",
+                    I->mnemonic, (I->op_str[0] == '\0'? "": " "),
+                    I->op_str, I->address);
+            failed = true;
+            skip = sync;
+            continue;
+        }
+        all[count++] = loc;
+    }
+    cs_free(I, 1);
+    all.resize(count, Location(0, 0, false, 0));
+    locs.swap(all);
+
+    // Step (4): Match the instructions in parallel:
+    size_t range = (count + num_chunks - 1) / num_chunks;
+    size_t max = MAX_CACHE_SIZE / num_chunks;
+    std::vector<InsnCache> caches(num_chunks);
+    for (size_t i = range, j = 1; i < count; i += range, j++)
+        workers.emplace_back(matchChunk, &elf, &program, locs.data() + i,
+            std::min(range, count - i), &caches[j], max);
+    matchChunk(&elf, &program, locs.data(), std::min(range, count),
+        &caches[0], max);
+    for (auto &worker: workers)
+        worker.join();
+    for (const auto &C: caches)
+        for (const auto &entry: C.entries)
+            cacheInsn(cache, MAX_CACHE_SIZE, entry.offset, &entry.insn);
+
+    return end;
+}
+
 /*
  * Convert a positon into an address.
  */
@@ -2209,6 +2863,13 @@ static void usage(FILE *stream, const char *progname)
     fputs("\t\tUse PROG as the backend.  The default is \"e9patch\".\n",
         stream);
     fputc('\n', stream);
+    fputs("\t--batch N\n", stream);
+    fputs("\t\tSend up to N patches (and the corresponding instructions)\n",
+        stream);
+    fputs("\t\tto the backend in each message.  A value of 0 disables\n",
+        stream);
+    fputs("\t\tbatching.  The default is 4096.\n", stream);
+    fputc('\n', stream);
     fputs("\t--compression N, -c N\n", stream);
     fputs("\t\tSet the compression level to be N, where N is a number within\n",
         stream);
@@ -2238,9 +2899,16 @@ static void usage(FILE *stream, const char *progname)
     fputs("\t--format FORMAT\n", stream);
     fputs("\t\tSet the output format to FORMAT which is one of {binary,\n",
         stream);
-    fputs("\t\tjson, patch, patch.gz, patch,bz2, patch.xz}.  Here:\n", stream);
+    fputs("\t\tdelta, delta.xz, json, patch, patch.gz, patch,bz2, "
+        "patch.xz}.\n", stream);
+    fputs("\t\tHere:\n", stream);
     fputc('\n', stream);
     fputs("\t\t\t- \"binary\" is a modified ELF executable file;\n", stream);
+    fputs("\t\t\t- \"delta\" and \"delta.xz\" are (compressed) "
+        "native\n", stream);
+    fputs("\t\t\t  binary deltas that can be applied to the input\n",
+        stream);
+    fputs("\t\t\t  binary using the e9apply tool;\n", stream);
     fputs("\t\t\t- \"json\" is the raw JSON RPC stream for the e9patch\n",
         stream);
     fputs("\t\t\t  backend; or\n", stream);
@@ -2264,6 +2932,17 @@ static void usage(FILE *stream, const char *progname)
         "is\n", stream);
     fputs("\t\t\"a.out\".\n", stream);
     fputc('\n', stream);
+    fputs("\t--protocol PROTOCOL\n", stream);
+    fputs("\t\tSet the protocol used to communicate with the e9patch\n",
+        stream);
+    fputs("\t\tbackend to PROTOCOL which is one of {json, binary}.  The\n",
+        stream);
+    fputs("\t\t\"binary\" protocol is more compact and faster to parse.\n",
+        stream);
+    fputs("\t\tThe \"json\" protocol is always used for the \"json\" "
+        "output\n", stream);
+    fputs("\t\tformat.  The default protocol is \"json\".\n", stream);
+    fputc('\n', stream);
     fputs("\t--shared\n", stream);
     fputs("\t\tTreat the input file as a shared library, even if it appears "
         "to\n", stream);
@@ -2307,6 +2986,17 @@ static void usage(FILE *stream, const char *progname)
     fputc('\n', stream);
     fputs("\t\tThe default syntax is \"ATT\".\n", stream);
     fputc('\n', stream);
+    fputs("\t--threads N\n", stream);
+    fputs("\t\tUse N threads to disassemble and match the (.text) "
+        "section.\n", stream);
+    fputs("\t\tThe result is the same as using a single thread.  "
+        "Plugins\n", stream);
+    fputs("\t\tand the \"random\" attribute require sequential "
+        "matching,\n", stream);
+    fputs("\t\tso this option is ignored if either is used.  The "
+        "default\n", stream);
+    fputs("\t\tis 1.\n", stream);
+    fputc('\n', stream);
     fputs("\t--trap-all\n", stream);
     fputs("\t\tInsert a trap (int3) instruction at each trampoline entry.\n",
         stream);
@@ -2321,6 +3011,7 @@ enum Option
 {
     OPTION_ACTION,
     OPTION_BACKEND,
+    OPTION_BATCH,
     OPTION_COMPRESSION,
     OPTION_DEBUG,
     OPTION_END,
@@ -2331,11 +3022,13 @@ enum Option
     OPTION_NO_WARNINGS,
     OPTION_OPTION,
     OPTION_OUTPUT,
+    OPTION_PROTOCOL,
     OPTION_SHARED,
     OPTION_START,
     OPTION_STATIC_LOADER,
     OPTION_SYNC,
     OPTION_SYNTAX,
+    OPTION_THREADS,
     OPTION_TRAP_ALL,
 };
 
@@ -2351,6 +3044,7 @@ int main(int argc, char **argv)
     {
         {"action",         true,  nullptr, OPTION_ACTION},
         {"backend",        true,  nullptr, OPTION_BACKEND},
+        {"batch",          true,  nullptr, OPTION_BATCH},
         {"compression",    true,  nullptr, OPTION_COMPRESSION},
         {"debug",          false, nullptr, OPTION_DEBUG},
         {"end",            true,  nullptr, OPTION_END},
@@ -2361,11 +3055,13 @@ int main(int argc, char **argv)
         {"no-warnings",    false, nullptr, OPTION_NO_WARNINGS},
         {"option",         true,  nullptr, OPTION_OPTION},
         {"output",         true,  nullptr, OPTION_OUTPUT},
+        {"protocol",       true,  nullptr, OPTION_PROTOCOL},
         {"shared",         false, nullptr, OPTION_SHARED},
         {"start",          true,  nullptr, OPTION_START},
         {"static-loader",  false, nullptr, OPTION_STATIC_LOADER},
         {"sync",           true,  nullptr, OPTION_SYNC},
         {"syntax",         true,  nullptr, OPTION_SYNTAX},
+        {"threads",        true,  nullptr, OPTION_THREADS},
         {"trap-all",       false, nullptr, OPTION_TRAP_ALL},
         {nullptr,          false, nullptr, 0}
     }; 
@@ -2374,8 +3070,9 @@ int main(int argc, char **argv)
     std::vector<char *> option_options;
     unsigned option_compression_level = 9;
     ssize_t option_sync = -1;
+    unsigned option_threads = 1;
     bool option_executable = false, option_shared = false,
-        option_static_loader = false;
+        option_static_loader = false, option_binary_protocol = false;
     std::string option_start(""), option_end(""), option_backend("./e9patch");
     MatchExpr *option_match = nullptr;
     while (true)
@@ -2397,6 +3094,18 @@ int main(int argc, char **argv)
             case OPTION_BACKEND:
                 option_backend = optarg;
                 break;
+            case OPTION_BATCH:
+            {
+                errno = 0;
+                char *end = nullptr;
+                unsigned long r = strtoul(optarg, &end, 10);
+                if (errno != 0 || end == optarg ||
+                        (end != nullptr && *end != '\0') || r > 1000000)
+                    error("bad value \"%s\" for `--batch' option; "
+                        "expected an integer 0..1000000", optarg);
+                option_batch = (size_t)r;
+                break;
+            }
             case OPTION_COMPRESSION:
             case 'c':
                 if (!isdigit(optarg[0]) || optarg[1] != '\0')
@@ -2416,14 +3125,17 @@ int main(int argc, char **argv)
             case OPTION_FORMAT:
                 option_format = optarg;
                 if (option_format != "binary" &&
+                        option_format != "delta" &&
+                        option_format != "delta.xz" &&
                         option_format != "json" &&
                         option_format != "patch" &&
                         option_format != "patch.gz" &&
                         option_format != "patch.bz2" &&
                         option_format != "patch.xz")
                     error("bad value \"%s\" for `--format' option; "
-                        "expected one of \"binary\", \"json\", \"patch\", "
-                        "\"patch.gz\", \"patch.bz2\", or \"patch.xz\"",
+                        "expected one of \"binary\", \"delta\", "
+                        "\"delta.xz\", \"json\", \"patch\", \"patch.gz\", "
+                        "\"patch.bz2\", or \"patch.xz\"",
                         optarg);
                 break;
             case OPTION_HELP:
@@ -2449,6 +3161,15 @@ int main(int argc, char **argv)
             case OPTION_NO_WARNINGS:
                 option_no_warnings = true;
                 break;
+            case OPTION_PROTOCOL:
+                if (strcmp(optarg, "binary") == 0)
+                    option_binary_protocol = true;
+                else if (strcmp(optarg, "json") == 0)
+                    option_binary_protocol = false;
+                else
+                    error("bad value \"%s\" for `--protocol' option; "
+                        "expected one of \"binary\" or \"json\"", optarg);
+                break;
             case OPTION_SHARED:
                 option_shared = true;
                 break;
@@ -2477,6 +3198,19 @@ int main(int argc, char **argv)
                     error("bad value \"%s\" for `--syntax' option; "
                         "expected \"ATT\" or \"intel\"", optarg);
                 break;
+            case OPTION_THREADS:
+            {
+                errno = 0;
+                char *end = nullptr;
+                unsigned long r = strtoul(optarg, &end, 10);
+                if (errno != 0 || end == optarg ||
+                        (end != nullptr && *end != '\0') || r < 1 ||
+                        r > 1024)
+                    error("bad value \"%s\" for `--threads' option; "
+                        "expected an integer 1..1024", optarg);
+                option_threads = (unsigned)r;
+                break;
+            }
             case OPTION_TRAP_ALL:
                 option_trap_all = true;
                 break;
@@ -2540,7 +3274,14 @@ int main(int argc, char **argv)
         }
     }
     else
+    {
         spawnBackend(option_backend.c_str(), option_options, backend);
+        if (option_binary_protocol)
+        {
+            sendProtocolMessage(backend.out);
+            option_binary = true;
+        }
+    }
     const char *mode = 
         (option_executable? "exe":
         (option_shared?     "dso":
@@ -2648,15 +3389,7 @@ int main(int argc, char **argv)
     /*
      * Disassemble the ELF file.
      */
-    csh handle;
-    cs_err err = cs_open(CS_ARCH_X86, CS_MODE_64, &handle);
-    if (err != 0)
-        error("failed to open capstone handle (err = %u)", err);
-    if (option_detail)
-        cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
-    if (option_syntax != "intel")
-        cs_option(handle, CS_OPT_SYNTAX, CS_OPT_SYNTAX_ATT);
-    cs_option(handle, CS_OPT_SKIPDATA, CS_OPT_ON);
+    csh handle = openHandle(option_detail);
 
     std::vector<Location> locs;
     const uint8_t *start = elf.data + elf.text_offset;
@@ -2664,38 +3397,77 @@ int main(int argc, char **argv)
     size_t size = elf.text_size;
     uint64_t address = elf.text_addr;
     cs_insn *I = cs_malloc(handle);
+    InsnCache cache;
+    MatchProgram program;
+    MatchState state;
+    compileMatch(program, option_actions);
+    initMatch(program, state);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
     bool failed = false;
     unsigned sync = 0;
-    while (cs_disasm_iter(handle, &code, &size, &address, I))
+    bool parallel = (option_threads > 1 && plugins.empty());
+    for (size_t i = 0; parallel && i < option_actions.size(); i++)
+        parallel = !matchRandom(option_actions[i]->match);
+    if (parallel)
+        code = start + disasmParallel(handle, elf, program,
+            option_threads, option_sync, locs, cache, failed);
+    bool prefilter = (!parallel && matchPrefilter(program));
+    csh sweep = (prefilter? openHandle(/*detail=*/false): handle);
+    cs_insn *S = (prefilter? cs_malloc(sweep): I);
+    while (!parallel && cs_disasm_iter(sweep, &code, &size, &address, S))
     {
         if (sync > 0)
         {
             sync--;
             continue;
         }
-        if (I->mnemonic[0] == '.')
+        if (S->mnemonic[0] == '.')
         {
             warning("failed to disassemble (%s%s%s) at address 0x%lx",
-                I->mnemonic, (I->op_str[0] == '\0'? "": " "), I->op_str,
-                I->address);
+                S->mnemonic, (S->op_str[0] == '\0'? "": " "), S->op_str,
+                S->address);
             failed = true;
             sync = option_sync;
             continue;
         }
 
         int idx = -1;
-        off_t offset = ((intptr_t)I->address - elf.text_addr);
+        off_t offset = ((intptr_t)S->address - elf.text_addr);
+        if (prefilter)
+        {
+            // Only disassemble with details if some action can match:
+            if (matchEntry(program, S) == MATCH_REJECT)
+            {
+                locs.emplace_back(offset, S->size, false, idx);
+                continue;
+            }
+            const uint8_t *code = start + offset;
+            uint64_t address = S->address;
+            size_t size = S->size;
+            bool ok = cs_disasm_iter(handle, &code, &size, &address, I);
+            if (!ok)
+                error("failed to disassemble instruction at address "
+                    "0x%lx", address);
+        }
 
         if (option_notify)
             notifyPlugins(backend.out, &elf, handle, offset, I);
         else
         {
             matchPlugins(backend.out, &elf, handle, offset, I);
-            idx = match(handle, option_actions, I, offset);
+            idx = match(handle, program, state, I, offset);
         }
 
         Location loc(offset, I->size, (idx >= 0), idx);
         locs.push_back(loc);
+        if (option_notify || idx >= 0)
+            cacheInsn(cache, MAX_CACHE_SIZE, offset, I);
+    }
+    if (prefilter)
+    {
+        cs_free(S, 1);
+        cs_close(&sweep);
     }
     if (code != end)
         error("failed to disassemble the full (.text) section 0x%lx..0x%lx; "
@@ -2716,8 +3488,10 @@ int main(int argc, char **argv)
     if (option_notify)
     {
         // The first disassembly pass was used for notifications.
-        // We employ a second disassembly pass for matching.
+        // We employ a second pass for matching, using the cached
+        // instructions from the first pass where possible.
  
+        InsnCache matched;
         size_t count = locs.size();
         for (size_t i = 0; i < count; i++)
         {
@@ -2725,20 +3499,46 @@ int main(int argc, char **argv)
             off_t text_offset = (off_t)loc.offset;
             uint64_t address = (uint64_t)elf.text_addr + text_offset;
             off_t offset = elf.text_offset + text_offset;
-            const uint8_t *code = elf.data + offset;
-            size_t size = loc.size;
-            bool ok = cs_disasm_iter(handle, &code, &size, &address, I);
-            if (!ok)
-                error("failed to disassemble instruction at address 0x%lx",
-                    address);
-            matchPlugins(backend.out, &elf, handle, offset, I);
-            int idx = match(handle, option_actions, I, offset);
+            const cs_insn *J = I;
+            bool cached = (!cache.entries.empty() &&
+                cache.entries.front().offset == text_offset);
+            if (cached)
+                J = &cache.entries.front().insn;
+            else
+            {
+                const uint8_t *code = elf.data + offset;
+                size_t size = loc.size;
+                bool ok = cs_disasm_iter(handle, &code, &size, &address, I);
+                if (!ok)
+                    error("failed to disassemble instruction at address "
+                        "0x%lx", address);
+            }
+            matchPlugins(backend.out, &elf, handle, offset, J);
+            int idx = match(handle, program, state, J, offset);
             if (idx >= 0)
             {
-                Location new_loc(text_offset, I->size, true, idx);
+                Location new_loc(text_offset, J->size, true, idx);
                 locs[i] = new_loc;
+                cacheInsn(matched, MAX_CACHE_SIZE - cache.size, text_offset,
+                    J);
+            }
+            if (cached)
+            {
+                cache.entries.pop_front();
+                cache.size -= sizeof(CacheEntry);
             }
         }
+        std::swap(cache, matched);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (option_debug)
+    {
+        double t = (double)(t1.tv_sec - t0.tv_sec) +
+            (double)(t1.tv_nsec - t0.tv_nsec) / 1.0e9;
+        fprintf(stderr, "%sdebug%s: disassembled and matched %zu "
+            "instructions in %.3fs (%.0f instructions/s)\n",
+            (option_is_tty? "\33[35m": ""), (option_is_tty? "\33[0m": ""),
+            locs.size(), t, (double)locs.size() / t);
     }
 
     /*
@@ -2755,13 +3555,19 @@ int main(int argc, char **argv)
         intptr_t addr = elf.text_addr + offset;
         offset += elf.text_offset;
 
-        // Disassmble the instruction again.
-        const uint8_t *code = elf.data + offset;
-        uint64_t address = (uint64_t)addr;
-        size_t size = loc.size;
-        bool ok = cs_disasm_iter(handle, &code, &size, &address, I);
-        if (!ok)
-            error("failed to disassemble instruction at address 0x%lx", addr);
+        // Disassmble the instruction again (if not cached).
+        const cs_insn *J = findInsn(cache, (off_t)loc.offset);
+        if (J == nullptr)
+        {
+            const uint8_t *code = elf.data + offset;
+            uint64_t address = (uint64_t)addr;
+            size_t size = loc.size;
+            bool ok = cs_disasm_iter(handle, &code, &size, &address, I);
+            if (!ok)
+                error("failed to disassemble instruction at address 0x%lx",
+                    addr);
+            J = I;
+        }
 
         bool done = false;
         for (ssize_t j = i; !done && j >= 0; j--)
@@ -2778,8 +3584,9 @@ int main(int argc, char **argv)
             // Special handling for plugins:
             if (action->plugin->patchFunc != nullptr)
             {
+                flushBatch(backend.out);
                 action->plugin->patchFunc(backend.out, &elf, handle, offset,
-                    I, action->context);
+                    J, action->context);
             }
         }
         else
@@ -2787,11 +3594,12 @@ int main(int argc, char **argv)
             // Builtin actions:
             char buf[4096];
             Metadata metadata_buf[MAX_ARGNO+1];
-            Metadata *metadata = buildMetadata(handle, action, I, offset,
+            Metadata *metadata = buildMetadata(handle, action, J, offset,
                 metadata_buf, buf, sizeof(buf)-1);
-            sendPatchMessage(backend.out, action->name, offset, metadata);
+            queuePatchMessage(backend.out, action->name, offset, metadata);
         }
     }
+    flushBatch(backend.out);
     cs_free(I, 1);
 
     /*
@@ -2803,7 +3611,12 @@ int main(int argc, char **argv)
     /*
      * Emit the final binary/patch file.
      */
-    if (option_format == "patch" && !hasSuffix(option_output, ".patch"))
+    if (option_format == "delta" && !hasSuffix(option_output, ".delta"))
+        option_output += ".delta";
+    else if (option_format == "delta.xz" &&
+            !hasSuffix(option_output, ".delta.xz"))
+        option_output += ".delta.xz";
+    else if (option_format == "patch" && !hasSuffix(option_output, ".patch"))
         option_output += ".patch";
     else if (option_format == "patch.gz" &&
             !hasSuffix(option_output, ".patch.gz"))